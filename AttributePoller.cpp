@@ -0,0 +1,356 @@
+#include "AttributePoller.h"
+#include "Debug.h"
+
+#define POLLER_TOKEN 1000 /** tokens per frame, tokens accrue per ms **/
+
+AttributePoller::AttributePoller(NetworkSender sender, PollResult result, uint8_t window, uint16_t framesPerSecond, uint8_t batch) {
+	this->networkSender = sender;
+	this->result = result;
+	this->window = window == 0 ? 1 : (window > POLLER_MAX_WINDOW ? POLLER_MAX_WINDOW : window);
+	this->framesPerSecond = framesPerSecond;
+	this->batch = batch == 0 ? 1 : (batch > POLLER_MAX_BATCH ? POLLER_MAX_BATCH : batch);
+	this->tokens = POLLER_TOKEN;
+	this->lastRefill = 0;
+	this->started = false;
+	this->nextRequest = 0;
+	this->lastNode = 0;
+	this->pending = 0;
+	this->sent = 0;
+	this->retries = 0;
+	for(uint16_t i = 0; i < POLLER_MAX_REQUESTS; i++) {
+		this->requests[i].state = POLL_FREE;
+	}
+	for(uint16_t i = 0; i < POLLER_MAX_NODES; i++) {
+		this->nodes[i].nodeID = 0;
+	}
+}
+
+AttributePoller::~AttributePoller() {
+	/* do nothing */
+}
+
+PollNode *AttributePoller::getNode(uint16_t nodeID, bool create) {
+	PollNode *idle = NULL;
+	for(uint16_t i = 0; i < POLLER_MAX_NODES; i++) {
+		PollNode *node = &(this->nodes[i]);
+		if(node->nodeID == nodeID) {
+			return node;
+		}
+		/* prefer unused slots, then ones with nothing pending */
+		if(node->nodeID == 0 && (idle == NULL || idle->nodeID != 0)) {
+			idle = node;
+		} else if(idle == NULL && node->outstanding == 0 && node->queued == 0) {
+			idle = node;
+		}
+	}
+	if(!create || idle == NULL) {
+		return NULL;
+	}
+
+	idle->nodeID = nodeID;
+	idle->outstanding = 0;
+	idle->queued = 0;
+	idle->srtt = 0;
+	idle->rttvar = 0;
+	idle->rto = POLLER_INITIAL_RTO;
+	return idle;
+}
+
+bool AttributePoller::request(uint16_t nodeID, AttributeIdentifier *attr) {
+	if(nodeID == 0) {
+		LOG(F("AttributePoller: cannot poll unregistered node\r\n"));
+		return false;
+	}
+	for(uint16_t i = 0; i < POLLER_MAX_REQUESTS; i++) {
+		PollRequest *request = &(this->requests[i]);
+		if(request->state == POLL_FREE) {
+			PollNode *node = this->getNode(nodeID, true);
+			if(node == NULL) {
+				LOG(F("AttributePoller: node table full\r\n"));
+				return false;
+			}
+			request->nodeID = nodeID;
+			request->attr = *attr;
+			request->state = POLL_QUEUED;
+			request->retries = 0;
+			node->queued++;
+			this->pending++;
+			return true;
+		}
+	}
+	LOG(F("AttributePoller: poll table full\r\n"));
+	return false;
+}
+
+bool AttributePoller::takeToken() {
+	if(this->framesPerSecond == 0) {
+		return true;
+	}
+	if(this->tokens < POLLER_TOKEN) {
+		return false;
+	}
+	this->tokens -= POLLER_TOKEN;
+	return true;
+}
+
+bool AttributePoller::sendRequest(PollRequest *batch[], uint8_t count, uint32_t now) {
+	uint8_t buffer[EMONCMS_MTU];
+	HeaderInfo *header = (HeaderInfo *)buffer;
+	uint16_t index = sizeof(HeaderInfo);
+
+	/* NID, then GID, AID, ATTRNUM for every polled attribute */
+	buffer[index++] = USHORT;
+	memcpy(&(buffer[index]), &(batch[0]->nodeID), sizeof(uint16_t));
+	index += sizeof(uint16_t);
+	for(uint8_t i = 0; i < count; i++) {
+		uint16_t values[3] = {
+			batch[i]->attr.groupID,
+			batch[i]->attr.attributeID,
+			batch[i]->attr.attributeNumber
+		};
+		for(uint8_t j = 0; j < 3; j++) {
+			buffer[index++] = USHORT;
+			memcpy(&(buffer[index]), &(values[j]), sizeof(uint16_t));
+			index += sizeof(uint16_t);
+		}
+		batch[i]->sentAt = now;
+	}
+
+	header->dataSize = index - sizeof(HeaderInfo);
+	header->status = SUCCESS;
+	header->dataCount = 1 + 3 * count;
+	this->sent++;
+	return this->networkSender(ATTR_POST, buffer, index) > 0;
+}
+
+void AttributePoller::complete(PollRequest *request, PollNode *node, uint8_t status, DataItem *value) {
+	if(node != NULL && node->outstanding > 0) {
+		node->outstanding--;
+	}
+	request->state = POLL_FREE;
+	this->pending--;
+	if(this->result != NULL) {
+		/* copy the identifier out so the slot can be reused by the callback */
+		AttributeIdentifier attr = request->attr;
+		this->result(request->nodeID, &attr, status, value);
+	}
+}
+
+void AttributePoller::sampleRoundTrip(PollNode *node, uint32_t rtt) {
+	/* Jacobson/Karels estimator as used for TCP retransmission timeouts */
+	if(node->srtt == 0 && node->rttvar == 0) {
+		node->srtt = rtt;
+		node->rttvar = rtt / 2;
+	} else {
+		uint32_t delta = node->srtt > rtt ? node->srtt - rtt : rtt - node->srtt;
+		node->rttvar = (3 * node->rttvar + delta) / 4;
+		node->srtt = (7 * node->srtt + rtt) / 8;
+	}
+	node->rto = node->srtt + 4 * node->rttvar;
+	if(node->rto < POLLER_MIN_RTO) {
+		node->rto = POLLER_MIN_RTO;
+	} else if(node->rto > POLLER_MAX_RTO) {
+		node->rto = POLLER_MAX_RTO;
+	}
+}
+
+void AttributePoller::poll(uint32_t now) {
+	if(this->framesPerSecond > 0) {
+		if(this->started) {
+			/* A full bucket takes at most this long, capping the product */
+			uint32_t elapsed = now - this->lastRefill;
+			if(elapsed > POLLER_MAX_BURST * POLLER_TOKEN) {
+				elapsed = POLLER_MAX_BURST * POLLER_TOKEN;
+			}
+			this->tokens += elapsed * this->framesPerSecond;
+			if(this->tokens > POLLER_MAX_BURST * POLLER_TOKEN) {
+				this->tokens = POLLER_MAX_BURST * POLLER_TOKEN;
+			}
+		}
+		this->lastRefill = now;
+		this->started = true;
+	}
+
+	/* Resend or give up on timed out requests first, each resend
+	 *  doubles the timeout for that request.
+	 */
+	for(uint16_t i = 0; i < POLLER_MAX_REQUESTS; i++) {
+		PollRequest *request = &(this->requests[i]);
+		if(request->state != POLL_OUTSTANDING) {
+			continue;
+		}
+		PollNode *node = this->getNode(request->nodeID, false);
+		uint32_t timeout = node->rto << request->retries;
+		if(timeout > POLLER_MAX_RTO) {
+			timeout = POLLER_MAX_RTO;
+		}
+		if((uint32_t)(now - request->sentAt) < timeout) {
+			continue;
+		}
+		if(request->retries >= POLLER_MAX_RETRIES) {
+			LOG(F("AttributePoller: no response from node\r\n"));
+			this->complete(request, node, FAILURE, NULL);
+		} else if(this->takeToken()) {
+			request->retries++;
+			this->retries++;
+			this->sendRequest(&request, 1, now);
+		}
+	}
+
+	/* Then fill each node's window, scanning round robin for fairness.
+	 *  The next scan starts past the last request served, or when out of
+	 *  tokens at the next node waiting other than the one served last, so
+	 *  a node with many polls queued can't hold back nodes after it.
+	 */
+	uint16_t start = this->nextRequest;
+	bool resumeFound = false;
+	for(uint16_t n = 0; n < POLLER_MAX_REQUESTS; n++) {
+		uint16_t i = (start + n) % POLLER_MAX_REQUESTS;
+		PollRequest *request = &(this->requests[i]);
+		if(request->state != POLL_QUEUED) {
+			continue;
+		}
+		PollNode *node = this->getNode(request->nodeID, false);
+		if(node->outstanding >= this->window) {
+			continue;
+		}
+		/* Like Nagle's algorithm, a partial batch waits while answers are
+		 *  still due so single answers don't lock the node into single polls.
+		 */
+		if(node->outstanding > 0 && (node->queued < this->batch || this->window - node->outstanding < this->batch)) {
+			continue;
+		}
+		if(resumeFound || !this->takeToken()) {
+			if(!resumeFound || request->nodeID != this->lastNode) {
+				this->nextRequest = i;
+			}
+			if(request->nodeID != this->lastNode) {
+				return;
+			}
+			resumeFound = true;
+			continue;
+		}
+
+		/* Coalesce further queued polls of the node while the window allows */
+		PollRequest *batch[POLLER_MAX_BATCH];
+		uint8_t count = 0;
+		for(uint16_t m = n; m < POLLER_MAX_REQUESTS && count < this->batch && node->outstanding < this->window; m++) {
+			PollRequest *next = &(this->requests[(start + m) % POLLER_MAX_REQUESTS]);
+			if(next->state == POLL_QUEUED && next->nodeID == request->nodeID) {
+				next->state = POLL_OUTSTANDING;
+				node->queued--;
+				node->outstanding++;
+				batch[count++] = next;
+			}
+		}
+		this->nextRequest = (i + 1) % POLLER_MAX_REQUESTS;
+		this->lastNode = request->nodeID;
+		if(!this->sendRequest(batch, count, now)) {
+			LOG(F("AttributePoller: error sending request\r\n"));
+		}
+	}
+}
+
+bool AttributePoller::match(uint16_t values[4], uint8_t status, DataItem *value, uint32_t now) {
+	for(uint16_t i = 0; i < POLLER_MAX_REQUESTS; i++) {
+		PollRequest *request = &(this->requests[i]);
+		if(request->state == POLL_OUTSTANDING && request->nodeID == values[0]
+				&& request->attr.groupID == values[1]
+				&& request->attr.attributeID == values[2]
+				&& request->attr.attributeNumber == values[3]) {
+			PollNode *node = this->getNode(request->nodeID, false);
+			/* Karn's rule: resent requests give ambiguous round trips */
+			if(request->retries == 0) {
+				this->sampleRoundTrip(node, now - request->sentAt);
+			}
+			this->complete(request, node, status, value);
+			return true;
+		}
+	}
+
+	/* most likely the late answer to a request that was resent */
+	return false;
+}
+
+bool AttributePoller::handleResponse(uint8_t type, uint8_t *buffer, uint16_t length, uint32_t now) {
+	if((type != ATTR_POST_RESPONSE && type != ATTR_MULTI_RESPONSE) || length < sizeof(HeaderInfo)) {
+		return false;
+	}
+
+	HeaderInfo *header = (HeaderInfo *)buffer;
+	DataItem items[EMONCMS_MTU / 2];
+	if(header->dataCount == 0 || header->dataCount > EMONCMS_MTU / 2) {
+		return false;
+	}
+	if(!EMonCMS::parseDataItems(header, &(buffer[sizeof(HeaderInfo)]), items, length - sizeof(HeaderInfo))) {
+		LOG(F("AttributePoller: truncated response\r\n"));
+		return false;
+	}
+
+	uint16_t values[4];
+	if(type == ATTR_POST_RESPONSE) {
+		/* Success responses are a post: NID, GID, AID, ATTRNUM, ATTRVAL,
+		 *  failures carry the status in the header and no value.
+		 */
+		bool success = header->status == SUCCESS;
+		if(header->dataCount != (success ? 5 : 4)) {
+			return false;
+		}
+		for(uint8_t i = 0; i < 4; i++) {
+			if(items[i].type != USHORT) {
+				return false;
+			}
+			memcpy(&(values[i]), items[i].item, sizeof(uint16_t));
+		}
+		return this->match(values, header->status, success ? &(items[4]) : NULL, now);
+	}
+
+	/* Multi responses are NID, then GID, AID, ATTRNUM, status and the
+	 *  value on success for every attribute.
+	 */
+	if(items[0].type != USHORT) {
+		return false;
+	}
+	memcpy(&(values[0]), items[0].item, sizeof(uint16_t));
+	bool matched = false;
+	uint16_t i = 1;
+	while(i + 4 <= header->dataCount) {
+		for(uint8_t j = 0; j < 3; j++) {
+			if(items[i + j].type != USHORT) {
+				return matched;
+			}
+			memcpy(&(values[j + 1]), items[i + j].item, sizeof(uint16_t));
+		}
+		if(items[i + 3].type != UCHAR) {
+			return matched;
+		}
+		uint8_t status = *(uint8_t *)(items[i + 3].item);
+		DataItem *value = NULL;
+		i += 4;
+		if(status == SUCCESS) {
+			if(i >= header->dataCount) {
+				return matched;
+			}
+			value = &(items[i++]);
+		}
+		matched = this->match(values, status, value, now) || matched;
+	}
+	return matched;
+}
+
+uint16_t AttributePoller::getPending() {
+	return this->pending;
+}
+
+uint32_t AttributePoller::getSent() {
+	return this->sent;
+}
+
+uint32_t AttributePoller::getRetries() {
+	return this->retries;
+}
+
+uint32_t AttributePoller::getTimeout(uint16_t nodeID) {
+	PollNode *node = this->getNode(nodeID, false);
+	return node == NULL ? POLLER_INITIAL_RTO : node->rto;
+}
@@ -0,0 +1,181 @@
+#ifndef __ATTRIBUTEPOLLER_H__
+#define __ATTRIBUTEPOLLER_H__
+
+#include "EMonCMS.h"
+
+#ifndef POLLER_MAX_NODES
+#define POLLER_MAX_NODES 16 /** nodes that can have polls queued at once **/
+#endif
+#ifndef POLLER_MAX_REQUESTS
+#define POLLER_MAX_REQUESTS 64 /** polls queued or outstanding over all nodes **/
+#endif
+#define POLLER_MAX_WINDOW 16 /** largest per node window of outstanding polls **/
+#ifndef POLLER_MAX_BURST
+#define POLLER_MAX_BURST 4 /** frames a paced poller may send back to back after idling **/
+#endif
+#define POLLER_MAX_RETRIES 3 /** resends before a poll is reported as failed **/
+#define POLLER_INITIAL_RTO 1000 /** ms timeout before any round trip is measured **/
+#define POLLER_MIN_RTO 200 /** ms lower bound of the adaptive timeout **/
+#define POLLER_MAX_RTO 10000 /** ms upper bound of the adaptive timeout **/
+#define POLLER_MAX_BATCH ((EMONCMS_MTU - 7) / 9) /** attributes fitting in one 'P' request **/
+
+/**
+ * User implemented event which is triggered when a poll completes.
+ * @param nodeID node the attribute was polled from
+ * @param attr the polled attribute
+ * @param status SUCCESS, the failure status from the node, or FAILURE
+ *  if the node never answered
+ * @param value the value on SUCCESS, pointing into the received packet,
+ *  otherwise NULL
+ **/
+typedef void (*PollResult)(uint16_t nodeID, AttributeIdentifier *attr, uint8_t status, DataItem *value);
+
+/**
+ * States of a slot in the poll table
+ **/
+enum PollState {
+	POLL_FREE = 0,
+	POLL_QUEUED,
+	POLL_OUTSTANDING
+};
+
+/**
+ * A queued or outstanding poll of one attribute
+ **/
+typedef struct {
+	uint16_t nodeID; /** node being polled **/
+	AttributeIdentifier attr; /** attribute being polled **/
+	uint8_t state; /** PollState **/
+	uint8_t retries; /** resends so far **/
+	uint32_t sentAt; /** ms time of the last send **/
+} PollRequest;
+
+/**
+ * Per node window and round trip estimate
+ **/
+typedef struct {
+	uint16_t nodeID; /** node, 0 if the slot is unused **/
+	uint8_t outstanding; /** polls sent and not yet answered **/
+	uint8_t queued; /** polls waiting for window space **/
+	uint32_t srtt; /** smoothed round trip time in ms, 0 before the first sample **/
+	uint32_t rttvar; /** round trip time variation in ms **/
+	uint32_t rto; /** current timeout in ms **/
+} PollNode;
+
+/**
+ * Gateway side scheduler issuing 'P' attribute requests to nodes. Each
+ * node has a window of outstanding requests so the channel isn't idle
+ * while waiting for replies, timeouts follow the measured round trip
+ * time, and sends over all nodes are paced by a token bucket.
+ *
+ * With batching, queued polls for the same node are coalesced into one
+ * multi attribute request and the node packs its answers into as few
+ * ATTR_MULTI_RESPONSE packets as it can.
+ *
+ * Requests carry the node ID as their first item; the NetworkSender is
+ * expected to address the frame from it.
+ **/
+class AttributePoller {
+	public:
+		/**
+		 * @param sender NetworkSender for the 'P' requests
+		 * @param result callback for completed polls
+		 * @param window outstanding requests allowed per node, up to POLLER_MAX_WINDOW
+		 * @param framesPerSecond global send rate, 0 for unpaced
+		 * @param batch polls coalesced per request, up to POLLER_MAX_BATCH,
+		 *  1 for single attribute requests that any node understands
+		 **/
+		AttributePoller(NetworkSender sender, PollResult result, uint8_t window, uint16_t framesPerSecond, uint8_t batch = 1);
+		~AttributePoller();
+		/**
+		 * Queues a poll of an attribute
+		 * @param nodeID node to poll
+		 * @param attr attribute to poll
+		 * @return false if the poll or node table is full
+		 **/
+		bool request(uint16_t nodeID, AttributeIdentifier *attr);
+		/**
+		 * Resends timed out requests, gives up on those out of retries and
+		 * sends queued requests as far as windows and pacing allow.
+		 * @param now current time in ms
+		 **/
+		void poll(uint32_t now);
+		/**
+		 * Matches a received 'p' or 'm' packet to its outstanding requests
+		 * @param type type of the received packet
+		 * @param buffer the whole packet, including header
+		 * @param length length of the packet
+		 * @param now current time in ms
+		 * @return true if it answered at least one outstanding request
+		 **/
+		bool handleResponse(uint8_t type, uint8_t *buffer, uint16_t length, uint32_t now);
+		/**
+		 * @return number of polls queued or outstanding
+		 **/
+		uint16_t getPending();
+		/**
+		 * @return number of requests sent, including resends
+		 **/
+		uint32_t getSent();
+		/**
+		 * @return number of resends after timeouts
+		 **/
+		uint32_t getRetries();
+		/**
+		 * @param nodeID node to look up
+		 * @return the current timeout for the node in ms
+		 **/
+		uint32_t getTimeout(uint16_t nodeID);
+	protected:
+		PollRequest requests[POLLER_MAX_REQUESTS]; /** poll table **/
+		PollNode nodes[POLLER_MAX_NODES]; /** nodes with polls in the table **/
+		NetworkSender networkSender; /** function to send requests **/
+		PollResult result; /** poll completion callback **/
+		uint8_t window; /** outstanding requests allowed per node **/
+		uint8_t batch; /** polls coalesced per request **/
+		uint16_t framesPerSecond; /** pacing rate, 0 for none **/
+		uint32_t tokens; /** pacing tokens, 1000 per frame **/
+		uint32_t lastRefill; /** ms time tokens were last added **/
+		bool started; /** whether lastRefill has been set **/
+		uint16_t nextRequest; /** slot to start the next send scan from **/
+		uint16_t lastNode; /** node sent to last **/
+		uint16_t pending; /** polls queued or outstanding **/
+		uint32_t sent; /** requests sent **/
+		uint32_t retries; /** resends **/
+
+		/**
+		 * Finds the node entry, optionally creating it
+		 * @return NULL if not found and none could be created
+		 **/
+		PollNode *getNode(uint16_t nodeID, bool create);
+		/**
+		 * Takes a pacing token if one is available
+		 * @return true if a frame may be sent
+		 **/
+		bool takeToken();
+		/**
+		 * Builds and sends one request for a batch of polls of a node
+		 * @param batch the polls, all for the same node
+		 * @param count number of polls
+		 * @return true if the sender accepted it
+		 **/
+		bool sendRequest(PollRequest *batch[], uint8_t count, uint32_t now);
+		/**
+		 * Completes the outstanding poll an answer is for
+		 * @param values NID, GID, AID, ATTRNUM of the answer
+		 * @param status status of the answer
+		 * @param value the value on SUCCESS
+		 * @return true if there was a matching poll
+		 **/
+		bool match(uint16_t values[4], uint8_t status, DataItem *value, uint32_t now);
+		/**
+		 * Frees a poll and reports its result
+		 **/
+		void complete(PollRequest *request, PollNode *node, uint8_t status, DataItem *value);
+		/**
+		 * Feeds a round trip sample into the node's timeout estimate
+		 **/
+		void sampleRoundTrip(PollNode *node, uint32_t rtt);
+};
+
+#endif
@@ -0,0 +1,282 @@
+#include "BulkUploader.h"
+#include "Debug.h"
+
+#define BULK_PREFIX "data=["
+#define BULK_PREFIX_LENGTH 6
+
+BulkUploader::BulkUploader(BulkSender sender, void *context, uint32_t maxAge) {
+	this->sender = sender;
+	this->context = context;
+	this->maxAge = maxAge;
+	this->filling = NULL;
+	this->sequence = 0;
+	this->readingsForwarded = 0;
+	this->bytesForwarded = 0;
+	this->readingsDropped = 0;
+	for(uint8_t i = 0; i < BULK_BUFFER_COUNT; i++) {
+		this->buffers[i].state = BULK_FREE;
+	}
+}
+
+BulkUploader::~BulkUploader() {
+	/* do nothing */
+}
+
+uint16_t BulkUploader::writeUnsigned(char *out, uint64_t value) {
+	char digits[20];
+	uint16_t count = 0;
+	do {
+		digits[count++] = '0' + (value % 10);
+		value /= 10;
+	} while(value > 0);
+	for(uint16_t i = 0; i < count; i++) {
+		out[i] = digits[count - 1 - i];
+	}
+	return count;
+}
+
+uint16_t BulkUploader::writeValue(char *out, DataItem *item) {
+	union {
+		int8_t c; uint8_t uc; int16_t s; uint16_t us;
+		int32_t i; uint32_t ui; int64_t l; uint64_t ul; float f;
+	} v;
+	int64_t whole;
+	uint16_t index = 0;
+
+	/* items point into the raw packet so may be unaligned */
+	switch(item->type) {
+		case CHAR: memcpy(&v.c, item->item, sizeof(v.c)); whole = v.c; break;
+		case UCHAR: memcpy(&v.uc, item->item, sizeof(v.uc)); whole = v.uc; break;
+		case SHORT: memcpy(&v.s, item->item, sizeof(v.s)); whole = v.s; break;
+		case USHORT: memcpy(&v.us, item->item, sizeof(v.us)); whole = v.us; break;
+		case INT: memcpy(&v.i, item->item, sizeof(v.i)); whole = v.i; break;
+		case UINT: memcpy(&v.ui, item->item, sizeof(v.ui)); whole = v.ui; break;
+		case LONG: memcpy(&v.l, item->item, sizeof(v.l)); whole = v.l; break;
+		case ULONG:
+			memcpy(&v.ul, item->item, sizeof(v.ul));
+			return this->writeUnsigned(out, v.ul);
+		case FLOAT:
+			memcpy(&v.f, item->item, sizeof(v.f));
+			/* JSON has no NaN or infinity, and huge values would overflow */
+			if(v.f != v.f || v.f > 1e15f || v.f < -1e15f) {
+				memcpy(out, "null", 4);
+				return 4;
+			}
+			if(v.f < 0) {
+				out[index++] = '-';
+				v.f = -v.f;
+			}
+			{
+				/* three decimal places, trailing zeros dropped */
+				uint64_t scaled = (uint64_t)((double)v.f * 1000.0 + 0.5);
+				index += this->writeUnsigned(&(out[index]), scaled / 1000);
+				uint16_t fraction = scaled % 1000;
+				if(fraction > 0) {
+					out[index++] = '.';
+					out[index++] = '0' + fraction / 100;
+					fraction %= 100;
+					if(fraction > 0) {
+						out[index++] = '0' + fraction / 10;
+						fraction %= 10;
+						if(fraction > 0) {
+							out[index++] = '0' + fraction;
+						}
+					}
+				}
+			}
+			return index;
+		default:
+			return 0;
+	}
+
+	if(whole < 0) {
+		out[index++] = '-';
+		return index + this->writeUnsigned(&(out[index]), (uint64_t)(-(whole + 1)) + 1);
+	}
+	return this->writeUnsigned(out, (uint64_t)whole);
+}
+
+BulkBuffer *BulkUploader::start(uint32_t now) {
+	for(uint8_t i = 0; i < BULK_BUFFER_COUNT; i++) {
+		BulkBuffer *buffer = &(this->buffers[i]);
+		if(buffer->state == BULK_FREE) {
+			memcpy(buffer->data, BULK_PREFIX, BULK_PREFIX_LENGTH);
+			buffer->length = BULK_PREFIX_LENGTH;
+			buffer->readings = 0;
+			buffer->attempts = 0;
+			buffer->created = now;
+			buffer->state = BULK_FILLING;
+			return buffer;
+		}
+	}
+	return NULL;
+}
+
+void BulkUploader::seal() {
+	if(this->filling == NULL) {
+		return;
+	}
+	this->filling->data[this->filling->length++] = ']';
+	this->filling->state = BULK_READY;
+	this->filling->sequence = this->sequence++;
+	this->filling->nextAttempt = 0;
+	this->filling = NULL;
+}
+
+bool BulkUploader::add(uint16_t nodeID, AttributeIdentifier *attr, DataItem *value, uint32_t timestamp, uint32_t now) {
+	/* Serialise the value first so non numeric items are rejected
+	 *  before anything is written to the payload.
+	 */
+	char number[32];
+	uint16_t numberLength = this->writeValue(number, value);
+	if(numberLength == 0) {
+		LOG(F("BulkUploader: value is not numeric\r\n"));
+		return false;
+	}
+
+	if(this->filling != NULL && this->filling->length + BULK_MAX_READING > BULK_BUFFER_SIZE) {
+		this->seal();
+	}
+	if(this->filling == NULL) {
+		this->filling = this->start(now);
+		if(this->filling == NULL) {
+			LOG(F("BulkUploader: no free buffer\r\n"));
+			return false;
+		}
+	}
+
+	BulkBuffer *buffer = this->filling;
+	char *out = buffer->data;
+	uint16_t index = buffer->length;
+
+	if(buffer->readings > 0 && buffer->lastNode == nodeID && buffer->lastTime == timestamp) {
+		/* Merge into the open entry by reopening its object */
+		index -= 2;
+		out[index++] = ',';
+	} else {
+		if(buffer->readings > 0) {
+			out[index++] = ',';
+		}
+		out[index++] = '[';
+		index += this->writeUnsigned(&(out[index]), timestamp);
+		out[index++] = ',';
+		index += this->writeUnsigned(&(out[index]), nodeID);
+		out[index++] = ',';
+		out[index++] = '{';
+		buffer->lastNode = nodeID;
+		buffer->lastTime = timestamp;
+	}
+
+	out[index++] = '"';
+	index += this->writeUnsigned(&(out[index]), attr->groupID);
+	out[index++] = '_';
+	index += this->writeUnsigned(&(out[index]), attr->attributeID);
+	out[index++] = '_';
+	index += this->writeUnsigned(&(out[index]), attr->attributeNumber);
+	out[index++] = '"';
+	out[index++] = ':';
+	memcpy(&(out[index]), number, numberLength);
+	index += numberLength;
+	out[index++] = '}';
+	out[index++] = ']';
+
+	buffer->length = index;
+	buffer->readings++;
+	return true;
+}
+
+bool BulkUploader::post(HeaderInfo *header, DataItem items[], uint32_t timestamp, uint32_t now) {
+	if(header->dataCount < 5 || header->status != SUCCESS) {
+		LOG(F("BulkUploader: not a successful post\r\n"));
+		return false;
+	}
+	for(uint8_t i = 0; i < 4; i++) {
+		if(items[i].type != USHORT) {
+			LOG(F("BulkUploader: post identifier is not USHORTs\r\n"));
+			return false;
+		}
+	}
+
+	uint16_t nodeID;
+	AttributeIdentifier ident;
+	memcpy(&nodeID, items[0].item, sizeof(nodeID));
+	memcpy(&(ident.groupID), items[1].item, sizeof(ident.groupID));
+	memcpy(&(ident.attributeID), items[2].item, sizeof(ident.attributeID));
+	memcpy(&(ident.attributeNumber), items[3].item, sizeof(ident.attributeNumber));
+
+	return this->add(nodeID, &ident, &(items[4]), timestamp, now);
+}
+
+uint8_t BulkUploader::flush(uint32_t now) {
+	this->seal();
+	return this->poll(now);
+}
+
+uint8_t BulkUploader::poll(uint32_t now) {
+	if(this->filling != NULL && (uint32_t)(now - this->filling->created) >= this->maxAge) {
+		this->seal();
+	}
+
+	/* Gather the ready buffers in the order they were sealed */
+	BulkBuffer *batch[BULK_BUFFER_COUNT];
+	uint8_t count = 0;
+	for(uint8_t i = 0; i < BULK_BUFFER_COUNT; i++) {
+		BulkBuffer *buffer = &(this->buffers[i]);
+		if(buffer->state != BULK_READY) {
+			continue;
+		}
+		uint8_t j = count++;
+		while(j > 0 && (int32_t)(batch[j - 1]->sequence - buffer->sequence) > 0) {
+			batch[j] = batch[j - 1];
+			j--;
+		}
+		batch[j] = buffer;
+	}
+	/* Later payloads wait behind one backing off, so emoncms gets the
+	 *  data in time order.
+	 */
+	if(count == 0 || (batch[0]->attempts > 0 && (int32_t)(now - batch[0]->nextAttempt) < 0)) {
+		return 0;
+	}
+
+	const char *payloads[BULK_BUFFER_COUNT];
+	uint16_t lengths[BULK_BUFFER_COUNT];
+	for(uint8_t i = 0; i < count; i++) {
+		payloads[i] = batch[i]->data;
+		lengths[i] = batch[i]->length;
+	}
+
+	uint8_t accepted = this->sender(this->context, payloads, lengths, count);
+	if(accepted > count) {
+		accepted = count;
+	}
+
+	for(uint8_t i = 0; i < count; i++) {
+		BulkBuffer *buffer = batch[i];
+		if(i < accepted) {
+			this->readingsForwarded += buffer->readings;
+			this->bytesForwarded += buffer->length;
+			buffer->state = BULK_FREE;
+		} else if(++(buffer->attempts) >= BULK_MAX_ATTEMPTS) {
+			LOG(F("BulkUploader: dropping payload after retries\r\n"));
+			this->readingsDropped += buffer->readings;
+			buffer->state = BULK_FREE;
+		} else {
+			buffer->nextAttempt = now + ((uint32_t)BULK_RETRY_DELAY << (buffer->attempts - 1));
+		}
+	}
+
+	return accepted;
+}
+
+uint32_t BulkUploader::getReadingsForwarded() {
+	return this->readingsForwarded;
+}
+
+uint32_t BulkUploader::getBytesForwarded() {
+	return this->bytesForwarded;
+}
+
+uint32_t BulkUploader::getReadingsDropped() {
+	return this->readingsDropped;
+}
@@ -0,0 +1,145 @@
+#ifndef __BULKUPLOADER_H__
+#define __BULKUPLOADER_H__
+
+#include "EMonCMS.h"
+
+#ifndef BULK_BUFFER_SIZE
+#define BULK_BUFFER_SIZE 1024 /** size of one bulk payload in bytes **/
+#endif
+#ifndef BULK_BUFFER_COUNT
+#define BULK_BUFFER_COUNT 4 /** number of payloads filling or in flight **/
+#endif
+#define BULK_MAX_READING 96 /** worst case bytes for one reading, including closing brackets **/
+#define BULK_MAX_ATTEMPTS 5 /** attempts before a payload is dropped **/
+#define BULK_RETRY_DELAY 500 /** ms before the first retry, doubled each attempt **/
+
+/**
+ * Sends a batch of bulk payloads, in order, to emoncms. Implementations
+ * may pipeline the payloads and only wait for the responses at the end.
+ * @param context the context given to the BulkUploader
+ * @param payloads list of form encoded bodies for input/bulk
+ * @param lengths length of each payload
+ * @param count number of payloads
+ * @return the number of leading payloads the server accepted
+ **/
+typedef uint8_t (*BulkSender)(void *context, const char *payloads[], uint16_t lengths[], uint8_t count);
+
+/**
+ * States a bulk payload buffer moves through
+ **/
+enum BulkBufferState {
+	BULK_FREE = 0,
+	BULK_FILLING,
+	BULK_READY
+};
+
+/**
+ * A reusable payload buffer and the bookkeeping for it
+ **/
+typedef struct {
+	char data[BULK_BUFFER_SIZE]; /** the payload, "data=[...]" **/
+	uint16_t length; /** bytes used in data **/
+	uint16_t readings; /** readings serialised into data **/
+	uint8_t state; /** BulkBufferState **/
+	uint8_t attempts; /** failed send attempts **/
+	uint16_t lastNode; /** node of the last entry, for merging **/
+	uint32_t lastTime; /** timestamp of the last entry, for merging **/
+	uint32_t created; /** ms time of the first reading **/
+	uint32_t nextAttempt; /** ms time before which it is not resent **/
+	uint32_t sequence; /** order the buffer was sealed in **/
+} BulkBuffer;
+
+/**
+ * Accumulates posted attribute values into emoncms input/bulk payloads
+ * of the form data=[[time,node,{"group_attribute_number":value}],...],
+ * merging readings from a node at the same time into one entry.
+ * Payloads are flushed when full or older than the maximum age.
+ **/
+class BulkUploader {
+	public:
+		/**
+		 * @param sender function sending sealed payloads
+		 * @param context passed to the sender
+		 * @param maxAge ms a reading may wait before its payload is sent
+		 **/
+		BulkUploader(BulkSender sender, void *context, uint32_t maxAge);
+		~BulkUploader();
+		/**
+		 * Serialises a reading into the current payload.
+		 * @param nodeID node the reading came from
+		 * @param attr attribute of the reading
+		 * @param value numeric data item holding the reading
+		 * @param timestamp time of the reading in seconds
+		 * @param now current time in ms
+		 * @return false if the value isn't numeric or all buffers are busy
+		 **/
+		bool add(uint16_t nodeID, AttributeIdentifier *attr, DataItem *value, uint32_t timestamp, uint32_t now);
+		/**
+		 * Serialises the value of a parsed ATTR_POST packet.
+		 * @param header header of the post
+		 * @param items parsed items: NID, GID, AID, ATTRNUM, ATTRVAL
+		 * @param timestamp time the post was received in seconds
+		 * @param now current time in ms
+		 * @return true on success
+		 **/
+		bool post(HeaderInfo *header, DataItem items[], uint32_t timestamp, uint32_t now);
+		/**
+		 * Seals payloads past their age and sends every payload that is
+		 * ready, in the order they were sealed, retrying failed ones with
+		 * a growing delay. Nothing is sent while the oldest payload waits
+		 * for its retry.
+		 * @param now current time in ms
+		 * @return number of payloads accepted by the sender
+		 **/
+		uint8_t poll(uint32_t now);
+		/**
+		 * Seals the current payload regardless of age and sends.
+		 * @param now current time in ms
+		 * @return number of payloads accepted by the sender
+		 **/
+		uint8_t flush(uint32_t now);
+		/**
+		 * @return readings accepted by the server
+		 **/
+		uint32_t getReadingsForwarded();
+		/**
+		 * @return payload bytes accepted by the server
+		 **/
+		uint32_t getBytesForwarded();
+		/**
+		 * @return readings dropped after too many failed attempts
+		 **/
+		uint32_t getReadingsDropped();
+	protected:
+		BulkBuffer buffers[BULK_BUFFER_COUNT]; /** payload buffers, reused **/
+		BulkBuffer *filling; /** buffer readings are added to, NULL if none **/
+		BulkSender sender; /** function to send payloads **/
+		void *context; /** context for the sender **/
+		uint32_t maxAge; /** ms before a payload is flushed **/
+		uint32_t sequence; /** next seal sequence number **/
+		uint32_t readingsForwarded; /** readings accepted by the server **/
+		uint32_t bytesForwarded; /** bytes accepted by the server **/
+		uint32_t readingsDropped; /** readings given up on **/
+
+		/**
+		 * Moves the filling buffer to ready
+		 **/
+		void seal();
+		/**
+		 * Finds a free buffer and starts a payload in it
+		 * @return NULL if all buffers are busy
+		 **/
+		BulkBuffer *start(uint32_t now);
+		/**
+		 * Writes an unsigned integer as decimal
+		 * @return the number of characters written
+		 **/
+		uint16_t writeUnsigned(char *out, uint64_t value);
+		/**
+		 * Writes a numeric data item as a JSON number
+		 * @return the number of characters written, 0 if not numeric
+		 **/
+		uint16_t writeValue(char *out, DataItem *item);
+};
+
+#endif
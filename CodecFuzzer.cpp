@@ -0,0 +1,808 @@
+#ifdef LINUX
+
+#include "CodecFuzzer.h"
+
+#include <cstdlib>
+#include <time.h>
+
+static const RequestType fuzzTypes[FUZZ_TYPES] = { NODE_REGISTER, ATTR_REGISTER, ATTR_POST, ATTR_FAILURE,
+	ATTR_POST_RESPONSE, ATTR_MULTI_RESPONSE };
+
+static const uint8_t noiseTypes[FUZZ_NOISE_TYPES] = { 'r', 'a', ATTR_POST_RESPONSE, ATTR_POST };
+
+/** value the builders' attribute reads, set while a poll is answered **/
+static DataItem *fuzzAnswer = NULL;
+
+static uint64_t fuzzNanoseconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static bool fuzzAttributeReader(AttributeIdentifier *, DataItem *item) {
+	if(fuzzAnswer == NULL) {
+		return false;
+	}
+	*item = *fuzzAnswer;
+	return true;
+}
+
+/**
+ * @return true for the packets a node sends answering a poll
+ **/
+static bool fuzzIsAnswer(RequestType type) {
+	return type == ATTR_POST_RESPONSE || type == ATTR_MULTI_RESPONSE;
+}
+
+/**
+ * Fills in the header of a reference packet
+ **/
+static void fuzzHeader(uint8_t *packet, uint16_t length, uint8_t status, uint8_t count) {
+	uint16_t dataSize = length - 4;
+	packet[0] = dataSize & 0xFF;
+	packet[1] = dataSize >> 8;
+	packet[2] = status;
+	packet[3] = count;
+}
+
+/**
+ * Lays out one entry of a multi response to a list of triples
+ * @param items GID, AID, ATTRNUM polled
+ * @param answer the entry for a triple the node has
+ * @param answered items in answer
+ * @param present whether the node has the triple
+ * @param group set to the group of a triple the node lacks, entry may point to it
+ * @param status set to the status of a triple the node lacks, entry may point to it
+ * @param entry filled with the entry
+ * @return number of items in entry
+ **/
+static uint16_t fuzzMultiEntry(DataItem *items, DataItem *answer, uint16_t answered, bool present,
+		uint16_t *group, uint8_t *status, DataItem *entry) {
+	if(present) {
+		memcpy(entry, answer, answered * sizeof(DataItem));
+		return answered;
+	}
+	memcpy(group, items[0].item, sizeof(uint16_t));
+	*group ^= 1;
+	*status = UNSUPPORTED_ATTRIBUTE;
+	entry[0].type = USHORT;
+	entry[0].item = group;
+	entry[1] = items[1];
+	entry[2] = items[2];
+	entry[3].type = UCHAR;
+	entry[3].item = status;
+	return 4;
+}
+
+CodecFuzzer::CodecFuzzer(uint32_t seed, uint16_t invalidPerMille) {
+	this->random = seed != 0 ? seed : 1;
+	this->invalidPerMille = invalidPerMille;
+	for(uint8_t i = 0; i < FUZZ_NODES; i++) {
+		/* node IDs cover both bytes, the first builder is unregistered */
+		this->nodeIDs[i] = i == 0 ? 0 : (uint16_t)(this->nextRandom() % 0xFFFF + 1);
+		this->nodes[i] = new EMonCMS(&(this->answer), 1, NULL, NULL, NULL, this->nodeIDs[i]);
+		this->nodes[i]->setSender(CodecFuzzer::capture, this);
+	}
+	this->answer.reader = fuzzAttributeReader;
+	this->answer.registered = true;
+	this->capturing = NULL;
+	this->captures = 0;
+	this->registration.reader = fuzzAttributeReader;
+	this->registration.registered = false;
+	this->receiver = new EMonCMS(&(this->registration), 1, NULL, NULL, NULL, 1);
+	/* answers to noise taken as a request are captured into nothing */
+	this->receiver->setSender(CodecFuzzer::capture, this);
+	this->cases = (FuzzCase *)malloc(sizeof(FuzzCase) * FUZZ_BATCH);
+	this->frames = 0;
+	this->rejected = 0;
+	this->mismatches = 0;
+	this->splitAnswers = 0;
+	memset(this->typeFrames, 0, sizeof(this->typeFrames));
+	memset(this->calls, 0, sizeof(this->calls));
+	memset(this->nanoseconds, 0, sizeof(this->nanoseconds));
+	this->haveFailed = false;
+}
+
+CodecFuzzer::~CodecFuzzer() {
+	for(uint8_t i = 0; i < FUZZ_NODES; i++) {
+		delete this->nodes[i];
+	}
+	delete this->receiver;
+	free(this->cases);
+}
+
+uint32_t CodecFuzzer::nextRandom() {
+	this->random ^= this->random << 13;
+	this->random ^= this->random >> 17;
+	this->random ^= this->random << 5;
+	return this->random;
+}
+
+int8_t CodecFuzzer::referenceSize(uint8_t type) {
+	switch(type) {
+		case STRING:
+			return 0;
+		case CHAR:
+		case UCHAR:
+			return 1;
+		case SHORT:
+		case USHORT:
+			return 2;
+		case INT:
+		case UINT:
+		case FLOAT:
+			return 4;
+		case LONG:
+		case ULONG:
+			return 8;
+		default:
+			return -1;
+	}
+}
+
+uint16_t CodecFuzzer::referenceEncode(RequestType type, uint16_t nodeID, DataItem *items, uint16_t length, uint8_t *buffer) {
+	uint16_t itemCount;
+	uint8_t status = SUCCESS;
+	bool withNodeID = true;
+	switch(type) {
+		case NODE_REGISTER:
+			itemCount = 0;
+			withNodeID = false;
+			break;
+		case ATTR_REGISTER:
+			itemCount = 4;
+			break;
+		case ATTR_POST:
+			/* the sequence number is optional */
+			itemCount = length == 5 ? 5 : 4;
+			break;
+		case ATTR_FAILURE:
+			itemCount = 3;
+			status = FAILURE;
+			break;
+		case ATTR_POST_RESPONSE:
+		case ATTR_MULTI_RESPONSE:
+			/* the value is left out when the node lacks the attribute */
+			itemCount = length == 3 ? 3 : 4;
+			break;
+		default:
+			return 0;
+	}
+	if(length != itemCount || (withNodeID && nodeID == 0)) {
+		return 0;
+	}
+
+	DataItem answer[FUZZ_MAX_ITEMS];
+	uint8_t answered;
+	if(fuzzIsAnswer(type)) {
+		length = answerItems(type, items, length, answer, &answered);
+		items = answer;
+		if(type == ATTR_POST_RESPONSE) {
+			status = answered;
+		}
+	}
+
+	uint16_t index = 4;
+	if(withNodeID) {
+		buffer[index++] = USHORT;
+		buffer[index++] = nodeID & 0xFF;
+		buffer[index++] = nodeID >> 8;
+	}
+	for(uint16_t i = 0; i < length; i++) {
+		int8_t size = referenceSize(items[i].type);
+		if(size < 0 || index + 1 + size > EMONCMS_MTU) {
+			return 0;
+		}
+		buffer[index++] = items[i].type;
+		for(int8_t b = 0; b < size; b++) {
+			buffer[index++] = ((uint8_t *)items[i].item)[b];
+		}
+	}
+
+	uint16_t dataSize = index - 4;
+	buffer[0] = dataSize & 0xFF;
+	buffer[1] = dataSize >> 8;
+	buffer[2] = status;
+	buffer[3] = (withNodeID ? 1 : 0) + length;
+	return index;
+}
+
+bool CodecFuzzer::referenceDecode(uint8_t *buffer, uint16_t length, uint8_t count, uint16_t offsets[]) {
+	uint16_t index = 0;
+	for(uint8_t i = 0; i < count; i++) {
+		if(index >= length) {
+			return false;
+		}
+		int8_t size = referenceSize(buffer[index]);
+		if(size < 0) {
+			return false;
+		}
+		offsets[i] = index;
+		index += 1 + size;
+	}
+	return index <= length;
+}
+
+uint16_t CodecFuzzer::referenceMultiEncode(uint16_t nodeID, DataItem *items, uint8_t triples, uint8_t present, uint8_t *buffer) {
+	if(nodeID == 0 || triples == 0) {
+		return 0;
+	}
+	DataItem answer[FUZZ_MAX_ITEMS];
+	uint8_t answered;
+	uint16_t answerLength = answerItems(ATTR_MULTI_RESPONSE, items, 4, answer, &answered);
+
+	/* Every packet starts with the node ID, an entry that doesn't fit
+	 *  after another starts the next one.
+	 */
+	uint16_t start = 0;
+	uint16_t index = 4;
+	uint8_t count = 0;
+	for(uint8_t t = 0; t <= triples; t++) {
+		DataItem entry[FUZZ_MAX_ITEMS];
+		uint16_t entryLength = 0;
+		uint16_t group;
+		uint8_t status;
+		uint16_t size = 0;
+		if(t < triples) {
+			entryLength = fuzzMultiEntry(items, answer, answerLength, (present >> t) & 1, &group, &status, entry);
+			for(uint16_t i = 0; i < entryLength; i++) {
+				int8_t itemSize = referenceSize(entry[i].type);
+				if(itemSize < 0) {
+					return 0;
+				}
+				size += 1 + itemSize;
+			}
+		}
+		if(t == triples || (count > 1 && index - start + size > EMONCMS_MTU)) {
+			fuzzHeader(&(buffer[start]), index - start, SUCCESS, count);
+			if(t == triples) {
+				break;
+			}
+			start = index;
+			index = start + 4;
+			count = 0;
+		}
+		if(count == 0) {
+			if(start + EMONCMS_MTU > FUZZ_MAX_FRAMES * EMONCMS_MTU) {
+				return 0;
+			}
+			buffer[index++] = USHORT;
+			buffer[index++] = nodeID & 0xFF;
+			buffer[index++] = nodeID >> 8;
+			count = 1;
+		}
+		if(index - start + size > EMONCMS_MTU) {
+			return 0;
+		}
+		for(uint16_t i = 0; i < entryLength; i++) {
+			buffer[index++] = entry[i].type;
+			for(int8_t b = 0; b < referenceSize(entry[i].type); b++) {
+				buffer[index++] = ((uint8_t *)entry[i].item)[b];
+			}
+		}
+		count += entryLength;
+	}
+	return index;
+}
+
+bool CodecFuzzer::referenceAccepts(uint8_t type, uint8_t *buffer, uint16_t offsets[], uint8_t count, uint16_t nodeID) {
+	bool identifier = count >= 4 && buffer[offsets[1]] == USHORT && buffer[offsets[2]] == USHORT
+		&& buffer[offsets[3]] == USHORT;
+	switch(type) {
+		case 'r':
+			/* a node ID, which 0 isn't */
+			return count >= 1 && buffer[offsets[0]] == USHORT
+				&& (buffer[offsets[0] + 1] != 0 || buffer[offsets[0] + 2] != 0);
+		case 'a':
+			return identifier;
+		case ATTR_POST_RESPONSE:
+			return true;
+		case ATTR_POST:
+			/* a node ID then triples, answered if the node has an ID */
+			if(count < 4 || (count - 1) % 3 != 0 || nodeID == 0) {
+				return false;
+			}
+			for(uint8_t i = 1; i < count; i++) {
+				if(buffer[offsets[i]] != USHORT) {
+					return false;
+				}
+			}
+			return true;
+		default:
+			return false;
+	}
+}
+
+uint8_t CodecFuzzer::typeIndex(RequestType type) {
+	switch(type) {
+		case NODE_REGISTER:
+			return 0;
+		case ATTR_REGISTER:
+			return 1;
+		case ATTR_POST:
+			return 2;
+		case ATTR_FAILURE:
+			return 3;
+		case ATTR_POST_RESPONSE:
+			return 4;
+		default:
+			return 5;
+	}
+}
+
+uint16_t CodecFuzzer::answerItems(RequestType type, DataItem *items, uint16_t length, DataItem *answer, uint8_t *status) {
+	/* A value of an unknown type is answered as invalid */
+	if(length < 4) {
+		*status = UNSUPPORTED_ATTRIBUTE;
+	} else {
+		*status = referenceSize(items[3].type) < 0 ? INVALID_VALUE : SUCCESS;
+	}
+
+	/* A 'p' carries the status in its header, each 'm' entry in an item */
+	uint16_t count = 3;
+	memcpy(answer, items, 3 * sizeof(DataItem));
+	if(type == ATTR_MULTI_RESPONSE) {
+		answer[count].type = UCHAR;
+		answer[count++].item = status;
+	}
+	if(*status == SUCCESS) {
+		answer[count++] = items[3];
+	}
+	return count;
+}
+
+void CodecFuzzer::generate(FuzzCase *fuzzCase) {
+	fuzzCase->type = fuzzTypes[this->nextRandom() % FUZZ_TYPES];
+	fuzzCase->node = 1 + this->nextRandom() % (FUZZ_NODES - 1);
+	fuzzCase->triples = 0;
+	fuzzCase->present = 0;
+	switch(fuzzCase->type) {
+		case NODE_REGISTER:
+			fuzzCase->length = 0;
+			break;
+		case ATTR_FAILURE:
+			fuzzCase->length = 3;
+			break;
+		case ATTR_POST:
+			fuzzCase->length = this->nextRandom() % 2 == 0 ? 4 : 5;
+			break;
+		case ATTR_MULTI_RESPONSE:
+			/* half poll a list of triples the node has or lacks, one
+			 *  triple by itself would be answered with a 'p'
+			 */
+			if(this->nextRandom() % 2 == 0) {
+				fuzzCase->length = 4;
+				fuzzCase->triples = 2 + this->nextRandom() % (FUZZ_MAX_TRIPLES - 1);
+				fuzzCase->present = this->nextRandom() & ((1 << fuzzCase->triples) - 1);
+				break;
+			}
+			/* fallthrough */
+		case ATTR_POST_RESPONSE:
+			/* answered with the value, or the node lacks the attribute */
+			fuzzCase->length = this->nextRandom() % 4 == 0 ? 3 : 4;
+			break;
+		default:
+			fuzzCase->length = 4;
+			break;
+	}
+	for(uint8_t i = 0; i < FUZZ_MAX_ITEMS; i++) {
+		fuzzCase->values[i] = ((uint64_t)this->nextRandom() << 32) | this->nextRandom();
+		fuzzCase->items[i].item = &(fuzzCase->values[i]);
+		/* the identifier is USHORTs, the value any type, then the sequence number */
+		fuzzCase->items[i].type = i < 3 ? (uint8_t)USHORT : i == 4 ? (uint8_t)UINT : (uint8_t)(STRING + this->nextRandom() % FLOAT);
+	}
+	if(fuzzIsAnswer(fuzzCase->type)) {
+		/* A single wildcard poll is answered with an 'm', and a group
+		 *  without the attribute with an entry for the wildcard itself.
+		 *  Triples polled by themselves can't be wildcards.
+		 */
+		uint16_t attributeID;
+		memcpy(&attributeID, fuzzCase->items[1].item, sizeof(attributeID));
+		if(fuzzCase->type == ATTR_MULTI_RESPONSE && fuzzCase->length == 3) {
+			attributeID = ATTR_WILDCARD;
+		} else if((fuzzCase->type == ATTR_POST_RESPONSE || fuzzCase->triples > 0) && attributeID == ATTR_WILDCARD) {
+			attributeID--;
+		}
+		memcpy(fuzzCase->items[1].item, &attributeID, sizeof(attributeID));
+	}
+
+	if(this->nextRandom() % 1000 >= this->invalidPerMille) {
+		return;
+	}
+	switch(this->nextRandom() % 3) {
+		case 0:
+			/* no node ID */
+			if(fuzzCase->type != NODE_REGISTER) {
+				fuzzCase->node = 0;
+				break;
+			}
+			/* fallthrough */
+		case 1:
+			/* wrong number of items, answers have no count of their own */
+			if(!fuzzIsAnswer(fuzzCase->type)) {
+				fuzzCase->length = (fuzzCase->length + 1 + this->nextRandom() % FUZZ_MAX_ITEMS) % (FUZZ_MAX_ITEMS + 1);
+				if(fuzzCase->length > 0) {
+					break;
+				}
+				fuzzCase->length = 1;
+			}
+			/* fallthrough */
+		default:
+			/* an unknown type code somewhere in the list, in an answer
+			 *  the value read
+			 */
+			if(fuzzIsAnswer(fuzzCase->type)) {
+				fuzzCase->length = 4;
+			} else if(fuzzCase->length == 0) {
+				fuzzCase->length = 1;
+			}
+			uint8_t code;
+			do {
+				code = this->nextRandom() & 0xFF;
+			} while(referenceSize(code) >= 0);
+			fuzzCase->items[fuzzIsAnswer(fuzzCase->type) ? 3 : this->nextRandom() % fuzzCase->length].type = code;
+			break;
+	}
+}
+
+void CodecFuzzer::mismatch(FuzzPath path, FuzzCase *fuzzCase) {
+	this->mismatches++;
+	if(fuzzCase != NULL && !this->haveFailed) {
+		this->haveFailed = true;
+		this->failed = *fuzzCase;
+		this->failedPath = path;
+	}
+}
+
+void CodecFuzzer::respond(FuzzCase *fuzzCase) {
+	uint16_t ident[3];
+	for(uint8_t i = 0; i < 3; i++) {
+		memcpy(&(ident[i]), fuzzCase->items[i].item, sizeof(uint16_t));
+	}
+	/* The builder's attribute reads the case's value, and is in another
+	 *  group when the case leaves the value out.
+	 */
+	this->answer.attr.groupID = fuzzCase->length == 3 ? ident[0] ^ 1 : ident[0];
+	this->answer.attr.attributeID = ident[1];
+	this->answer.attr.attributeNumber = ident[2];
+	fuzzAnswer = &(fuzzCase->items[3]);
+
+	/* Multi responses answer a wildcard for the group, or the list of
+	 *  triples with the missing ones in the next group over.
+	 */
+	uint8_t triples = fuzzCase->triples > 0 ? fuzzCase->triples : 1;
+	uint8_t request[sizeof(HeaderInfo) + 3 * (1 + 3 * FUZZ_MAX_TRIPLES)] __attribute__((aligned(4)));
+	HeaderInfo *header = (HeaderInfo *)request;
+	header->dataSize = 3 * (1 + 3 * triples);
+	header->status = SUCCESS;
+	header->dataCount = 1 + 3 * triples;
+	uint16_t values[1 + 3 * FUZZ_MAX_TRIPLES];
+	values[0] = this->nodeIDs[fuzzCase->node];
+	for(uint8_t t = 0; t < triples; t++) {
+		bool present = fuzzCase->triples == 0 || ((fuzzCase->present >> t) & 1);
+		values[1 + 3 * t] = present ? ident[0] : ident[0] ^ 1;
+		values[2 + 3 * t] = fuzzCase->type == ATTR_MULTI_RESPONSE && fuzzCase->triples == 0 ? (uint16_t)ATTR_WILDCARD : ident[1];
+		values[3 + 3 * t] = ident[2];
+	}
+	for(uint8_t i = 0; i < header->dataCount; i++) {
+		request[sizeof(HeaderInfo) + i * 3] = USHORT;
+		memcpy(&(request[sizeof(HeaderInfo) + i * 3 + 1]), &(values[i]), sizeof(uint16_t));
+	}
+
+	DataItem items[1 + 3 * FUZZ_MAX_TRIPLES];
+	this->capturing = fuzzCase;
+	this->captures = 0;
+	fuzzCase->built = 0;
+	this->nodes[fuzzCase->node]->parseEMonCMSPacket(header, 'P', &(request[sizeof(HeaderInfo)]), items);
+	if(fuzzCase->triples == 0 && this->captures > 1) {
+		/* one entry always fits in one packet */
+		fuzzCase->built = 0;
+	}
+	this->capturing = NULL;
+	fuzzAnswer = NULL;
+}
+
+uint16_t CodecFuzzer::capture(void *context, uint8_t type, uint8_t *buffer, uint16_t length) {
+	CodecFuzzer *self = (CodecFuzzer *)context;
+	FuzzCase *fuzzCase = self->capturing;
+	/* packets split over several are kept back to back */
+	if(fuzzCase != NULL && type == fuzzCase->type && length <= EMONCMS_MTU
+			&& fuzzCase->built + length <= sizeof(fuzzCase->frame)) {
+		memcpy(&(fuzzCase->frame[fuzzCase->built]), buffer, length);
+		fuzzCase->built += length;
+	}
+	self->captures++;
+	return length;
+}
+
+void CodecFuzzer::checkBuild() {
+	uint64_t start = fuzzNanoseconds();
+	for(uint16_t i = 0; i < FUZZ_BATCH; i++) {
+		FuzzCase *c = &(this->cases[i]);
+		if(fuzzIsAnswer(c->type)) {
+			this->respond(c);
+		} else {
+			c->built = this->nodes[c->node]->attrBuilder(c->type, c->items, c->length, c->frame);
+		}
+	}
+	uint64_t built = fuzzNanoseconds();
+	for(uint16_t i = 0; i < FUZZ_BATCH; i++) {
+		FuzzCase *c = &(this->cases[i]);
+		c->expected = c->triples > 0
+			? referenceMultiEncode(this->nodeIDs[c->node], c->items, c->triples, c->present, c->reference)
+			: referenceEncode(c->type, this->nodeIDs[c->node], c->items, c->length, c->reference);
+	}
+	this->nanoseconds[FUZZ_BUILD] += built - start;
+	this->nanoseconds[FUZZ_REFERENCE] += fuzzNanoseconds() - built;
+	this->calls[FUZZ_BUILD] += FUZZ_BATCH;
+	this->calls[FUZZ_REFERENCE] += FUZZ_BATCH;
+
+	for(uint16_t i = 0; i < FUZZ_BATCH; i++) {
+		FuzzCase *c = &(this->cases[i]);
+		if(c->built != c->expected || memcmp(c->frame, c->reference, c->expected) != 0) {
+			this->mismatch(FUZZ_BUILD, c);
+		} else if(c->expected == 0) {
+			this->rejected++;
+		} else {
+			this->typeFrames[typeIndex(c->type)]++;
+			if(c->expected > sizeof(HeaderInfo) + ((HeaderInfo *)c->reference)->dataSize) {
+				this->splitAnswers++;
+			}
+		}
+	}
+}
+
+void CodecFuzzer::checkParse() {
+	uint64_t start = fuzzNanoseconds();
+	for(uint16_t i = 0; i < FUZZ_BATCH; i++) {
+		FuzzCase *c = &(this->cases[i]);
+		if(c->built > 0) {
+			/* the first packet of a split answer */
+			HeaderInfo *header = (HeaderInfo *)c->frame;
+			this->results[i] = header->dataCount <= FUZZ_MAX_PARSED && EMonCMS::parseDataItems(header, &(c->frame[sizeof(HeaderInfo)]),
+				c->parsed, c->triples > 0 ? header->dataSize : c->built - sizeof(HeaderInfo));
+			this->calls[FUZZ_PARSE_ITEMS]++;
+		}
+	}
+	this->nanoseconds[FUZZ_PARSE_ITEMS] += fuzzNanoseconds() - start;
+
+	for(uint16_t i = 0; i < FUZZ_BATCH; i++) {
+		FuzzCase *c = &(this->cases[i]);
+		HeaderInfo *header = (HeaderInfo *)c->frame;
+		if(c->built == 0) {
+			continue;
+		}
+		if(c->triples > 0) {
+			if(!this->results[i] || !this->checkAnswers(c)) {
+				this->mismatch(FUZZ_PARSE_ITEMS, c);
+			}
+			continue;
+		}
+		/* The node ID leads, then the items as given or as answered */
+		DataItem *given = c->items;
+		uint16_t length = c->length;
+		DataItem answer[FUZZ_MAX_ITEMS];
+		uint8_t status;
+		if(fuzzIsAnswer(c->type)) {
+			length = answerItems(c->type, c->items, c->length, answer, &status);
+			given = answer;
+		}
+		bool same = this->results[i] && header->dataCount == (c->type == NODE_REGISTER ? 0 : length + 1);
+		for(uint8_t j = 0; same && j < header->dataCount; j++) {
+			DataItem *item = j == 0 ? NULL : &(given[j - 1]);
+			uint16_t nodeID = this->nodeIDs[c->node];
+			same = c->parsed[j].type == (item == NULL ? (uint8_t)USHORT : item->type)
+				&& memcmp(c->parsed[j].item, item == NULL ? &nodeID : item->item, referenceSize(c->parsed[j].type)) == 0;
+		}
+		/* and a packet cut short must not parse */
+		if(same && header->dataCount > 0) {
+			same = !EMonCMS::parseDataItems(header, &(c->frame[sizeof(HeaderInfo)]), c->parsed, c->built - sizeof(HeaderInfo) - 1);
+		}
+		if(!same) {
+			this->mismatch(FUZZ_PARSE_ITEMS, c);
+		}
+	}
+
+	/* The packets are fed back to a node as the acknowledgements a
+	 *  gateway would send, registrations must mark the attribute. Multi
+	 *  responses are for an AttributePoller, a node must refuse them.
+	 *  Cut short by one byte, every packet with items must be refused.
+	 */
+	start = fuzzNanoseconds();
+	for(uint16_t i = 0; i < FUZZ_BATCH; i++) {
+		FuzzCase *c = &(this->cases[i]);
+		if(c->built == 0) {
+			continue;
+		}
+		bool registering = c->type == ATTR_REGISTER;
+		bool multi = c->type == ATTR_MULTI_RESPONSE;
+		if(registering) {
+			this->registration.attr.groupID = *(uint16_t *)c->items[0].item;
+			this->registration.attr.attributeID = *(uint16_t *)c->items[1].item;
+			this->registration.attr.attributeNumber = *(uint16_t *)c->items[2].item;
+			this->registration.registered = false;
+		}
+		HeaderInfo *header = (HeaderInfo *)c->frame;
+		this->results[i] = this->receiver->parseEMonCMSPacket(header, registering ? 'a' : (multi ? 'm' : 'p'),
+			&(c->frame[sizeof(HeaderInfo)]), c->parsed) != multi
+			&& (!registering || this->registration.registered);
+		if(this->results[i] && header->dataCount > 0) {
+			HeaderInfo shortHeader = *header;
+			shortHeader.dataSize--;
+			this->results[i] = !this->receiver->parseEMonCMSPacket(&shortHeader, 'p', &(c->frame[sizeof(HeaderInfo)]), c->parsed);
+			this->calls[FUZZ_PARSE_PACKET]++;
+		}
+		this->calls[FUZZ_PARSE_PACKET]++;
+	}
+	this->nanoseconds[FUZZ_PARSE_PACKET] += fuzzNanoseconds() - start;
+
+	for(uint16_t i = 0; i < FUZZ_BATCH; i++) {
+		if(this->cases[i].built > 0 && !this->results[i]) {
+			this->mismatch(FUZZ_PARSE_PACKET, &(this->cases[i]));
+		}
+	}
+}
+
+bool CodecFuzzer::checkAnswers(FuzzCase *fuzzCase) {
+	DataItem answer[FUZZ_MAX_ITEMS];
+	uint8_t answered;
+	uint16_t answerLength = answerItems(ATTR_MULTI_RESPONSE, fuzzCase->items, 4, answer, &answered);
+	uint16_t nodeID = this->nodeIDs[fuzzCase->node];
+
+	uint8_t triple = 0;
+	uint16_t offset = 0;
+	while(offset < fuzzCase->built) {
+		HeaderInfo header;
+		if(offset + sizeof(HeaderInfo) > fuzzCase->built) {
+			return false;
+		}
+		memcpy(&header, &(fuzzCase->frame[offset]), sizeof(HeaderInfo));
+		uint8_t *data = &(fuzzCase->frame[offset + sizeof(HeaderInfo)]);
+		if(offset + sizeof(HeaderInfo) + header.dataSize > fuzzCase->built || header.dataCount > FUZZ_MAX_PARSED
+				|| !EMonCMS::parseDataItems(&header, data, fuzzCase->parsed, header.dataSize)
+				|| fuzzCase->parsed[0].type != USHORT || memcmp(fuzzCase->parsed[0].item, &nodeID, sizeof(nodeID)) != 0) {
+			return false;
+		}
+
+		/* each entry in the order polled, as the reference lays it out */
+		uint16_t j = 1;
+		while(j < header.dataCount) {
+			DataItem entry[FUZZ_MAX_ITEMS];
+			uint16_t group;
+			uint8_t status;
+			if(triple >= fuzzCase->triples) {
+				return false;
+			}
+			uint16_t entryLength = fuzzMultiEntry(fuzzCase->items, answer, answerLength,
+				(fuzzCase->present >> triple) & 1, &group, &status, entry);
+			for(uint16_t k = 0; k < entryLength; k++, j++) {
+				if(j >= header.dataCount || fuzzCase->parsed[j].type != entry[k].type
+						|| memcmp(fuzzCase->parsed[j].item, entry[k].item, referenceSize(entry[k].type)) != 0) {
+					return false;
+				}
+			}
+			triple++;
+		}
+		if(EMonCMS::parseDataItems(&header, data, fuzzCase->parsed, header.dataSize - 1)) {
+			return false;
+		}
+		offset += sizeof(HeaderInfo) + header.dataSize;
+	}
+	return triple == fuzzCase->triples;
+}
+
+void CodecFuzzer::checkNoise() {
+	/* Bytes below 12 make most type codes known, so items are often
+	 *  accepted and the walk goes deep into the buffer. Half are USHORT,
+	 *  so node IDs and identifiers turn up often enough to be read.
+	 */
+	for(uint16_t i = 0; i < FUZZ_BATCH; i++) {
+		FuzzCase *c = &(this->cases[i]);
+		c->built = 1 + this->nextRandom() % EMONCMS_MTU;
+		c->length = this->nextRandom() % (FUZZ_MAX_ITEMS + 2);
+		for(uint16_t b = 0; b < c->built; b++) {
+			uint32_t r = this->nextRandom();
+			c->frame[b] = r & 0x100 ? (uint8_t)USHORT : (uint8_t)(r % 12);
+		}
+	}
+
+	uint64_t start = fuzzNanoseconds();
+	for(uint16_t i = 0; i < FUZZ_BATCH; i++) {
+		FuzzCase *c = &(this->cases[i]);
+		HeaderInfo header = { c->built, SUCCESS, c->length };
+		this->results[i] = EMonCMS::parseDataItems(&header, c->frame, c->parsed, c->built);
+	}
+	this->nanoseconds[FUZZ_DECODE_NOISE] += fuzzNanoseconds() - start;
+	this->calls[FUZZ_DECODE_NOISE] += FUZZ_BATCH;
+
+	for(uint16_t i = 0; i < FUZZ_BATCH; i++) {
+		FuzzCase *c = &(this->cases[i]);
+		uint16_t offsets[FUZZ_MAX_ITEMS + 1];
+		bool same = referenceDecode(c->frame, c->built, c->length, offsets) == this->results[i];
+		for(uint8_t j = 0; same && this->results[i] && j < c->length; j++) {
+			same = c->parsed[j].type == c->frame[offsets[j]] && c->parsed[j].item == &(c->frame[offsets[j] + 1]);
+		}
+		if(!same) {
+			this->mismatch(FUZZ_DECODE_NOISE, NULL);
+		}
+	}
+
+	/* A node must refuse the same noise as any acknowledgement or
+	 *  request unless the items that type reads are there. Node ID
+	 *  responses change the receiver's ID, so requests are checked
+	 *  against the ID it ends up with.
+	 */
+	for(uint8_t t = 0; t < FUZZ_NOISE_TYPES; t++) {
+		uint16_t nodeID = this->receiver->getNodeID();
+		start = fuzzNanoseconds();
+		for(uint16_t i = 0; i < FUZZ_BATCH; i++) {
+			FuzzCase *c = &(this->cases[i]);
+			HeaderInfo header = { c->built, SUCCESS, c->length };
+			this->results[i] = this->receiver->parseEMonCMSPacket(&header, noiseTypes[t], c->frame, c->parsed);
+		}
+		this->nanoseconds[FUZZ_PARSE_PACKET] += fuzzNanoseconds() - start;
+		this->calls[FUZZ_PARSE_PACKET] += FUZZ_BATCH;
+
+		for(uint16_t i = 0; i < FUZZ_BATCH; i++) {
+			FuzzCase *c = &(this->cases[i]);
+			uint16_t offsets[FUZZ_MAX_ITEMS + 1];
+			bool accepted = referenceDecode(c->frame, c->built, c->length, offsets)
+				&& referenceAccepts(noiseTypes[t], c->frame, offsets, c->length, nodeID);
+			if(accepted != this->results[i]) {
+				this->mismatch(FUZZ_PARSE_PACKET, NULL);
+			}
+		}
+	}
+}
+
+uint32_t CodecFuzzer::run(uint32_t frames) {
+	uint32_t before = this->mismatches;
+	for(uint32_t done = 0; done < frames; done += FUZZ_BATCH) {
+		for(uint16_t i = 0; i < FUZZ_BATCH; i++) {
+			this->generate(&(this->cases[i]));
+		}
+		this->checkBuild();
+		this->checkParse();
+		this->checkNoise();
+		this->frames += FUZZ_BATCH;
+	}
+	return this->mismatches - before;
+}
+
+uint32_t CodecFuzzer::getFrames() {
+	return this->frames;
+}
+
+uint32_t CodecFuzzer::getRejected() {
+	return this->rejected;
+}
+
+uint32_t CodecFuzzer::getMismatches() {
+	return this->mismatches;
+}
+
+uint32_t CodecFuzzer::getSplitAnswers() {
+	return this->splitAnswers;
+}
+
+uint32_t CodecFuzzer::getTypeFrames(RequestType type) {
+	return this->typeFrames[typeIndex(type)];
+}
+
+uint32_t CodecFuzzer::getPathCalls(FuzzPath path) {
+	return this->calls[path];
+}
+
+double CodecFuzzer::getPathSeconds(FuzzPath path) {
+	return this->nanoseconds[path] / 1e9;
+}
+
+FuzzCase *CodecFuzzer::getFirstMismatch(FuzzPath *path) {
+	if(!this->haveFailed) {
+		return NULL;
+	}
+	*path = this->failedPath;
+	return &(this->failed);
+}
+
+#endif
@@ -0,0 +1,253 @@
+#ifndef __CODECFUZZER_H__
+#define __CODECFUZZER_H__
+
+#ifdef LINUX
+
+#include "EMonCMS.h"
+
+#define FUZZ_BATCH 256 /** cases generated, then run through each path in turn **/
+#define FUZZ_MAX_ITEMS 5 /** items passed to attrBuilder, posts can have a sequence number **/
+#define FUZZ_NODES 8 /** builders with different node IDs, the first has none **/
+#define FUZZ_TYPES 6 /** request types generated **/
+#define FUZZ_MAX_TRIPLES 6 /** triples in a multi attribute poll, as many as fit in one request **/
+#define FUZZ_MAX_FRAMES ((FUZZ_MAX_TRIPLES + 1) / 2) /** frames answering a multi attribute poll, two of the largest entries fit in one **/
+#define FUZZ_MAX_PARSED (1 + 5 * FUZZ_MAX_TRIPLES) /** items in one frame, the node ID and an entry for every triple **/
+#define FUZZ_NOISE_TYPES 4 /** packet types a node is fed noise as **/
+
+/**
+ * Code paths timed by the fuzzer
+ **/
+enum FuzzPath {
+	FUZZ_BUILD, /** EMonCMS::attrBuilder, or a node answering a poll **/
+	FUZZ_REFERENCE, /** CodecFuzzer::referenceEncode **/
+	FUZZ_PARSE_ITEMS, /** EMonCMS::parseDataItems **/
+	FUZZ_PARSE_PACKET, /** EMonCMS::parseEMonCMSPacket **/
+	FUZZ_DECODE_NOISE, /** parseDataItems on random bytes **/
+	FUZZ_PATHS
+};
+
+/**
+ * One randomly generated request
+ **/
+typedef struct {
+	RequestType type; /** request to build **/
+	uint8_t node; /** index of the builder **/
+	uint8_t length; /** items passed to the builder **/
+	uint8_t triples; /** triples polled for a multi response, 0 for a wildcard poll **/
+	uint8_t present; /** bit set for each polled triple the builder has **/
+	DataItem items[FUZZ_MAX_ITEMS]; /** items, pointing into values **/
+	uint64_t values[FUZZ_MAX_ITEMS]; /** random value bytes **/
+	uint16_t expected; /** length from the reference encoder **/
+	uint16_t built; /** length from attrBuilder **/
+	uint8_t reference[FUZZ_MAX_FRAMES * EMONCMS_MTU]; /** packets from the reference encoder, back to back **/
+	uint8_t frame[FUZZ_MAX_FRAMES * EMONCMS_MTU]; /** packets from attrBuilder or the node, back to back **/
+	DataItem parsed[FUZZ_MAX_PARSED]; /** items parsed back from a frame **/
+} FuzzCase;
+
+/**
+ * Differential fuzzer for the packet codec. Random item lists for every
+ * RequestType are built with attrBuilder and with a reference encoder
+ * written from the wire format alone, the bytes compared, then parsed
+ * back with parseDataItems and parseEMonCMSPacket and compared with
+ * what went in. Poll answers ('p' and 'm') are built by a node answering
+ * a 'P' request for an attribute reading the case's value. Multi
+ * responses answer a wildcard, or a list of triples the node has or
+ * lacks, split over as many packets as EMONCMS_MTU needs. A share of
+ * the cases are invalid (unknown type codes, wrong item counts, no node
+ * ID) and must be rejected by both encoders, or answered as
+ * INVALID_VALUE. Random byte strings and cut short packets are also
+ * decoded by parseDataItems, parseEMonCMSPacket and a reference
+ * decoder, which must agree, and a node fed the noise as any
+ * acknowledgement or request must refuse it unless the items it reads
+ * are there.
+ *
+ * Each path is timed separately over whole batches, so a sweep of
+ * millions of frames gives throughput figures for codec changes as
+ * well as checking them.
+ **/
+class CodecFuzzer {
+	public:
+		/**
+		 * @param seed seed for the case generator
+		 * @param invalidPerMille cases out of every thousand made invalid
+		 **/
+		CodecFuzzer(uint32_t seed, uint16_t invalidPerMille);
+		~CodecFuzzer();
+		/**
+		 * Generates and checks cases, rounded up to whole batches
+		 * @param frames number of cases to run
+		 * @return mismatches found by this run
+		 **/
+		uint32_t run(uint32_t frames);
+		/**
+		 * @return cases run so far
+		 **/
+		uint32_t getFrames();
+		/**
+		 * @return cases both encoders rejected
+		 **/
+		uint32_t getRejected();
+		/**
+		 * @return cases where a path disagreed with the reference
+		 **/
+		uint32_t getMismatches();
+		/**
+		 * @return multi responses answered in more than one packet
+		 **/
+		uint32_t getSplitAnswers();
+		/**
+		 * @param type a request type
+		 * @return valid cases run for it
+		 **/
+		uint32_t getTypeFrames(RequestType type);
+		/**
+		 * @param path a code path
+		 * @return calls made to it
+		 **/
+		uint32_t getPathCalls(FuzzPath path);
+		/**
+		 * @param path a code path
+		 * @return seconds spent in it
+		 **/
+		double getPathSeconds(FuzzPath path);
+		/**
+		 * The first case that disagreed, kept for reporting
+		 * @param path set to the path that disagreed
+		 * @return the case, NULL if there were no mismatches or only
+		 *  noise decoding disagreed
+		 **/
+		FuzzCase *getFirstMismatch(FuzzPath *path);
+		/**
+		 * Encodes a request byte by byte from the wire format, without
+		 * using the type table. For ATTR_POST_RESPONSE and
+		 * ATTR_MULTI_RESPONSE the items are GID, AID, ATTRNUM and the
+		 * value read, without the value if the node lacks the
+		 * attribute, and the packet is the node's answer to a poll.
+		 * @param type request type
+		 * @param nodeID node ID of the sender, 0 if not registered
+		 * @param items items to encode
+		 * @param length number of items
+		 * @param buffer buffer of at least EMONCMS_MTU bytes
+		 * @return length of the packet, 0 if the request is invalid
+		 **/
+		static uint16_t referenceEncode(RequestType type, uint16_t nodeID, DataItem *items, uint16_t length, uint8_t *buffer);
+		/**
+		 * Encodes a node's multi responses to a poll for a list of
+		 * triples, starting a packet whenever the next entry would take
+		 * one past EMONCMS_MTU. Triples the node has are GID, AID, ATTRNUM
+		 * from items, the ones it lacks are in the next group over.
+		 * @param nodeID node ID of the sender, 0 if not registered
+		 * @param items GID, AID, ATTRNUM and the value read
+		 * @param triples triples polled
+		 * @param present bit set for each triple the node has
+		 * @param buffer buffer of at least FUZZ_MAX_FRAMES * EMONCMS_MTU bytes
+		 * @return length of the packets, 0 if the request is invalid
+		 **/
+		static uint16_t referenceMultiEncode(uint16_t nodeID, DataItem *items, uint8_t triples, uint8_t present, uint8_t *buffer);
+		/**
+		 * Walks the items section of a packet, without using the type table
+		 * @param buffer the raw data items
+		 * @param length bytes available in buffer
+		 * @param count number of items
+		 * @param offsets filled with the offset of each item's type byte
+		 * @return false if an item is unknown or runs past the end
+		 **/
+		static bool referenceDecode(uint8_t *buffer, uint16_t length, uint8_t count, uint16_t offsets[]);
+		/**
+		 * @param type a type code
+		 * @return bytes after the type byte, -1 for unknown codes
+		 **/
+		static int8_t referenceSize(uint8_t type);
+		/**
+		 * Whether a node accepts decoded items as a packet of a type,
+		 * from the items that type reads
+		 * @param type 'r', 'a', 'p' or 'P'
+		 * @param buffer the raw data items
+		 * @param offsets offset of each item's type byte
+		 * @param count number of items
+		 * @param nodeID the node's ID
+		 * @return true if the node should handle the packet
+		 **/
+		static bool referenceAccepts(uint8_t type, uint8_t *buffer, uint16_t offsets[], uint8_t count, uint16_t nodeID);
+	protected:
+		uint32_t random; /** xorshift state **/
+		uint16_t invalidPerMille; /** share of invalid cases **/
+		EMonCMS *nodes[FUZZ_NODES]; /** builders **/
+		uint16_t nodeIDs[FUZZ_NODES]; /** node ID of each builder **/
+		FuzzCase *cases; /** the current batch **/
+		uint32_t frames; /** cases run **/
+		uint32_t rejected; /** cases rejected by both encoders **/
+		uint32_t mismatches; /** disagreements found **/
+		uint32_t splitAnswers; /** multi responses over more than one packet **/
+		uint32_t typeFrames[FUZZ_TYPES]; /** valid cases per request type **/
+		uint32_t calls[FUZZ_PATHS]; /** calls per path **/
+		uint64_t nanoseconds[FUZZ_PATHS]; /** time per path **/
+		AttributeValue registration; /** attribute of the receiver acknowledging registrations **/
+		AttributeValue answer; /** attribute of the builders answering polls **/
+		FuzzCase *capturing; /** case the answer to a poll is captured into **/
+		uint8_t captures; /** frames sent answering the poll **/
+		EMonCMS *receiver; /** parses acknowledgements of the built packets **/
+		bool results[FUZZ_BATCH]; /** outcome of each call in a timed loop **/
+		bool haveFailed; /** whether failed is set **/
+		FuzzCase failed; /** first case that disagreed **/
+		FuzzPath failedPath; /** path that disagreed first **/
+
+		uint32_t nextRandom();
+		/**
+		 * Fills in a random case, valid or not
+		 **/
+		void generate(FuzzCase *fuzzCase);
+		/**
+		 * Polls the case's builder for its attribute, capturing the
+		 * answer into the case's frame
+		 **/
+		void respond(FuzzCase *fuzzCase);
+		/**
+		 * ContextSender capturing a builder's answer to a poll
+		 **/
+		static uint16_t capture(void *context, uint8_t type, uint8_t *buffer, uint16_t length);
+		/**
+		 * Lays out the items of a node's answer to a poll
+		 * @param type ATTR_POST_RESPONSE or ATTR_MULTI_RESPONSE
+		 * @param items GID, AID, ATTRNUM and the value read, if any
+		 * @param length number of items
+		 * @param answer filled with the items after the node ID
+		 * @param status set to the status answered, answer may point to it
+		 * @return number of items in answer
+		 **/
+		static uint16_t answerItems(RequestType type, DataItem *items, uint16_t length, DataItem *answer, uint8_t *status);
+		/**
+		 * Builds the batch with attrBuilder and the reference encoder
+		 * and compares the packets
+		 **/
+		void checkBuild();
+		/**
+		 * Parses the built packets back and compares the items with the
+		 * ones they were built from
+		 **/
+		void checkParse();
+		/**
+		 * Parses every packet of the multi responses to a list of triples
+		 * and compares the entries with the ones expected
+		 * @return true if they match and each packet cut short is refused
+		 **/
+		bool checkAnswers(FuzzCase *fuzzCase);
+		/**
+		 * Decodes random byte strings with all decoders
+		 **/
+		void checkNoise();
+		/**
+		 * @return index of a request type in typeFrames
+		 **/
+		static uint8_t typeIndex(RequestType type);
+		/**
+		 * Reports a mismatch
+		 * @param path path that disagreed
+		 * @param fuzzCase the case, NULL for noise
+		 **/
+		void mismatch(FuzzPath path, FuzzCase *fuzzCase);
+};
+
+#endif
+
+#endif
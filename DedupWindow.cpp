@@ -0,0 +1,94 @@
+#include "DedupWindow.h"
+#include "Debug.h"
+
+DedupWindow::DedupWindow() {
+	memset(this->entries, 0, sizeof(this->entries));
+	memset(this->counts, 0, sizeof(this->counts));
+	this->restarts = 0;
+	this->evictions = 0;
+}
+
+DedupWindow::~DedupWindow() {
+	/* do nothing */
+}
+
+uint8_t DedupWindow::check(uint16_t nodeID, uint32_t sequence) {
+	DedupEntry *entry = &(this->entries[nodeID & (DEDUP_MAX_NODES - 1)]);
+	uint8_t result = DEDUP_NEW;
+
+	if(entry->nodeID != nodeID) {
+		if(entry->nodeID != 0) {
+			this->evictions++;
+		}
+		entry->nodeID = nodeID;
+		entry->top = sequence;
+		entry->seen = 1;
+	} else {
+		/* The difference is signed so the count can wrap */
+		int32_t ahead = (int32_t)(sequence - entry->top);
+		uint32_t behind = entry->top - sequence;
+		if(ahead > 0) {
+			entry->seen = ahead >= DEDUP_WINDOW ? 1 : (entry->seen << ahead) | 1;
+			entry->top = sequence;
+		} else if(behind >= DEDUP_WINDOW) {
+			result = DEDUP_STALE;
+		} else if(entry->seen & ((uint64_t)1 << behind)) {
+			result = DEDUP_DUPLICATE;
+		} else {
+			entry->seen |= (uint64_t)1 << behind;
+			result = DEDUP_REORDERED;
+		}
+	}
+
+	this->counts[result]++;
+	return result;
+}
+
+uint8_t DedupWindow::checkFrame(uint8_t type, uint8_t *buffer, uint16_t length) {
+	HeaderInfo *header = (HeaderInfo *)buffer;
+	if(type != ATTR_POST || length < sizeof(HeaderInfo) || header->dataCount < DEDUP_POST_ITEMS) {
+		this->counts[DEDUP_UNSEQUENCED]++;
+		return DEDUP_UNSEQUENCED;
+	}
+
+	DataItem items[DEDUP_POST_ITEMS];
+	HeaderInfo postHeader = *header;
+	postHeader.dataCount = DEDUP_POST_ITEMS;
+	if(!EMonCMS::parseDataItems(&postHeader, &(buffer[sizeof(HeaderInfo)]), items, length - sizeof(HeaderInfo))) {
+		this->counts[DEDUP_UNSEQUENCED]++;
+		return DEDUP_UNSEQUENCED;
+	}
+	return this->checkItems(&postHeader, items);
+}
+
+uint8_t DedupWindow::checkItems(HeaderInfo *header, DataItem items[]) {
+	if(header->dataCount < DEDUP_POST_ITEMS || items[0].type != USHORT || items[DEDUP_POST_ITEMS - 1].type != UINT) {
+		this->counts[DEDUP_UNSEQUENCED]++;
+		return DEDUP_UNSEQUENCED;
+	}
+	uint16_t nodeID;
+	uint32_t sequence;
+	memcpy(&nodeID, items[0].item, sizeof(nodeID));
+	memcpy(&sequence, items[DEDUP_POST_ITEMS - 1].item, sizeof(sequence));
+	return this->check(nodeID, sequence);
+}
+
+void DedupWindow::forget(uint16_t nodeID) {
+	DedupEntry *entry = &(this->entries[nodeID & (DEDUP_MAX_NODES - 1)]);
+	if(entry->nodeID == nodeID) {
+		this->restarts++;
+		memset(entry, 0, sizeof(DedupEntry));
+	}
+}
+
+uint32_t DedupWindow::getCount(uint8_t result) {
+	return result < DEDUP_RESULTS ? this->counts[result] : 0;
+}
+
+uint32_t DedupWindow::getRestarts() {
+	return this->restarts;
+}
+
+uint32_t DedupWindow::getEvictions() {
+	return this->evictions;
+}
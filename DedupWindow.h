@@ -0,0 +1,114 @@
+#ifndef __DEDUPWINDOW_H__
+#define __DEDUPWINDOW_H__
+
+#include "EMonCMS.h"
+
+#ifndef DEDUP_MAX_NODES
+#define DEDUP_MAX_NODES 256 /** node entries, a power of 2 **/
+#endif
+#define DEDUP_WINDOW 64 /** sequence numbers remembered behind the highest, bits in DedupEntry::seen **/
+#define DEDUP_POST_ITEMS 6 /** NID, GID, AID, ATTRNUM, value, SEQ **/
+
+/**
+ * Outcome of checking a post. Those below DEDUP_DUPLICATE should be
+ * handled, the rest dropped.
+ **/
+enum DedupResult {
+	DEDUP_NEW = 0, /** highest sequence number so far, or first from the node **/
+	DEDUP_REORDERED, /** not seen before but behind the highest **/
+	DEDUP_UNSEQUENCED, /** no sequence number to check **/
+	DEDUP_DUPLICATE, /** seen before **/
+	DEDUP_STALE, /** too far behind to tell, treated as seen **/
+	DEDUP_RESULTS
+};
+
+/**
+ * Sliding window of one node's sequence numbers
+ **/
+typedef struct {
+	uint64_t seen; /** bit n is set once top - n has been accepted **/
+	uint32_t top; /** highest sequence number accepted **/
+	uint16_t nodeID; /** node the entry belongs to, 0 if unused **/
+	uint16_t reserved; /** pads the entry to 16 bytes **/
+} DedupEntry;
+
+/**
+ * Gateway side filter dropping repeated posts, from nodes retransmitting
+ * or from several gateways hearing the same frame. Posts numbered with
+ * EMonCMS::setPostSequence are checked against a window of the last
+ * DEDUP_WINDOW sequence numbers from their node, so posts arriving out
+ * of order within the window are still taken once. Anything further
+ * behind is stale, however far, since a repeat delayed that long cannot
+ * be told from a node counting again. A node starting its count again,
+ * e.g. after a reset, is only recognised when its window is forgotten,
+ * so forget the node when it registers again; until then its posts are
+ * dropped as stale or repeats until they pass the old top.
+ *
+ * Entries are a fixed table indexed by the low bits of the node ID, so a
+ * check is a few shifts and never allocates. Two nodes sharing an entry
+ * take it from each other, which resets the window and lets repeats
+ * through, so size DEDUP_MAX_NODES to the number of nodes. Each node
+ * touches only its own entry: ingest sharded on node ID can give each
+ * shard its own DedupWindow without locking.
+ **/
+class DedupWindow {
+	public:
+		DedupWindow();
+		~DedupWindow();
+		/**
+		 * Checks a sequence number and records it if new
+		 * @param nodeID node the post came from
+		 * @param sequence sequence number of the post
+		 * @return a DedupResult
+		 **/
+		uint8_t check(uint16_t nodeID, uint32_t sequence);
+		/**
+		 * Checks a received frame. Anything but a post with a sequence
+		 * number is DEDUP_UNSEQUENCED.
+		 * @param type type of the frame
+		 * @param buffer the whole frame, including header
+		 * @param length length of the frame
+		 * @return a DedupResult
+		 **/
+		uint8_t checkFrame(uint8_t type, uint8_t *buffer, uint16_t length);
+		/**
+		 * Checks the parsed items of a post. A post without a sequence
+		 * number is DEDUP_UNSEQUENCED.
+		 * @param header header of the post
+		 * @param items parsed items: NID, GID, AID, ATTRNUM, value, SEQ
+		 * @return a DedupResult
+		 **/
+		uint8_t checkItems(HeaderInfo *header, DataItem items[]);
+		/**
+		 * Clears a node's window, e.g. when it registers again or its ID
+		 * is given to a new node
+		 **/
+		void forget(uint16_t nodeID);
+		/**
+		 * @param result a DedupResult
+		 * @return true if the post should be handled
+		 **/
+		static inline bool accepted(uint8_t result) {
+			return result < DEDUP_DUPLICATE;
+		}
+		/**
+		 * @param result a DedupResult
+		 * @return number of checks with that result
+		 **/
+		uint32_t getCount(uint8_t result);
+		/**
+		 * @return windows cleared by forget
+		 **/
+		uint32_t getRestarts();
+		/**
+		 * @return entries taken over by a different node
+		 **/
+		uint32_t getEvictions();
+	protected:
+		DedupEntry entries[DEDUP_MAX_NODES]; /** window of each node **/
+		uint32_t counts[DEDUP_RESULTS]; /** checks by result **/
+		uint32_t restarts; /** windows cleared by forget **/
+		uint32_t evictions; /** entries changing node **/
+};
+
+#endif
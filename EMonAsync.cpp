@@ -0,0 +1,717 @@
+#if defined(LINUX) && defined(EMONCMS_COROUTINES)
+
+#include "EMonAsync.h"
+#include "Debug.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define TIMER_SLOT_BITS 20 /** low bits of a timer ID holding the slot plus one **/
+#define TIMER_SLOT_MASK ((1u << TIMER_SLOT_BITS) - 1)
+
+/**
+ * @return true if deadline a comes before deadline b
+ **/
+static inline bool deadlineBefore(uint32_t a, uint32_t b) {
+	return (int32_t)(a - b) < 0;
+}
+
+EventLoop::EventLoop(uint32_t maxFds, uint32_t maxTimers) {
+	if(maxTimers >= TIMER_SLOT_MASK) {
+		maxTimers = TIMER_SLOT_MASK - 1;
+	}
+	this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+	this->watches = (AsyncWatch *)calloc(maxFds, sizeof(AsyncWatch));
+	this->timers = (AsyncTimer *)calloc(maxTimers, sizeof(AsyncTimer));
+	this->heap = (uint32_t *)malloc(sizeof(uint32_t) * maxTimers);
+	this->freeTimers = (uint32_t *)malloc(sizeof(uint32_t) * maxTimers);
+	bool allocated = this->watches != NULL && this->timers != NULL && this->heap != NULL && this->freeTimers != NULL;
+	this->maxFds = allocated ? maxFds : 0;
+	this->maxTimers = allocated ? maxTimers : 0;
+	for(uint32_t i = 0; i < this->maxTimers; i++) {
+		this->freeTimers[i] = this->maxTimers - 1 - i;
+	}
+	this->freeCount = this->maxTimers;
+	this->heapCount = 0;
+	this->watchCount = 0;
+	this->stopped = false;
+}
+
+EventLoop::~EventLoop() {
+	if(this->epollFd >= 0) {
+		close(this->epollFd);
+	}
+	free(this->watches);
+	free(this->timers);
+	free(this->heap);
+	free(this->freeTimers);
+}
+
+bool EventLoop::watch(int fd, ReadHandler handler, void *context) {
+	if(fd < 0 || (uint32_t)fd >= this->maxFds || handler == NULL) {
+		return false;
+	}
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	int op = this->watches[fd].handler == NULL ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+	if(epoll_ctl(this->epollFd, op, fd, &event) != 0) {
+		LOG(F("EventLoop: could not watch descriptor\r\n"));
+		return false;
+	}
+	if(op == EPOLL_CTL_ADD) {
+		this->watchCount++;
+	}
+	this->watches[fd].handler = handler;
+	this->watches[fd].context = context;
+	return true;
+}
+
+void EventLoop::unwatch(int fd) {
+	if(fd < 0 || (uint32_t)fd >= this->maxFds || this->watches[fd].handler == NULL) {
+		return;
+	}
+	epoll_ctl(this->epollFd, EPOLL_CTL_DEL, fd, NULL);
+	this->watches[fd].handler = NULL;
+	this->watches[fd].context = NULL;
+	this->watchCount--;
+}
+
+void EventLoop::siftUp(uint32_t index) {
+	uint32_t slot = this->heap[index];
+	while(index > 0) {
+		uint32_t parent = (index - 1) / 2;
+		if(!deadlineBefore(this->timers[slot].deadline, this->timers[this->heap[parent]].deadline)) {
+			break;
+		}
+		this->heap[index] = this->heap[parent];
+		this->timers[this->heap[index]].heapIndex = index;
+		index = parent;
+	}
+	this->heap[index] = slot;
+	this->timers[slot].heapIndex = index;
+}
+
+void EventLoop::siftDown(uint32_t index) {
+	uint32_t slot = this->heap[index];
+	for(;;) {
+		uint32_t child = index * 2 + 1;
+		if(child >= this->heapCount) {
+			break;
+		}
+		if(child + 1 < this->heapCount && deadlineBefore(this->timers[this->heap[child + 1]].deadline,
+				this->timers[this->heap[child]].deadline)) {
+			child++;
+		}
+		if(!deadlineBefore(this->timers[this->heap[child]].deadline, this->timers[slot].deadline)) {
+			break;
+		}
+		this->heap[index] = this->heap[child];
+		this->timers[this->heap[index]].heapIndex = index;
+		index = child;
+	}
+	this->heap[index] = slot;
+	this->timers[slot].heapIndex = index;
+}
+
+uint32_t EventLoop::startTimer(uint32_t ms, TimerHandler handler, void *context) {
+	if(this->freeCount == 0 || handler == NULL) {
+		LOG(F("EventLoop: no free timers\r\n"));
+		return ASYNC_NO_TIMER;
+	}
+	uint32_t slot = this->freeTimers[--this->freeCount];
+	AsyncTimer *timer = &(this->timers[slot]);
+	timer->deadline = this->clock.millis() + ms;
+	timer->handler = handler;
+	timer->context = context;
+	this->heap[this->heapCount] = slot;
+	this->siftUp(this->heapCount++);
+	return ((uint32_t)timer->generation << TIMER_SLOT_BITS) | (slot + 1);
+}
+
+void EventLoop::cancelTimer(uint32_t id) {
+	uint32_t slot = (id & TIMER_SLOT_MASK) - 1;
+	if(id == ASYNC_NO_TIMER || slot >= this->maxTimers) {
+		return;
+	}
+	AsyncTimer *timer = &(this->timers[slot]);
+	if(timer->handler == NULL || (timer->generation & (0xFFFFFFFF >> TIMER_SLOT_BITS)) != id >> TIMER_SLOT_BITS) {
+		return;
+	}
+	this->removeTimer(slot);
+}
+
+void EventLoop::removeTimer(uint32_t slot) {
+	AsyncTimer *timer = &(this->timers[slot]);
+	uint32_t index = timer->heapIndex;
+	uint32_t last = this->heap[--this->heapCount];
+	if(index != this->heapCount) {
+		/* Move the last entry into the hole, it may need to go either way */
+		this->heap[index] = last;
+		this->timers[last].heapIndex = index;
+		this->siftUp(index);
+		this->siftDown(this->timers[last].heapIndex);
+	}
+	timer->handler = NULL;
+	timer->generation++;
+	this->freeTimers[this->freeCount++] = slot;
+}
+
+void EventLoop::fireTimers() {
+	uint32_t now = this->clock.millis();
+	while(this->heapCount > 0 && clockReached(now, this->timers[this->heap[0]].deadline)) {
+		uint32_t slot = this->heap[0];
+		TimerHandler handler = this->timers[slot].handler;
+		void *context = this->timers[slot].context;
+		/* Free the slot first so the handler can start another timer */
+		this->removeTimer(slot);
+		handler(context);
+	}
+}
+
+void EventLoop::stopHandler(void *context) {
+	((EventLoop *)context)->stop();
+}
+
+void EventLoop::run(uint32_t limit) {
+	this->stopped = false;
+	uint32_t limitTimer = limit > 0 ? this->startTimer(limit, EventLoop::stopHandler, this) : ASYNC_NO_TIMER;
+	struct epoll_event events[ASYNC_MAX_EVENTS];
+
+	while(!this->stopped && (this->watchCount > 0 || this->heapCount > 0)) {
+		int timeout = -1;
+		if(this->heapCount > 0) {
+			int32_t wait = (int32_t)(this->timers[this->heap[0]].deadline - this->clock.millis());
+			timeout = wait < 0 ? 0 : wait;
+		}
+		int count = epoll_wait(this->epollFd, events, ASYNC_MAX_EVENTS, timeout);
+		if(count < 0 && errno != EINTR) {
+			LOG(F("EventLoop: epoll_wait failed\r\n"));
+			break;
+		}
+		for(int i = 0; i < count; i++) {
+			int fd = events[i].data.fd;
+			/* an earlier handler may have stopped watching it */
+			if(this->watches[fd].handler != NULL) {
+				this->watches[fd].handler(this->watches[fd].context, fd);
+			}
+		}
+		this->fireTimers();
+	}
+
+	this->cancelTimer(limitTimer);
+}
+
+void EventLoop::stop() {
+	this->stopped = true;
+}
+
+EMonClock *EventLoop::getClock() {
+	return &(this->clock);
+}
+
+bool radioPair(int fds[2], bool nonblocking) {
+	int type = SOCK_SEQPACKET | SOCK_CLOEXEC | (nonblocking ? SOCK_NONBLOCK : 0);
+	if(socketpair(AF_UNIX, type, 0, fds) != 0) {
+		LOG(F("radioPair: socketpair failed\r\n"));
+		return false;
+	}
+	return true;
+}
+
+uint16_t radioSend(int fd, uint8_t type, uint8_t *buffer, uint16_t length) {
+	struct iovec parts[2];
+	parts[0].iov_base = &type;
+	parts[0].iov_len = sizeof(type);
+	parts[1].iov_base = buffer;
+	parts[1].iov_len = length;
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = parts;
+	message.msg_iovlen = 2;
+	if(sendmsg(fd, &message, MSG_NOSIGNAL) != (ssize_t)(length + sizeof(type))) {
+		LOG(F("radioSend: frame not sent\r\n"));
+		return 0;
+	}
+	return length;
+}
+
+int32_t radioReceive(int fd, uint8_t *type, uint8_t *buffer) {
+	/* The type goes in its own part so the frame stays aligned */
+	struct iovec parts[2];
+	parts[0].iov_base = type;
+	parts[0].iov_len = sizeof(*type);
+	parts[1].iov_base = buffer;
+	parts[1].iov_len = EMONCMS_MTU;
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = parts;
+	message.msg_iovlen = 2;
+	ssize_t received = recvmsg(fd, &message, 0);
+	if(received < 0) {
+		return -1;
+	}
+	return received == 0 ? 0 : (int32_t)(received - sizeof(*type));
+}
+
+RegisteredAwaiter::RegisteredAwaiter(AsyncNode *node) {
+	this->node = node;
+}
+
+bool RegisteredAwaiter::await_ready() {
+	return this->node->node.getNodeID() != 0;
+}
+
+void RegisteredAwaiter::await_suspend(std::coroutine_handle<> handle) {
+	this->node->registerWaiter = handle;
+	if(this->node->registerTimer == ASYNC_NO_TIMER) {
+		this->node->requestNodeID();
+	}
+}
+
+uint16_t RegisteredAwaiter::await_resume() {
+	return this->node->node.getNodeID();
+}
+
+PostAwaiter::PostAwaiter(AsyncNode *node, AttributeIdentifier *ident, uint32_t timeout) {
+	this->node = node;
+	this->ident = ident;
+	this->timeout = timeout;
+	this->done = false;
+}
+
+bool PostAwaiter::await_ready() {
+	return false;
+}
+
+bool PostAwaiter::await_suspend(std::coroutine_handle<> handle) {
+	/* One post waits at a time, others fail straight away, as does a
+	 *  post that could never time out.
+	 */
+	if(this->node->postWaiter) {
+		this->done = true;
+		return false;
+	}
+	uint32_t timer = this->node->loop->startTimer(this->timeout, AsyncNode::postTimeout, this->node);
+	if(timer == ASYNC_NO_TIMER) {
+		this->done = true;
+		return false;
+	}
+	if(this->node->node.postAttribute(this->ident) == 0) {
+		this->node->loop->cancelTimer(timer);
+		this->done = true;
+		return false;
+	}
+	this->node->postWaiter = handle;
+	this->node->postIdent = this->ident;
+	this->node->postAcked = false;
+	this->node->postTimer = timer;
+	return true;
+}
+
+bool PostAwaiter::await_resume() {
+	return this->done ? false : this->node->postAcked;
+}
+
+AsyncNode::AsyncNode(EventLoop *loop, int fd, AttributeValue values[], int16_t length, uint16_t nodeID) {
+	this->loop = loop;
+	this->fd = fd;
+	this->node = EMonCMS(values, length, NULL, NULL, NULL, nodeID);
+	this->node.setSender(AsyncNode::sender, this);
+	this->node.setClock(loop->getClock());
+	this->registerTimer = ASYNC_NO_TIMER;
+	this->postIdent = NULL;
+	this->postTimer = ASYNC_NO_TIMER;
+	this->postAcked = false;
+	loop->watch(fd, AsyncNode::readable, this);
+}
+
+AsyncNode::~AsyncNode() {
+	this->loop->unwatch(this->fd);
+	this->loop->cancelTimer(this->registerTimer);
+	this->loop->cancelTimer(this->postTimer);
+}
+
+RegisteredAwaiter AsyncNode::registered() {
+	return RegisteredAwaiter(this);
+}
+
+PostAwaiter AsyncNode::post(AttributeIdentifier *ident, uint32_t timeout) {
+	return PostAwaiter(this, ident, timeout);
+}
+
+EMonCMS *AsyncNode::getNode() {
+	return &(this->node);
+}
+
+void AsyncNode::requestNodeID() {
+	this->node.attrSender(NODE_REGISTER, NULL, 0);
+	this->registerTimer = this->loop->startTimer(REGISTERREQUESTTIMEOUT, AsyncNode::registerTimeout, this);
+}
+
+void AsyncNode::registerTimeout(void *context) {
+	AsyncNode *self = (AsyncNode *)context;
+	self->registerTimer = ASYNC_NO_TIMER;
+	if(self->node.getNodeID() == 0) {
+		self->requestNodeID();
+	}
+}
+
+void AsyncNode::postTimeout(void *context) {
+	AsyncNode *self = (AsyncNode *)context;
+	self->postTimer = ASYNC_NO_TIMER;
+	self->postAcked = false;
+	std::coroutine_handle<> waiter = self->postWaiter;
+	self->postWaiter = nullptr;
+	waiter.resume();
+}
+
+uint16_t AsyncNode::sender(void *context, uint8_t type, uint8_t *buffer, uint16_t length) {
+	return radioSend(((AsyncNode *)context)->fd, type, buffer, length);
+}
+
+void AsyncNode::readable(void *context, int fd) {
+	AsyncNode *self = (AsyncNode *)context;
+	uint8_t frame[EMONCMS_MTU] __attribute__((aligned(4)));
+	uint8_t type;
+	int32_t length;
+	/* Waiters are resumed once self is no longer needed, as a resumed
+	 *  coroutine may destroy the node.
+	 */
+	std::coroutine_handle<> registered = nullptr;
+	std::coroutine_handle<> posted = nullptr;
+
+	while((length = radioReceive(fd, &type, frame)) > 0) {
+		HeaderInfo *header = (HeaderInfo *)frame;
+		uint8_t *data = &(frame[sizeof(HeaderInfo)]);
+		if(length < (int32_t)sizeof(HeaderInfo) || header->dataCount > ASYNC_MAX_ITEMS
+				|| !EMonCMS::parseDataItems(header, data, self->items, length - sizeof(HeaderInfo))) {
+			LOG(F("AsyncNode: malformed frame\r\n"));
+			continue;
+		}
+
+		uint16_t nodeID = self->node.getNodeID();
+		self->node.parseEMonCMSPacket(header, type, data, self->items);
+
+		if(nodeID == 0 && self->node.getNodeID() != 0) {
+			/* Registered, the attributes can follow straight away */
+			self->node.registerAttributes();
+			self->loop->cancelTimer(self->registerTimer);
+			self->registerTimer = ASYNC_NO_TIMER;
+			if(self->registerWaiter) {
+				registered = self->registerWaiter;
+				self->registerWaiter = nullptr;
+			}
+		} else if(type == ATTR_POST_RESPONSE && self->postWaiter && header->dataCount >= 4) {
+			AttributeIdentifier ident;
+			memcpy(&(ident.groupID), self->items[1].item, sizeof(uint16_t));
+			memcpy(&(ident.attributeID), self->items[2].item, sizeof(uint16_t));
+			memcpy(&(ident.attributeNumber), self->items[3].item, sizeof(uint16_t));
+			if(self->node.compareAttribute(&ident, self->postIdent) == 0) {
+				self->postAcked = header->status == SUCCESS;
+				self->loop->cancelTimer(self->postTimer);
+				self->postTimer = ASYNC_NO_TIMER;
+				posted = self->postWaiter;
+				self->postWaiter = nullptr;
+			}
+		}
+	}
+	if(length == 0) {
+		self->loop->unwatch(fd);
+	}
+
+	if(registered) {
+		registered.resume();
+	}
+	if(posted) {
+		posted.resume();
+	}
+}
+
+PollAwaiter::PollAwaiter(AsyncGateway *gateway, uint16_t nodeID, AttributeIdentifier *ident, uint32_t timeout) {
+	this->gateway = gateway;
+	this->link = NULL;
+	this->nodeID = nodeID;
+	this->ident = *ident;
+	this->timeout = timeout;
+	this->timer = ASYNC_NO_TIMER;
+	this->reply.status = FAILURE;
+	this->reply.type = 0;
+	memset(this->reply.value, 0, sizeof(this->reply.value));
+	this->next = NULL;
+}
+
+bool PollAwaiter::await_ready() {
+	this->link = this->gateway->nodeLinks[this->nodeID];
+	return this->nodeID == 0 || this->link == NULL;
+}
+
+bool PollAwaiter::await_suspend(std::coroutine_handle<> handle) {
+	/* Without a timer a lost answer would never resume the poll, so it
+	 *  times out straight away.
+	 */
+	this->timer = this->gateway->loop->startTimer(this->timeout, AsyncGateway::pollTimeout, this);
+	if(this->timer == ASYNC_NO_TIMER) {
+		return false;
+	}
+
+	/* NID, GID, AID, ATTRNUM, all USHORT */
+	uint8_t frame[sizeof(HeaderInfo) + 12] __attribute__((aligned(4)));
+	HeaderInfo *header = (HeaderInfo *)frame;
+	header->dataSize = 12;
+	header->status = SUCCESS;
+	header->dataCount = 4;
+	uint16_t values[4] = { this->nodeID, this->ident.groupID, this->ident.attributeID, this->ident.attributeNumber };
+	for(uint8_t i = 0; i < 4; i++) {
+		frame[sizeof(HeaderInfo) + i * 3] = USHORT;
+		memcpy(&(frame[sizeof(HeaderInfo) + i * 3 + 1]), &(values[i]), sizeof(uint16_t));
+	}
+	if(radioSend(this->link->fd, ATTR_POST, frame, sizeof(frame)) == 0) {
+		this->gateway->loop->cancelTimer(this->timer);
+		this->timer = ASYNC_NO_TIMER;
+		return false;
+	}
+	this->handle = handle;
+	this->next = this->link->polls;
+	this->link->polls = this;
+	return true;
+}
+
+PollReply PollAwaiter::await_resume() {
+	return this->reply;
+}
+
+AsyncGateway::AsyncGateway(EventLoop *loop, uint32_t maxLinks, AsyncPostHandler handler, void *context) {
+	this->loop = loop;
+	this->table = new NodeTable(ASYNC_ARENA_SLOTS);
+	this->links = (AsyncLink *)calloc(maxLinks, sizeof(AsyncLink));
+	this->nodeLinks = (AsyncLink **)calloc(NODETABLE_SIZE, sizeof(AsyncLink *));
+	this->maxLinks = this->links != NULL && this->nodeLinks != NULL ? maxLinks : 0;
+	this->linkCount = 0;
+	this->handler = handler;
+	this->context = context;
+	this->posts = 0;
+}
+
+AsyncGateway::~AsyncGateway() {
+	for(uint32_t i = 0; i < this->linkCount; i++) {
+		this->loop->unwatch(this->links[i].fd);
+	}
+	free(this->links);
+	free(this->nodeLinks);
+	delete this->table;
+}
+
+bool AsyncGateway::addLink(int fd) {
+	if(this->linkCount >= this->maxLinks) {
+		LOG(F("AsyncGateway: no room for link\r\n"));
+		return false;
+	}
+	AsyncLink *link = &(this->links[this->linkCount]);
+	link->gateway = this;
+	link->fd = fd;
+	link->nodeID = 0;
+	link->polls = NULL;
+	link->answered = NULL;
+	if(!this->loop->watch(fd, AsyncGateway::readable, link)) {
+		return false;
+	}
+	this->linkCount++;
+	return true;
+}
+
+PollAwaiter AsyncGateway::poll(uint16_t nodeID, AttributeIdentifier *ident, uint32_t timeout) {
+	return PollAwaiter(this, nodeID, ident, timeout);
+}
+
+NodeTable *AsyncGateway::getTable() {
+	return this->table;
+}
+
+DedupWindow *AsyncGateway::getDedup() {
+	return &(this->dedup);
+}
+
+uint32_t AsyncGateway::getPosts() {
+	return this->posts;
+}
+
+void AsyncGateway::readable(void *context, int fd) {
+	AsyncLink *link = (AsyncLink *)context;
+	uint8_t frame[EMONCMS_MTU] __attribute__((aligned(4)));
+	uint8_t type;
+	int32_t length;
+
+	while((length = radioReceive(fd, &type, frame)) > 0) {
+		link->gateway->handleFrame(link, type, frame, length);
+	}
+	if(length == 0) {
+		link->gateway->loop->unwatch(fd);
+	}
+
+	/* A resumed poll may tear down the gateway, so nothing is touched after */
+	PollAwaiter *answered = link->answered;
+	link->answered = NULL;
+	while(answered != NULL) {
+		PollAwaiter *poll = answered;
+		answered = poll->next;
+		poll->handle.resume();
+	}
+}
+
+void AsyncGateway::handleFrame(AsyncLink *link, uint8_t type, uint8_t *frame, uint16_t length) {
+	HeaderInfo *header = (HeaderInfo *)frame;
+	uint8_t *data = &(frame[sizeof(HeaderInfo)]);
+	if(length < sizeof(HeaderInfo) || header->dataCount > ASYNC_MAX_ITEMS
+			|| !EMonCMS::parseDataItems(header, data, this->items, length - sizeof(HeaderInfo))) {
+		LOG(F("AsyncGateway: malformed frame\r\n"));
+		return;
+	}
+
+	if(type == NODE_REGISTER) {
+		/* A resent request gets the ID already given out */
+		if(link->nodeID == 0) {
+			link->nodeID = this->table->allocate();
+			if(link->nodeID == 0) {
+				LOG(F("AsyncGateway: out of node IDs\r\n"));
+				return;
+			}
+			this->nodeLinks[link->nodeID] = link;
+		}
+		/* A node asking for an ID, even again, has started its count again */
+		this->dedup.forget(link->nodeID);
+		uint8_t response[sizeof(HeaderInfo) + 3] __attribute__((aligned(4)));
+		HeaderInfo *responseHeader = (HeaderInfo *)response;
+		responseHeader->dataSize = 3;
+		responseHeader->status = SUCCESS;
+		responseHeader->dataCount = 1;
+		response[sizeof(HeaderInfo)] = USHORT;
+		memcpy(&(response[sizeof(HeaderInfo) + 1]), &(link->nodeID), sizeof(uint16_t));
+		radioSend(link->fd, 'r', response, sizeof(response));
+		return;
+	}
+
+	/* Everything else is NID, GID, AID, ATTRNUM first */
+	if(header->dataCount < 4) {
+		return;
+	}
+	for(uint8_t i = 0; i < 4; i++) {
+		if(this->items[i].type != USHORT) {
+			return;
+		}
+	}
+	uint16_t nodeID;
+	memcpy(&nodeID, this->items[0].item, sizeof(nodeID));
+	if(link->nodeID == 0 && nodeID != 0) {
+		/* A node configured with its ID never asks for one */
+		this->table->assign(nodeID);
+		link->nodeID = nodeID;
+		this->nodeLinks[nodeID] = link;
+	}
+
+	uint32_t now = this->loop->getClock()->millis();
+	bool known;
+	switch(type) {
+		case ATTR_REGISTER:
+			/* A node registers after a reset and counts its posts again.
+			 *  A registration only resent lets a repeat of an earlier post
+			 *  through, which beats dropping the node's posts as stale.
+			 */
+			this->dedup.forget(nodeID);
+			known = this->table->handleFrame(type, frame, length, now);
+			this->acknowledge(link, 'a', frame, known ? SUCCESS : FAILURE);
+			break;
+		case ATTR_POST:
+			known = this->table->handleFrame(type, frame, length, now);
+			/* Repeats are acknowledged again, in case the first acknowledgement was lost */
+			if(known && DedupWindow::accepted(this->dedup.checkFrame(type, frame, length))) {
+				this->posts++;
+				if(this->handler != NULL) {
+					AttributeIdentifier ident;
+					memcpy(&(ident.groupID), this->items[1].item, sizeof(uint16_t));
+					memcpy(&(ident.attributeID), this->items[2].item, sizeof(uint16_t));
+					memcpy(&(ident.attributeNumber), this->items[3].item, sizeof(uint16_t));
+					this->handler(this->context, nodeID, &ident, &(this->items[4]));
+				}
+			}
+			this->acknowledge(link, ATTR_POST_RESPONSE, frame, known ? SUCCESS : UNSUPPORTED_ATTRIBUTE);
+			break;
+		case ATTR_POST_RESPONSE:
+			this->table->seen(nodeID, now);
+			this->answerPoll(link, header);
+			break;
+		default:
+			LOG(F("AsyncGateway: unhandled frame type\r\n"));
+			break;
+	}
+}
+
+void AsyncGateway::acknowledge(AsyncLink *link, uint8_t type, uint8_t *frame, uint8_t status) {
+	uint8_t response[sizeof(HeaderInfo) + 12] __attribute__((aligned(4)));
+	HeaderInfo *header = (HeaderInfo *)response;
+	header->dataSize = 12;
+	header->status = status;
+	header->dataCount = 4;
+	memcpy(&(response[sizeof(HeaderInfo)]), &(frame[sizeof(HeaderInfo)]), 12);
+	radioSend(link->fd, type, response, sizeof(response));
+}
+
+void AsyncGateway::answerPoll(AsyncLink *link, HeaderInfo *header) {
+	AttributeIdentifier ident;
+	memcpy(&(ident.groupID), this->items[1].item, sizeof(uint16_t));
+	memcpy(&(ident.attributeID), this->items[2].item, sizeof(uint16_t));
+	memcpy(&(ident.attributeNumber), this->items[3].item, sizeof(uint16_t));
+
+	/* The oldest poll for the attribute is at the end of the list */
+	PollAwaiter **match = NULL;
+	for(PollAwaiter **poll = &(link->polls); *poll != NULL; poll = &((*poll)->next)) {
+		if((*poll)->ident.groupID == ident.groupID && (*poll)->ident.attributeID == ident.attributeID
+				&& (*poll)->ident.attributeNumber == ident.attributeNumber) {
+			match = poll;
+		}
+	}
+	if(match == NULL) {
+		LOG(F("AsyncGateway: answer for no poll\r\n"));
+		return;
+	}
+
+	PollAwaiter *poll = *match;
+	*match = poll->next;
+	this->loop->cancelTimer(poll->timer);
+	poll->reply.status = header->status;
+	if(header->status == SUCCESS && header->dataCount >= 5) {
+		/* The items were parsed over the received length, so the value's
+		 *  own size is in the frame whatever dataSize claims.
+		 */
+		uint8_t size = typeSize(this->items[4].type);
+		poll->reply.type = this->items[4].type;
+		memcpy(poll->reply.value, this->items[4].item, size < sizeof(poll->reply.value) ? size : sizeof(poll->reply.value));
+	}
+
+	/* Answered in the order the frames came */
+	PollAwaiter **tail = &(link->answered);
+	while(*tail != NULL) {
+		tail = &((*tail)->next);
+	}
+	poll->next = NULL;
+	*tail = poll;
+}
+
+void AsyncGateway::pollTimeout(void *context) {
+	PollAwaiter *poll = (PollAwaiter *)context;
+	for(PollAwaiter **entry = &(poll->link->polls); *entry != NULL; entry = &((*entry)->next)) {
+		if(*entry == poll) {
+			*entry = poll->next;
+			break;
+		}
+	}
+	poll->timer = ASYNC_NO_TIMER;
+	poll->reply.status = FAILURE;
+	poll->handle.resume();
+}
+
+#endif
@@ -0,0 +1,405 @@
+#ifndef __EMONASYNC_H__
+#define __EMONASYNC_H__
+
+#if defined(LINUX) && defined(EMONCMS_COROUTINES)
+
+#include <coroutine>
+#include <exception>
+
+#include "EMonCMS.h"
+#include "EMonClock.h"
+#include "NodeTable.h"
+#include "DedupWindow.h"
+
+#define ASYNC_MAX_EVENTS 64 /** epoll events handled per wait **/
+#define ASYNC_NO_TIMER 0 /** timer ID of no timer **/
+#define ASYNC_POLL_TIMEOUT 1000 /** default ms a poll waits for its answer **/
+#define ASYNC_POST_TIMEOUT 1000 /** default ms a post waits for its acknowledgement **/
+#define ASYNC_ARENA_SLOTS 65536 /** attribute slots in the gateway NodeTable **/
+#define ASYNC_MAX_ITEMS ((EMONCMS_MTU - sizeof(HeaderInfo)) / 3) /** items in a received frame, all 3 byte USHORTs at most **/
+
+/**
+ * Called when a watched file descriptor is readable
+ * @param context the context given to watch
+ * @param fd the readable descriptor
+ **/
+typedef void (*ReadHandler)(void *context, int fd);
+
+/**
+ * Called when a timer expires
+ * @param context the context given to startTimer
+ **/
+typedef void (*TimerHandler)(void *context);
+
+/**
+ * A timer slot, in the event loop's heap while running
+ **/
+typedef struct {
+	uint32_t deadline; /** ms time it expires **/
+	TimerHandler handler; /** called on expiry, NULL if the slot is free **/
+	void *context; /** passed to handler **/
+	uint32_t heapIndex; /** position in the heap **/
+	uint16_t generation; /** bumped on reuse so stale IDs are ignored **/
+} AsyncTimer;
+
+/**
+ * A watched file descriptor
+ **/
+typedef struct {
+	ReadHandler handler; /** NULL if not watched **/
+	void *context; /** passed to handler **/
+} AsyncWatch;
+
+/**
+ * Single threaded event loop over epoll with millisecond timers, for
+ * running many node conversations as coroutines without a thread each.
+ * Timers are kept in a binary heap of preallocated slots so starting and
+ * cancelling one is O(log n) and never allocates.
+ **/
+class EventLoop {
+	public:
+		/**
+		 * @param maxFds highest file descriptor that can be watched, plus one
+		 * @param maxTimers timers that can run at once
+		 **/
+		EventLoop(uint32_t maxFds, uint32_t maxTimers);
+		~EventLoop();
+		/**
+		 * Calls a handler whenever the descriptor is readable
+		 * @return false if fd is out of range or epoll refuses it
+		 **/
+		bool watch(int fd, ReadHandler handler, void *context);
+		/**
+		 * Stops watching a descriptor
+		 **/
+		void unwatch(int fd);
+		/**
+		 * Calls a handler once after a delay
+		 * @param ms delay in ms
+		 * @return ID for cancelTimer, ASYNC_NO_TIMER if all slots are in use
+		 **/
+		uint32_t startTimer(uint32_t ms, TimerHandler handler, void *context);
+		/**
+		 * Stops a timer before it expires, IDs of expired timers are ignored
+		 **/
+		void cancelTimer(uint32_t id);
+		/**
+		 * Handles events until stop is called or the time limit passes
+		 * @param limit ms to run for, 0 for no limit
+		 **/
+		void run(uint32_t limit = 0);
+		/**
+		 * Makes run return once the current event is handled
+		 **/
+		void stop();
+		/**
+		 * @return clock timers are measured with
+		 **/
+		EMonClock *getClock();
+	protected:
+		int epollFd; /** epoll instance **/
+		MonotonicClock clock; /** time for timers **/
+		AsyncWatch *watches; /** watched descriptors indexed by fd **/
+		uint32_t maxFds; /** size of watches **/
+		AsyncTimer *timers; /** timer slots **/
+		uint32_t *heap; /** slots of running timers ordered by deadline **/
+		uint32_t heapCount; /** running timers **/
+		uint32_t *freeTimers; /** stack of free slots **/
+		uint32_t freeCount; /** entries in freeTimers **/
+		uint32_t maxTimers; /** number of slots **/
+		uint32_t watchCount; /** descriptors watched **/
+		bool stopped; /** set by stop **/
+
+		/**
+		 * Restores heap order around an entry
+		 **/
+		void siftUp(uint32_t index);
+		void siftDown(uint32_t index);
+		/**
+		 * Removes a timer from the heap and frees its slot
+		 **/
+		void removeTimer(uint32_t slot);
+		/**
+		 * Calls the handlers of expired timers
+		 **/
+		void fireTimers();
+		/**
+		 * Timer handler for the run time limit
+		 **/
+		static void stopHandler(void *context);
+};
+
+/**
+ * Coroutine return type for fire and forget conversations. The coroutine
+ * starts running at once and its frame is freed when it finishes.
+ **/
+class AsyncTask {
+	public:
+		struct promise_type {
+			AsyncTask get_return_object() { return AsyncTask(); }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception() { std::terminate(); }
+		};
+};
+
+/**
+ * Creates a connected pair of pseudo radio descriptors, each message
+ * carrying one frame
+ * @param fds filled with the two ends
+ * @param nonblocking set O_NONBLOCK on both ends, for use with EventLoop
+ * @return false on failure
+ **/
+bool radioPair(int fds[2], bool nonblocking);
+
+/**
+ * Sends a frame over a pseudo radio
+ * @return length on success, 0 on failure
+ **/
+uint16_t radioSend(int fd, uint8_t type, uint8_t *buffer, uint16_t length);
+
+/**
+ * Receives a frame from a pseudo radio
+ * @param type set to the frame type
+ * @param buffer EMONCMS_MTU bytes to receive into
+ * @return frame length, 0 if closed, -1 if nothing is waiting or on error
+ **/
+int32_t radioReceive(int fd, uint8_t *type, uint8_t *buffer);
+
+class AsyncNode;
+class AsyncGateway;
+class PollAwaiter;
+
+/**
+ * Awaitable waiting for a node to be given its ID, see AsyncNode::registered
+ **/
+class RegisteredAwaiter {
+	public:
+		RegisteredAwaiter(AsyncNode *node);
+		bool await_ready();
+		void await_suspend(std::coroutine_handle<> handle);
+		/**
+		 * @return the node ID
+		 **/
+		uint16_t await_resume();
+	protected:
+		AsyncNode *node; /** node being registered **/
+};
+
+/**
+ * Awaitable waiting for a post to be acknowledged, see AsyncNode::post
+ **/
+class PostAwaiter {
+	public:
+		PostAwaiter(AsyncNode *node, AttributeIdentifier *ident, uint32_t timeout);
+		bool await_ready();
+		/**
+		 * Sends the post
+		 * @return false, without suspending, if the post failed to send
+		 *  or no timer was free to time it out
+		 **/
+		bool await_suspend(std::coroutine_handle<> handle);
+		/**
+		 * @return true if the gateway acknowledged the post
+		 **/
+		bool await_resume();
+	protected:
+		AsyncNode *node; /** node posting **/
+		AttributeIdentifier *ident; /** attribute posted **/
+		uint32_t timeout; /** ms to wait for the acknowledgement **/
+		bool done; /** result known without waiting **/
+};
+
+/**
+ * A node end of a pseudo radio driven by an EventLoop. The EMonCMS node
+ * answers attribute requests by itself, registered and post can be
+ * awaited from a coroutine.
+ **/
+class AsyncNode {
+	friend class RegisteredAwaiter;
+	friend class PostAwaiter;
+	public:
+		/**
+		 * @param loop event loop to run on
+		 * @param fd node end of a nonblocking radioPair
+		 * @param values list of attributes which can be read from this node
+		 * @param length length of attribute list
+		 * @param nodeID node id for emoncms, 0 to request one
+		 **/
+		AsyncNode(EventLoop *loop, int fd, AttributeValue values[], int16_t length, uint16_t nodeID = 0);
+		~AsyncNode();
+		/**
+		 * Requests a node ID, resending every REGISTERREQUESTTIMEOUT ms
+		 * until the gateway answers. co_await gives the node ID.
+		 **/
+		RegisteredAwaiter registered();
+		/**
+		 * Posts an attribute value. co_await gives true once the gateway
+		 * acknowledges it, false on timeout or if a post is already waiting.
+		 * @param ident attribute to post, must stay valid while waiting
+		 * @param timeout ms to wait for the acknowledgement
+		 **/
+		PostAwaiter post(AttributeIdentifier *ident, uint32_t timeout = ASYNC_POST_TIMEOUT);
+		/**
+		 * @return the EMonCMS node
+		 **/
+		EMonCMS *getNode();
+	protected:
+		EventLoop *loop; /** loop the node runs on **/
+		int fd; /** node end of the pseudo radio **/
+		EMonCMS node; /** protocol state **/
+		std::coroutine_handle<> registerWaiter; /** coroutine awaiting registered **/
+		uint32_t registerTimer; /** resend timer for the node ID request **/
+		std::coroutine_handle<> postWaiter; /** coroutine awaiting a post **/
+		AttributeIdentifier *postIdent; /** attribute of the waiting post **/
+		uint32_t postTimer; /** timeout of the waiting post **/
+		bool postAcked; /** result of the last post **/
+		DataItem items[ASYNC_MAX_ITEMS]; /** items of the frame being handled **/
+
+		/**
+		 * Sends a node ID request and schedules the next
+		 **/
+		void requestNodeID();
+		static void registerTimeout(void *context);
+		static void postTimeout(void *context);
+		static void readable(void *context, int fd);
+		static uint16_t sender(void *context, uint8_t type, uint8_t *buffer, uint16_t length);
+};
+
+/**
+ * A gateway link to one node
+ **/
+typedef struct {
+	AsyncGateway *gateway; /** owner of the link **/
+	int fd; /** gateway end of the pseudo radio **/
+	uint16_t nodeID; /** node on the link, 0 until registered **/
+	PollAwaiter *polls; /** polls waiting for answers **/
+	PollAwaiter *answered; /** polls answered by the frames being read, resumed once read **/
+} AsyncLink;
+
+/**
+ * Answer to a poll
+ **/
+typedef struct {
+	uint8_t status; /** SUCCESS, the node's failure status or FAILURE on timeout **/
+	uint8_t type; /** dataTypes of the value on SUCCESS **/
+	uint8_t value[8]; /** the value on SUCCESS **/
+} PollReply;
+
+/**
+ * Awaitable waiting for the answer to a poll, see AsyncGateway::poll
+ **/
+class PollAwaiter {
+	friend class AsyncGateway;
+	public:
+		PollAwaiter(AsyncGateway *gateway, uint16_t nodeID, AttributeIdentifier *ident, uint32_t timeout);
+		bool await_ready();
+		/**
+		 * Sends the request
+		 * @return false, without suspending, if the request failed to
+		 *  send or no timer was free to time it out
+		 **/
+		bool await_suspend(std::coroutine_handle<> handle);
+		PollReply await_resume();
+	protected:
+		AsyncGateway *gateway; /** gateway polling **/
+		AsyncLink *link; /** link to the node polled **/
+		uint16_t nodeID; /** node polled **/
+		AttributeIdentifier ident; /** attribute polled **/
+		uint32_t timeout; /** ms to wait for the answer **/
+		uint32_t timer; /** timeout timer **/
+		PollReply reply; /** the answer **/
+		std::coroutine_handle<> handle; /** coroutine waiting **/
+		PollAwaiter *next; /** next poll waiting on the same node **/
+};
+
+/**
+ * Called for every attribute value a node posts
+ * @param context the context given to the gateway
+ * @param nodeID node posting
+ * @param attr attribute posted
+ * @param value the posted value, pointing into the received frame
+ **/
+typedef void (*AsyncPostHandler)(void *context, uint16_t nodeID, AttributeIdentifier *attr, DataItem *value);
+
+
+/**
+ * Gateway end of many pseudo radios driven by an EventLoop. Node ID and
+ * attribute registrations are answered from a NodeTable, posts are
+ * acknowledged and handed to a handler, once each if they carry a
+ * sequence number, and polls can be awaited from a coroutine.
+ **/
+class AsyncGateway {
+	friend class PollAwaiter;
+	public:
+		/**
+		 * @param loop event loop to run on
+		 * @param maxLinks number of links that can be added
+		 * @param handler called for posted values, may be NULL
+		 * @param context passed to handler
+		 **/
+		AsyncGateway(EventLoop *loop, uint32_t maxLinks, AsyncPostHandler handler = NULL, void *context = NULL);
+		~AsyncGateway();
+		/**
+		 * Adds the gateway end of a nonblocking radioPair
+		 * @return false if there are already maxLinks
+		 **/
+		bool addLink(int fd);
+		/**
+		 * Requests an attribute from a node. co_await gives a PollReply.
+		 * @param nodeID node to poll
+		 * @param ident attribute to poll
+		 * @param timeout ms to wait for the answer
+		 **/
+		PollAwaiter poll(uint16_t nodeID, AttributeIdentifier *ident, uint32_t timeout = ASYNC_POLL_TIMEOUT);
+		/**
+		 * @return the table of registered nodes
+		 **/
+		NodeTable *getTable();
+		/**
+		 * @return the filter of repeated posts
+		 **/
+		DedupWindow *getDedup();
+		/**
+		 * @return number of posts handled, repeats not included
+		 **/
+		uint32_t getPosts();
+	protected:
+		EventLoop *loop; /** loop the gateway runs on **/
+		NodeTable *table; /** registered nodes and attributes **/
+		AsyncLink *links; /** one per pseudo radio **/
+		uint32_t linkCount; /** links added **/
+		uint32_t maxLinks; /** size of links **/
+		AsyncLink **nodeLinks; /** link of each node ID **/
+		AsyncPostHandler handler; /** called for posts **/
+		void *context; /** passed to handler **/
+		uint32_t posts; /** posts handled **/
+		DedupWindow dedup; /** drops repeated posts before they are handled **/
+		DataItem items[ASYNC_MAX_ITEMS]; /** items of the frame being handled **/
+
+		/**
+		 * Handles one frame from a node
+		 **/
+		void handleFrame(AsyncLink *link, uint8_t type, uint8_t *frame, uint16_t length);
+		/**
+		 * Sends the node ID, group, attribute and number of a frame back
+		 * to the node
+		 * @param link link the frame came in on
+		 * @param type type of the acknowledgement
+		 * @param frame the frame being acknowledged, its items parsed
+		 * @param status status to put in the header
+		 **/
+		void acknowledge(AsyncLink *link, uint8_t type, uint8_t *frame, uint8_t status);
+		/**
+		 * Completes the poll waiting for an answer, if any. It is resumed
+		 * by readable once the link is no longer used.
+		 **/
+		void answerPoll(AsyncLink *link, HeaderInfo *header);
+		static void readable(void *context, int fd);
+		static void pollTimeout(void *context);
+};
+
+#endif
+
+#endif
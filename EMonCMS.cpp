@@ -1,6 +1,24 @@
 #include "EMonCMS.h"
 #include "Debug.h"
 
+constexpr TypeDescriptor typeTable[TYPE_TABLE_SIZE] PROGMEM = {
+	{ 0, 0, 0 },
+	{ STRING, 0, TYPE_KNOWN | TYPE_VARIABLE },
+	{ CHAR, sizeof(int8_t), TYPE_KNOWN | TYPE_SIGNED },
+	{ UCHAR, sizeof(uint8_t), TYPE_KNOWN },
+	{ SHORT, sizeof(int16_t), TYPE_KNOWN | TYPE_SIGNED },
+	{ USHORT, sizeof(uint16_t), TYPE_KNOWN },
+	{ INT, sizeof(int32_t), TYPE_KNOWN | TYPE_SIGNED },
+	{ UINT, sizeof(uint32_t), TYPE_KNOWN },
+	{ LONG, sizeof(int64_t), TYPE_KNOWN | TYPE_SIGNED },
+	{ ULONG, sizeof(uint64_t), TYPE_KNOWN },
+	{ FLOAT, sizeof(float), TYPE_KNOWN | TYPE_SIGNED | TYPE_FLOATING },
+	{ 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }
+};
+
+static_assert(typeTable[ULONG].size == 8 && typeTable[FLOAT].size == 4 && typeTable[USHORT].size == 2, "wire sizes changed");
+static_assert(typeTable[0].code == 0 && typeTable[FLOAT + 1].code == 0, "unknown codes must be rejected");
+
 EMonCMS::EMonCMS(AttributeValue values[],
 			int16_t length, 
 			NetworkSender sender,
@@ -12,36 +30,21 @@ EMonCMS::EMonCMS(AttributeValue values[],
 	this->attrValues = values;
 	this->attrValuesLength = length;
 	this->networkSender = sender;
+	this->contextSender = NULL;
+	this->senderContext = NULL;
 	this->nodeID = nodeID;
 	this->attrRegistered = attrRegistered;
 	this->nodeRegistered = nodeRegistered;
 	this->lastRegisterRequest = 0;
-	#ifdef LINUX
-	this->start_time = time(0);
-	#endif
+	this->clock = EMonClock::platform();
+	this->sequencePosts = false;
+	this->postSequence = 0;
 }
 
 EMonCMS::~EMonCMS() {
 	/* do nothing */
 }
 
-uint16_t EMonCMS::getTypeSize(uint8_t type) {
-	switch(type) {
-		case CHAR: case UCHAR:
-			return sizeof(uint8_t);
-		case SHORT: case USHORT:
-			return sizeof(uint16_t);
-		case INT: case UINT:
-			return sizeof(uint32_t);
-		case FLOAT:
-			return sizeof(float);
-		case LONG: case ULONG:
-			return sizeof(uint64_t);
-		default:
-			return 0;
-	}
-}
-
 int16_t EMonCMS::compareAttribute(AttributeIdentifier *a, AttributeIdentifier *b) {
 	if(a == NULL || b == NULL) {
 		return 1;
@@ -52,7 +55,8 @@ int16_t EMonCMS::compareAttribute(AttributeIdentifier *a, AttributeIdentifier *b
 
 void EMonCMS::registerNode() {
 	/* Firstly check whether the previous request has timed out */
-	if((millis() - this->lastRegisterRequest) > REGISTERREQUESTTIMEOUT) {
+	uint32_t now = this->clock->millis();
+	if(clockElapsed(now, this->lastRegisterRequest) > REGISTERREQUESTTIMEOUT) {
 		LOG(F("registerNode: enter\r\n"));
 		/* See whether the node ID is the default value or has been registered.
 		 *  If it has not been registered, send node ID register request.
@@ -65,48 +69,52 @@ void EMonCMS::registerNode() {
 				LOG(F("Failed to send node ID request\r\n"));
 			}
 			LOG(F("registerNode: request sent\r\n"));
-			this->lastRegisterRequest = millis();
+			this->lastRegisterRequest = now;
 		} else {
-			/* For each attribute send a registration request */
-			for(uint16_t i = 0; i < attrValuesLength; i++) {
-				LOG(F("registerNode: attr: ")); LOG(i); LOG(F("\r\n"));
-
-				/* If the attribute isn't registered */
-				if(!this->attrValues[i].registered) {
-					DataItem regItems[4];
-
-					/* Convert it's identifier to data items */
-					this->attrIdentAsDataItems(&(this->attrValues[i].attr), regItems);
-
-					/* Read the value, this will be the default */
-					if(!this->attrValues[i].reader(&(this->attrValues[i].attr), &(regItems[3]))) {
-						LOG(F("registerNode: Failed to register attribute\r\n"));
-					} else {
-						LOG(F("registerNode: registering attribute ")); LOG(i); LOG(F("\r\n"));
-
-						/* If the value has been read and placed into data items,
-						 *  send register request.
-						 */
-						if(this->attrSender(ATTR_REGISTER, regItems, 4) > 0) {
-							LOG(F("registerNode: Sent attribute register request\r\n"));
-						} else {
-							LOG(F("registerNode: Error sending attribute registration request\r\n"));
-						}
-					}
-					
-					LOG(F("registerNode: attribute registered\r\n"));
-				}
-			}
+			this->registerAttributes();
 			
 			LOG(F("registerNode: setting last time\r\n"));
 			
-			this->lastRegisterRequest = millis();
+			this->lastRegisterRequest = now;
 		}
 		
 		LOG(F("registerNode: done\r\n"));
 	}	
 }
 
+void EMonCMS::registerAttributes() {
+	/* For each attribute send a registration request */
+	for(uint16_t i = 0; i < attrValuesLength; i++) {
+		LOG(F("registerNode: attr: ")); LOG(i); LOG(F("\r\n"));
+
+		/* If the attribute isn't registered */
+		if(!this->attrValues[i].registered) {
+			DataItem regItems[4];
+
+			/* Convert it's identifier to data items */
+			this->attrIdentAsDataItems(&(this->attrValues[i].attr), regItems);
+
+			/* Read the value, this will be the default */
+			if(!this->attrValues[i].reader(&(this->attrValues[i].attr), &(regItems[3]))) {
+				LOG(F("registerNode: Failed to register attribute\r\n"));
+			} else {
+				LOG(F("registerNode: registering attribute ")); LOG(i); LOG(F("\r\n"));
+
+				/* If the value has been read and placed into data items,
+				 *  send register request.
+				 */
+				if(this->attrSender(ATTR_REGISTER, regItems, 4) > 0) {
+					LOG(F("registerNode: Sent attribute register request\r\n"));
+				} else {
+					LOG(F("registerNode: Error sending attribute registration request\r\n"));
+				}
+			}
+			
+			LOG(F("registerNode: attribute registered\r\n"));
+		}
+	}
+}
+
 AttributeValue *EMonCMS::getAttribute(AttributeIdentifier *attr) {
 	/* Go through each registered attribute and compare to the given
 	 *  attribute identifier to get extra details such as reader.
@@ -135,7 +143,7 @@ bool EMonCMS::isEMonCMSPacket(uint8_t type) {
 	}
 }
 
-bool EMonCMS::requestAttribute(HeaderInfo *header, DataItem items[]) {
+bool EMonCMS::requestAttribute(DataItem items[]) {
 	/* extract the attribute identifying information */
 	AttributeIdentifier ident;
 	ident.groupID = *(uint16_t *)(items[1].item);
@@ -150,42 +158,46 @@ bool EMonCMS::requestAttribute(HeaderInfo *header, DataItem items[]) {
 	
 	if(attrVal == NULL) {
 		status = UNSUPPORTED_ATTRIBUTE;
-	} else if(!attrVal->reader(&ident, &item)) {
+	} else if(!attrVal->reader(&ident, &item) || !typeKnown(item.type)) {
 		status = INVALID_VALUE;
 	}
 
 	if(status != SUCCESS) {
-		int16_t size = attrSize(ATTR_FAILURE, &(items[1]), 3);
-		uint8_t failureBuffer[size];
+		uint16_t size = attrSize(ATTR_FAILURE, &(items[1]), 3);
+		uint8_t *failureBuffer = size <= EMONCMS_MTU ? this->framePool.acquire() : NULL;
 		
-		if(attrBuilder(ATTR_FAILURE, &(items[1]), 3, failureBuffer) != size) {
+		if(failureBuffer == NULL || attrBuilder(ATTR_FAILURE, &(items[1]), 3, failureBuffer) != size) {
 			LOG(F("Error: could not build response request failure"));
+			this->framePool.release(failureBuffer);
 			return false;
 		} else {
 			((HeaderInfo *)failureBuffer)->status = status;
 			
-			if(!this->networkSender('p', failureBuffer, size)) {
+			if(!this->send('p', failureBuffer, size)) {
 				LOG(F("Error sending error response to attribute request\r\n"));
 			}
+			this->framePool.release(failureBuffer);
 		}
 	} else {
 		DataItem responseItems[4];
 
 		/* Move the attribute identifier items to the response items */
-		memcpy(responseItems, items, sizeof(DataItem) * 3);
+		memcpy(responseItems, &(items[1]), sizeof(DataItem) * 3);
 		responseItems[3].type = item.type;
 		responseItems[3].item = item.item;
 		
 		uint16_t size = attrSize(ATTR_POST, responseItems, 4);
-		uint8_t responseBuffer[size];
+		uint8_t *responseBuffer = size <= EMONCMS_MTU ? this->framePool.acquire() : NULL;
 		
-		if(attrBuilder(ATTR_POST, responseItems, 4, responseBuffer) != size) {
+		if(responseBuffer == NULL || attrBuilder(ATTR_POST, responseItems, 4, responseBuffer) != size) {
 			LOG(F("Error: could not build response request failure"));
+			this->framePool.release(responseBuffer);
 			return false;
 		} else {
-			if(!this->networkSender('p', responseBuffer, size)) {
+			if(!this->send('p', responseBuffer, size)) {
 				LOG(F("Error sending success response to attribute request\r\n"));
 			}
+			this->framePool.release(responseBuffer);
 		}
 				
 	}
@@ -193,6 +205,165 @@ bool EMonCMS::requestAttribute(HeaderInfo *header, DataItem items[]) {
 	return true;
 }
 
+bool EMonCMS::sendMultiResponse(uint8_t *frame, uint16_t length) {
+	HeaderInfo *header = (HeaderInfo *)frame;
+	header->dataSize = length - sizeof(HeaderInfo);
+	header->status = SUCCESS;
+	if(!this->send(ATTR_MULTI_RESPONSE, frame, length)) {
+		LOG(F("Error sending multi attribute response\r\n"));
+		return false;
+	}
+	return true;
+}
+
+bool EMonCMS::appendAttributeEntry(uint8_t **frame, uint16_t *index, AttributeIdentifier *ident) {
+	uint8_t status = SUCCESS;
+	AttributeValue *attrVal = this->getAttribute(ident);
+	DataItem item;
+
+	if(attrVal == NULL) {
+		status = UNSUPPORTED_ATTRIBUTE;
+	} else if(!attrVal->reader(ident, &item) || !typeKnown(item.type)) {
+		status = INVALID_VALUE;
+	}
+
+	/* GID, AID, ATTRNUM, status and the value if there is one */
+	uint16_t size = 3 * (sizeof(uint16_t) + 1) + sizeof(status) + 1;
+	if(status == SUCCESS) {
+		size += sizeof(item.type) + typeSize(item.type);
+	}
+
+	HeaderInfo *header = (HeaderInfo *)*frame;
+	if(*index + size > EMONCMS_MTU && header->dataCount > 1) {
+		/* Send what there is and start again after the node ID, in a new
+		 *  frame as the sender may still be holding the sent one.
+		 */
+		if(!this->sendMultiResponse(*frame, *index)) {
+			return false;
+		}
+		uint8_t *next = this->framePool.acquire();
+		if(next == NULL) {
+			return false;
+		}
+		*index = sizeof(HeaderInfo) + sizeof(nodeID) + 1;
+		memcpy(next, *frame, *index);
+		this->framePool.release(*frame);
+		*frame = next;
+		header = (HeaderInfo *)next;
+		header->dataCount = 1;
+	}
+	if(*index + size > EMONCMS_MTU) {
+		LOG(F("Attribute does not fit in a multi response\r\n"));
+		return false;
+	}
+
+	DataItem entry[4];
+	this->attrIdentAsDataItems(ident, entry);
+	entry[3].type = UCHAR;
+	entry[3].item = &status;
+	for(uint8_t i = 0; i < 4; i++) {
+		*index += this->dataItemToBuffer(&(entry[i]), &((*frame)[*index]));
+	}
+	header->dataCount += 4;
+	if(status == SUCCESS) {
+		*index += this->dataItemToBuffer(&item, &((*frame)[*index]));
+		header->dataCount++;
+	}
+	return true;
+}
+
+bool EMonCMS::requestAttributes(HeaderInfo *header, DataItem items[]) {
+	bool valid = header->dataCount >= 4 && (header->dataCount - 1) % 3 == 0;
+	for(uint16_t i = 1; valid && i < header->dataCount; i++) {
+		valid = items[i].type == USHORT;
+	}
+	if(!valid) {
+		/* Nothing in the request can be echoed, answer with a bare failure */
+		LOG(F("Malformed multi attribute request\r\n"));
+		uint8_t *failure = this->framePool.acquire();
+		if(failure != NULL) {
+			HeaderInfo *failureHeader = (HeaderInfo *)failure;
+			failureHeader->dataSize = 0;
+			failureHeader->status = FAILURE;
+			failureHeader->dataCount = 0;
+			this->send(ATTR_POST_RESPONSE, failure, sizeof(HeaderInfo));
+			this->framePool.release(failure);
+		}
+		return false;
+	}
+	if(this->nodeID == 0) {
+		LOG(F("Cannot answer attribute request, no node iD\r\n"));
+		return false;
+	}
+
+	uint8_t *frame = this->framePool.acquire();
+	if(frame == NULL) {
+		return false;
+	}
+	DataItem nid;
+	nid.type = USHORT;
+	nid.item = &(this->nodeID);
+	uint16_t index = sizeof(HeaderInfo);
+	index += this->dataItemToBuffer(&nid, &(frame[index]));
+	((HeaderInfo *)frame)->dataCount = 1;
+
+	for(uint16_t i = 1; i < header->dataCount; i += 3) {
+		AttributeIdentifier ident;
+		ident.groupID = *(uint16_t *)(items[i].item);
+		ident.attributeID = *(uint16_t *)(items[i + 1].item);
+		ident.attributeNumber = *(uint16_t *)(items[i + 2].item);
+
+		if(ident.attributeID != ATTR_WILDCARD) {
+			if(!this->appendAttributeEntry(&frame, &index, &ident)) {
+				this->framePool.release(frame);
+				return false;
+			}
+			continue;
+		}
+
+		/* Answer for every attribute in the group */
+		bool found = false;
+		for(uint16_t j = 0; j < this->attrValuesLength; j++) {
+			if(this->attrValues[j].attr.groupID == ident.groupID) {
+				found = true;
+				if(!this->appendAttributeEntry(&frame, &index, &(this->attrValues[j].attr))) {
+					this->framePool.release(frame);
+					return false;
+				}
+			}
+		}
+		if(!found && !this->appendAttributeEntry(&frame, &index, &ident)) {
+			this->framePool.release(frame);
+			return false;
+		}
+	}
+
+	bool sent = this->sendMultiResponse(frame, index);
+	this->framePool.release(frame);
+	return sent;
+}
+
+bool EMonCMS::parseDataItems(HeaderInfo *header, uint8_t *buffer, DataItem items[], uint16_t length) {
+	uint16_t index = 0;
+	/* For each of the data items in the buffer set them up
+	 *  in data items.
+	 */
+	for(uint16_t i = 0; i < header->dataCount; i++) {
+		if(index >= length) {
+			return false;
+		}
+		TypeDescriptor descriptor = typeDescriptor(buffer[index]);
+		if(!(descriptor.flags & TYPE_KNOWN)) {
+			return false;
+		}
+		items[i].type = buffer[index];
+		index++;
+		items[i].item = &(buffer[index]);
+		index += descriptor.size;
+	}
+	return index <= length;
+}
+
 bool EMonCMS::parseEMonCMSPacket(HeaderInfo *header, uint8_t type, uint8_t *buffer, DataItem items[]) {
 	LOG(F("parseEmonCMSPacket: enter\r\n"));
 
@@ -201,17 +372,9 @@ bool EMonCMS::parseEMonCMSPacket(HeaderInfo *header, uint8_t type, uint8_t *buff
 		return false;
 	}
 
-	if(header->dataCount > 0) {
-		int16_t index = 0;
-		/* For each of the data items in the buffer set them up
-		 *  in data items.
-		 */
-		for(uint16_t i = 0; i < header->dataCount; i++) {
-			items[i].type = buffer[index];
-			index++;
-			items[i].item = &(buffer[index]);
-			index += getTypeSize(items[i].type);
-		}
+	if(!this->parseDataItems(header, buffer, items, header->dataSize)) {
+		LOG(F("parseEmonCMSPacket: malformed data items\r\n"));
+		return false;
 	}
 
 	if(header->status != SUCCESS) {
@@ -220,6 +383,10 @@ bool EMonCMS::parseEMonCMSPacket(HeaderInfo *header, uint8_t type, uint8_t *buff
 
 	switch(type) {
 		case 'r':
+			if(header->dataCount < 1 || items[0].type != USHORT || *(uint16_t *)(items[0].item) == 0) {
+				LOG(F("Malformed node ID response\r\n"));
+				return false;
+			}
 			this->nodeID = *(uint16_t *)(items[0].item);
 			LOG(F("emonCMSNodeID = ")); LOG(this->nodeID); LOG(F("\r\n"));
 			if(this->nodeRegistered != NULL) {
@@ -227,12 +394,26 @@ bool EMonCMS::parseEMonCMSPacket(HeaderInfo *header, uint8_t type, uint8_t *buff
 			}
 			break;
 		case 'P':
-			if(!requestAttribute(header, items)) {
-				LOG(F("Error responding to attribute request\r\n"));
+			/* A single attribute is answered as before, lists and
+			 *  wildcards with packed multi responses. Identifiers that
+			 *  aren't USHORTs are refused by requestAttributes.
+			 */
+			if(header->dataCount == 4 && items[1].type == USHORT && items[2].type == USHORT
+				&& items[3].type == USHORT && *(uint16_t *)(items[2].item) != ATTR_WILDCARD) {
+				if(!requestAttribute(items)) {
+					LOG(F("Error responding to attribute request\r\n"));
+					return false;
+				}
+			} else if(!requestAttributes(header, items)) {
+				LOG(F("Error responding to multi attribute request\r\n"));
 				return false;
 			}
 			break;
 		case 'a':
+			if(header->dataCount < 4 || items[1].type != USHORT || items[2].type != USHORT || items[3].type != USHORT) {
+				LOG(F("Malformed attribute registration response\r\n"));
+				return false;
+			}
 			AttributeIdentifier ident;
 			ident.groupID = *(uint16_t *)(items[1].item);
 			ident.attributeID = *(uint16_t *)(items[2].item);
@@ -272,7 +453,11 @@ uint16_t EMonCMS::attrSize(RequestType type, DataItem *item, uint16_t length) {
 	uint16_t size = sizeof(HeaderInfo);
 	/* On top of that is the size of each items data and it's type identifier */
 	for(uint16_t i = 0; i < length; i++) {
-		size += this->getTypeSize(item[i].type) + 1; /* Actual data size plus type */
+		if(!typeKnown(item[i].type)) {
+			LOG(F("Requested size of unknown type\r\n"));
+			return 0;
+		}
+		size += typeSize(item[i].type) + 1; /* Actual data size plus type */
 	}
 	switch(type) {
 		case ATTR_REGISTER:
@@ -293,12 +478,12 @@ uint16_t EMonCMS::attrSize(RequestType type, DataItem *item, uint16_t length) {
 }
 
 uint16_t EMonCMS::dataItemToBuffer(DataItem *item, uint8_t *buffer) {
+	uint8_t size = typeSize(item->type);
 	buffer[0] = item->type;
-	uint8_t *k = (uint8_t *)(item->item);
-	for(int i = 0; i < this->getTypeSize(item->type); i++) {
-		buffer[1 + i] = k[i];
+	if(size > 0) {
+		memcpy(&(buffer[1]), item->item, size);
 	}
-	return sizeof(item->type) + this->getTypeSize(item->type);
+	return sizeof(item->type) + size;
 }
 
 void EMonCMS::attrIdentAsDataItems(AttributeIdentifier *ident, DataItem *attrItems) {
@@ -318,13 +503,23 @@ uint16_t EMonCMS::attrSender(RequestType type, DataItem *items, uint16_t length)
 			LOG(F("attrSender: attrSize 0\r\n"));
 			return size;
 		}
-		uint8_t buffer[size];
+		if(size > EMONCMS_MTU) {
+			LOG(F("attrSender: packet larger than MTU\r\n"));
+			return 0;
+		}
+		uint8_t *buffer = this->framePool.acquire();
+		if(buffer == NULL) {
+			return 0;
+		}
 		if(this->attrBuilder(type, items, length, buffer) != size) {
 			LOG(F("attrSender: attrBuilder size mismatch\r\n"));
+			this->framePool.release(buffer);
 			return 0;
 		}
 		LOG(F("attrSender: exit\r\n"));
-		return this->networkSender(type, buffer, size);
+		uint16_t sent = this->send(type, buffer, size);
+		this->framePool.release(buffer);
+		return sent;
 }
 
 uint16_t EMonCMS::postAttribute(AttributeIdentifier *ident) {
@@ -342,22 +537,25 @@ uint16_t EMonCMS::postAttribute(AttributeIdentifier *ident) {
 		return 0;
 	}
 	
-	DataItem postItems[4];
+	DataItem postItems[5];
 	attrIdentAsDataItems(ident, postItems);
 	
 	postItems[3].type = item.type;
 	postItems[3].item = item.item;
-	return this->attrSender(ATTR_POST, postItems, 4);
+	if(!this->sequencePosts) {
+		return this->attrSender(ATTR_POST, postItems, 4);
+	}
+	/* The gateway drops repeats of a sequence number it has seen */
+	this->postSequence++;
+	postItems[4].type = UINT;
+	postItems[4].item = &(this->postSequence);
+	return this->attrSender(ATTR_POST, postItems, 5);
 }
 
 uint16_t EMonCMS::attrBuilder(RequestType type, DataItem *items, uint16_t length, uint8_t *buffer) {
 	LOG(F("attrBuilder: enter\r\n"));
 	/* Setup the header and input neccessary data */
 	HeaderInfo *header = (HeaderInfo *)buffer;
-	header->dataSize = 0;
-	for(uint16_t i = 0; i < length; i++) {
-		header->dataSize += sizeof(items[i].type) + this->getTypeSize(items[i].type);
-	}
 	
 	DataItem nid;
 
@@ -365,7 +563,7 @@ uint16_t EMonCMS::attrBuilder(RequestType type, DataItem *items, uint16_t length
 	switch(type) {
 		case ATTR_REGISTER:
 		case ATTR_POST:
-			if(length != 4) {
+			if(length != 4 && (type != ATTR_POST || length != 5)) {
 				LOG(F("Wrong number of items passed to builder for post/register\r\n"));
 				return 0;
 			}
@@ -373,8 +571,7 @@ uint16_t EMonCMS::attrBuilder(RequestType type, DataItem *items, uint16_t length
 				LOG(F("Cannot register/post attribute, no node iD\r\n"));
 				return 0;
 			}
-			header->dataCount = 5; /* NID, GID, AID, ATTRNUM, ATTRVAL/ATTRDEFAULT */
-			header->dataSize += (sizeof(nodeID) + 1);
+			header->dataCount = length + 1; /* NID, GID, AID, ATTRNUM, ATTRVAL/ATTRDEFAULT, optional SEQ */
 			header->status = SUCCESS;
 			/* Add Node ID to packet */
 			nid.type = USHORT;
@@ -391,7 +588,6 @@ uint16_t EMonCMS::attrBuilder(RequestType type, DataItem *items, uint16_t length
 				return 0;
 			}
 			header->dataCount = 4; /* NID, GID, AID, ATTRNUM */
-			header->dataSize += (sizeof(nodeID) + 1);
 			header->status = FAILURE; /* set custom error code later */
 			/* Add Node ID to packet */
 			nid.type = USHORT;
@@ -399,24 +595,63 @@ uint16_t EMonCMS::attrBuilder(RequestType type, DataItem *items, uint16_t length
 			itemIndex += dataItemToBuffer(&nid, &(buffer[itemIndex]));
 			break;
 		case NODE_REGISTER:
+			if(length != 0) {
+				LOG(F("Node register takes no items\r\n"));
+				return 0;
+			}
 			header->status = SUCCESS;
 			header->dataCount = 0;
-			header->dataSize = 0;
 			break;
 		default:
 			LOG(F("Requested build of unknown\r\n"));
 			return 0;
 	}
 
+	/* The size falls out of writing the items, each one a table lookup */
 	for(uint16_t i = 0; i < length; i++) {
+		if(!typeKnown(items[i].type)) {
+			LOG(F("Requested build of unknown type\r\n"));
+			return 0;
+		}
 		itemIndex += dataItemToBuffer(&(items[i]), &(buffer[itemIndex]));
 	}
+	header->dataSize = itemIndex - sizeof(HeaderInfo);
 	LOG(F("attrBuilder: exit\r\n"));
 	return itemIndex;
 }
 
-#ifdef LINUX
-unsigned long EMonCMS::millis() {
-	return (unsigned long)difftime(time(0), start_time);
+void EMonCMS::setClock(EMonClock *clock) {
+	this->clock = clock;
+}
+
+EMonClock *EMonCMS::getClock() {
+	return this->clock;
+}
+
+FramePool *EMonCMS::getFramePool() {
+	return &(this->framePool);
+}
+
+void EMonCMS::setPostSequence(bool enabled) {
+	this->sequencePosts = enabled;
+}
+
+uint32_t EMonCMS::getPostSequence() {
+	return this->postSequence;
+}
+
+void EMonCMS::setSender(ContextSender sender, void *context) {
+	this->contextSender = sender;
+	this->senderContext = context;
+}
+
+uint16_t EMonCMS::send(uint8_t type, uint8_t *buffer, uint16_t length) {
+	if(this->contextSender != NULL) {
+		return this->contextSender(this->senderContext, type, buffer, length);
+	}
+	if(this->networkSender == NULL) {
+		LOG(F("No sender set\r\n"));
+		return 0;
+	}
+	return this->networkSender(type, buffer, length);
 }
-#endif
@@ -2,15 +2,20 @@
 #define __EMONCMS_H__
 
 #ifdef LINUX
-#include <time.h>
 #include <cstring>
 #include <stdint.h>
 #else
 #include "Arduino.h"
 #endif
 
+#include "EMonClock.h"
+#include "FramePool.h"
+
 #define REGISTERREQUESTTIMEOUT 5000
 
+/** attribute ID in a 'P' request matching every attribute of the group **/
+#define ATTR_WILDCARD 0xFFFF
+
 /**
  * The is an enum to specify data formats to send over the
  * low power radio
@@ -28,6 +33,79 @@ enum dataTypes {
 	FLOAT = 10
 };
 
+/**
+ * Flags in a TypeDescriptor
+ **/
+enum TypeFlags {
+	TYPE_KNOWN = 0x01, /** a valid type code **/
+	TYPE_SIGNED = 0x02, /** signed integer or float **/
+	TYPE_FLOATING = 0x04, /** IEEE 754 float **/
+	TYPE_VARIABLE = 0x08 /** no fixed wire size, not carried yet **/
+};
+
+/**
+ * Wire layout of one of the dataTypes
+ **/
+typedef struct {
+	uint8_t code; /** the dataTypes value, so a masked lookup can check it **/
+	uint8_t size; /** bytes on the wire after the type byte **/
+	uint8_t flags; /** TypeFlags **/
+} TypeDescriptor;
+
+#define TYPE_TABLE_SIZE 16 /** power of 2 above the largest dataTypes value **/
+
+#ifdef LINUX
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#endif
+
+/**
+ * Descriptors indexed by type code, defined once in EMonCMS.cpp and kept
+ * in flash on the Arduino. Unused entries have code 0, which no lookup
+ * can match, so unknown codes are rejected by the same lookup that finds
+ * the size.
+ **/
+extern const TypeDescriptor typeTable[TYPE_TABLE_SIZE] PROGMEM;
+
+/**
+ * @param type a type code from the wire
+ * @return its descriptor, one with no flags for unknown codes
+ **/
+inline TypeDescriptor typeDescriptor(uint8_t type) {
+	const TypeDescriptor *entry = &(typeTable[type & (TYPE_TABLE_SIZE - 1)]);
+	TypeDescriptor descriptor;
+#ifdef LINUX
+	descriptor = *entry;
+#else
+	descriptor.code = pgm_read_byte(&(entry->code));
+	descriptor.size = pgm_read_byte(&(entry->size));
+	descriptor.flags = pgm_read_byte(&(entry->flags));
+#endif
+	if(descriptor.code != type) {
+		descriptor.code = 0;
+		descriptor.size = 0;
+		descriptor.flags = 0;
+	}
+	return descriptor;
+}
+
+/**
+ * @param type a type code from the wire
+ * @return bytes of the value after the type byte, 0 for unknown codes
+ **/
+inline uint8_t typeSize(uint8_t type) {
+	return typeDescriptor(type).size;
+}
+
+/**
+ * @param type a type code from the wire
+ * @return true if it is one of the dataTypes
+ **/
+inline bool typeKnown(uint8_t type) {
+	return (typeDescriptor(type).flags & TYPE_KNOWN) != 0;
+}
+
 /**
  * Status codes from the OEMan Communications specification
  **/
@@ -46,7 +124,8 @@ enum RequestType {
 	ATTR_REGISTER = 'A',
 	ATTR_POST = 'P',
 	ATTR_POST_RESPONSE = 'p',
-	ATTR_FAILURE
+	ATTR_FAILURE,
+	ATTR_MULTI_RESPONSE = 'm'
 };
 
 /**
@@ -84,6 +163,16 @@ typedef struct {
  **/
 typedef uint16_t (*NetworkSender)(uint8_t type, uint8_t *buffer, uint16_t length);
 
+/**
+ * NetworkSender taking a context, for senders serving several nodes
+ * @param context the context given with the sender
+ * @param type Packet type
+ * @param buffer data to send
+ * @param length length of buffer
+ * @return the length of the buffer on success
+ **/
+typedef uint16_t (*ContextSender)(void *context, uint8_t type, uint8_t *buffer, uint16_t length);
+
 /**
  * Function implemented by host program to retrieve the value of a piece of data.
  * It is expected that the pointer to the data set in the dataitem is a global
@@ -125,9 +214,9 @@ class EMonCMS {
 		 * @param node registered callback
 		 * @param nodeID defaults to 0, node id for emoncms
 		 **/
-		EMonCMS(AttributeValue values[],
-			int16_t length, 
-			NetworkSender sender,
+		EMonCMS(AttributeValue values[] = NULL,
+			int16_t length = 0,
+			NetworkSender sender = NULL,
 			AttributeRegistered attrRegistered = NULL,
 			NodeIDRegistered nodeRegistered = NULL,
 			uint16_t nodeID = 0
@@ -143,18 +232,29 @@ class EMonCMS {
 		 * Parses an incoming emon cms packet 
 		 * @param header incomiing emon cms header
 		 * @param type the type of the incoming packet
-		 * @param buffer the raw unparsed data items
+		 * @param buffer the raw unparsed data items, dataSize bytes from the header
 		 * @param items a list of data items the size of count in the header
 		 * @return returns true if the function succeeded
 		 **/
 		bool parseEMonCMSPacket(HeaderInfo *header, uint8_t type, uint8_t *buffer, DataItem items[]);
+		/**
+		 * Points the data items at the raw data items section of a packet
+		 * without acting on it, e.g. for a gateway ingesting posts.
+		 * @param header header of the packet
+		 * @param buffer the raw unparsed data items
+		 * @param items a list of data items the size of count in the header
+		 * @param length bytes available in buffer
+		 * @return false if the items run past the end of the buffer or
+		 *  have an unknown type
+		 **/
+		static bool parseDataItems(HeaderInfo *header, uint8_t *buffer, DataItem items[], uint16_t length = 0xFFFF);
 		/* methods for sending packets */
 		/**
 		 * Calculates the buffer size for the buffer passed to attrBuilder
 		 * @param type type of request to be sent
 		 * @param item list of data items
 		 * @param length length of list of data items
-		 * @return the size of the buffer
+		 * @return the size of the buffer, 0 if an item has an unknown type
 		 **/
 		uint16_t attrSize(RequestType type, DataItem *item, uint16_t length);
 		/**
@@ -162,17 +262,20 @@ class EMonCMS {
 		 * Items for each request type:
 		 * 	NODE_REGISTER: None
 		 * 	ATTR_REGISTER: Group ID, Attribute ID, Attribute Number, Attribure default
-		 * 	ATTR_POST: Group ID, Attribute ID, Attribute Number, Attribute Value
+		 * 	ATTR_POST: Group ID, Attribute ID, Attribute Number, Attribute Value,
+		 * 		optionally a sequence number (UINT)
 		 * 	ATTR_FAILURE: Group ID, Attribute ID, Attribute Number
 		 * @param type the type of the request to send
 		 * @param items list of data items to send
 		 * @param length length of list of data items to send
 		 * @param buffer buffer to write packet into, including header
-		 * @return the size of the buffer on success
+		 * @return the size of the buffer on success, 0 if an item has an
+		 *  unknown type
 		 **/
 		uint16_t attrBuilder(RequestType type, DataItem *items, uint16_t length, uint8_t *buffer);
 		/**
-		 * Wraps attrBuilder and sends requests through the NetworkSender
+		 * Wraps attrBuilder and sends requests through the NetworkSender,
+		 * building the packet in a frame from the pool
 		 * @param type type of request to send
 		 * @param items list of items to attach
 		 * @param length length of list of items to attach
@@ -204,6 +307,12 @@ class EMonCMS {
 		 * the node ID is too
 		 **/
 		void registerNode();
+		/**
+		 * Sends a registration request for every attribute not yet
+		 * registered, without waiting for the request timeout. Needs
+		 * the node ID.
+		 **/
+		void registerAttributes();
 		/**
 		 * Compares 2 attribute identifiers
 		 * @param a first attribute to compare
@@ -217,21 +326,55 @@ class EMonCMS {
 		 * @return the size of data sent on success
 		 */
 		uint16_t postAttribute(AttributeIdentifier *ident);
+		/**
+		 * Replaces the clock used for registration timing, e.g. with a
+		 * SimulatedClock in tests. Defaults to EMonClock::platform().
+		 * @param clock the clock to use, must outlive this object
+		 **/
+		void setClock(EMonClock *clock);
+		/**
+		 * @return the clock used for timing
+		 **/
+		EMonClock *getClock();
+		/**
+		 * Frames used to build outgoing packets. A caller can take a frame
+		 * to build into with attrBuilder and hold it, e.g. while queued,
+		 * releasing it once sent.
+		 * @return the frame pool
+		 **/
+		FramePool *getFramePool();
+		/**
+		 * Replaces the NetworkSender with one taking a context
+		 * @param sender function to send data to the radios
+		 * @param context passed to the sender
+		 **/
+		void setSender(ContextSender sender, void *context);
+		/**
+		 * Adds a sequence number to every post from postAttribute, so a
+		 * gateway can drop retransmitted or doubly received posts with a
+		 * DedupWindow. Off by default, keeping posts in their 5 item form.
+		 * @param enabled whether to number posts
+		 **/
+		void setPostSequence(bool enabled);
+		/**
+		 * @return sequence number of the last numbered post, 0 before any
+		 **/
+		uint32_t getPostSequence();
 	protected:
 		uint16_t nodeID; /** the EMonCMS node ID **/
 		AttributeValue *attrValues; /** list of registered attributes on this node **/
 		uint16_t attrValuesLength; /** length of list of registered attributes on this node **/
 		uint32_t lastRegisterRequest; /** time of last sent register request **/
+		EMonClock *clock; /** source of time **/
+		FramePool framePool; /** buffers for building packets **/
 		NetworkSender networkSender; /** function to send data to the radios **/
+		ContextSender contextSender; /** used instead of networkSender if set **/
+		void *senderContext; /** passed to contextSender **/
 		AttributeRegistered attrRegistered; /** attribute registered callback **/
 		NodeIDRegistered nodeRegistered; /** node registered callback **/
+		bool sequencePosts; /** whether posts carry a sequence number **/
+		uint32_t postSequence; /** sequence number of the last post **/
 
-		/**
-		 * Gets the size of the item in a DataItem
-		 * @param type the type of item
-		 * @return the size of the given type
-		 **/
-		uint16_t getTypeSize(uint8_t type);
 		/**
 		 * Transfers a data item into a char array
 		 * @param item item to put in char array
@@ -239,19 +382,50 @@ class EMonCMS {
 		 * @return size of transferred item on success
 		 **/
 		uint16_t dataItemToBuffer(DataItem *item, uint8_t *buffer);
+		/**
+		 * Sends a packet through whichever sender is set
+		 * @return the length sent on success
+		 **/
+		uint16_t send(uint8_t type, uint8_t *buffer, uint16_t length);
 		/**
 		 * Function to respond to a request for an attribute.
 		 * Sends through the NetworkSender specified in constructor.
-		 * @param header header of incoming request
 		 * @param items item list containing attribute identifier
 		 * @return true if building and sending succeeded
 		 **/
-		bool requestAttribute(HeaderInfo *header, DataItem items[]);
-		
-		#ifdef LINUX
-		time_t start_time;
-		unsigned long millis();
-		#endif
+		bool requestAttribute(DataItem items[]);
+		/**
+		 * Function to respond to a request for several attributes, or a
+		 * whole group when the attribute ID is ATTR_WILDCARD. The request
+		 * items are the node ID followed by a GID, AID, ATTRNUM triple per
+		 * attribute. Answers are packed into as few ATTR_MULTI_RESPONSE
+		 * packets as EMONCMS_MTU allows, each holding the node ID followed
+		 * by GID, AID, ATTRNUM, status (UCHAR) and, on SUCCESS, the value
+		 * for every attribute. A request that isn't a node ID followed by
+		 * USHORT triples is answered with a bare FAILURE header.
+		 * @param header header of incoming request
+		 * @param items item list containing the attribute identifiers
+		 * @return true if building and sending succeeded
+		 **/
+		bool requestAttributes(HeaderInfo *header, DataItem items[]);
+		/**
+		 * Reads an attribute and appends its entry to a multi response,
+		 * sending the packet first if the entry doesn't fit. The rest is
+		 * built in a new frame from the pool, so the sent one is never
+		 * overwritten while the sender holds it.
+		 * @param frame the multi response packet being built, replaced when sent
+		 * @param index bytes used in frame, updated
+		 * @param ident attribute to answer for
+		 * @return false if the entry could not be sent
+		 **/
+		bool appendAttributeEntry(uint8_t **frame, uint16_t *index, AttributeIdentifier *ident);
+		/**
+		 * Finishes the header of a multi response and sends it
+		 * @param frame the multi response packet
+		 * @param length length of frame
+		 * @return true if it was sent
+		 **/
+		bool sendMultiResponse(uint8_t *frame, uint16_t length);
 };
 
 #endif
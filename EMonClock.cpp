@@ -0,0 +1,69 @@
+#include "EMonClock.h"
+
+#ifdef LINUX
+MonotonicClock::MonotonicClock() {
+	clock_gettime(CLOCK_MONOTONIC, &(this->start));
+}
+
+uint32_t MonotonicClock::millis() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t ms = (int64_t)(now.tv_sec - this->start.tv_sec) * 1000
+		+ (now.tv_nsec - this->start.tv_nsec) / 1000000;
+	return (uint32_t)ms;
+}
+
+uint32_t MonotonicClock::micros() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t us = (int64_t)(now.tv_sec - this->start.tv_sec) * 1000000
+		+ (now.tv_nsec - this->start.tv_nsec) / 1000;
+	return (uint32_t)us;
+}
+
+EMonClock *EMonClock::platform() {
+	static MonotonicClock clock;
+	return &clock;
+}
+#else
+uint32_t ArduinoClock::millis() {
+	return ::millis();
+}
+
+uint32_t ArduinoClock::micros() {
+	return ::micros();
+}
+
+EMonClock *EMonClock::platform() {
+	static ArduinoClock clock;
+	return &clock;
+}
+#endif
+
+SimulatedClock::SimulatedClock(uint32_t start) {
+	this->ms = start;
+	this->us = 0;
+}
+
+uint32_t SimulatedClock::millis() {
+	return this->ms;
+}
+
+uint32_t SimulatedClock::micros() {
+	return this->ms * 1000 + this->us;
+}
+
+void SimulatedClock::set(uint32_t ms) {
+	this->ms = ms;
+	this->us = 0;
+}
+
+void SimulatedClock::advanceMicros(uint32_t us) {
+	this->us += us;
+	this->ms += this->us / 1000;
+	this->us %= 1000;
+}
+
+void SimulatedClock::advance(uint32_t ms) {
+	this->ms += ms;
+}
@@ -0,0 +1,109 @@
+#ifndef __EMONCLOCK_H__
+#define __EMONCLOCK_H__
+
+#ifdef LINUX
+#include <stdint.h>
+#include <time.h>
+#else
+#include "Arduino.h"
+#endif
+
+/**
+ * Source of time for EMonCMS and the gateway components. Times are
+ * free running 32 bit counters, so compare them with clockElapsed or
+ * clockReached rather than directly to get correct results across
+ * wraparound (about 49 days for millis, 71 minutes for micros).
+ **/
+class EMonClock {
+	public:
+		virtual ~EMonClock() {}
+		/**
+		 * @return milliseconds since an arbitrary start
+		 **/
+		virtual uint32_t millis() = 0;
+		/**
+		 * @return microseconds since an arbitrary start
+		 **/
+		virtual uint32_t micros() = 0;
+		/**
+		 * @return the default clock for the platform
+		 **/
+		static EMonClock *platform();
+};
+
+/**
+ * Time between two readings of the same clock, correct across wraparound
+ * @param now the later reading
+ * @param since the earlier reading
+ * @return now - since
+ **/
+inline uint32_t clockElapsed(uint32_t now, uint32_t since) {
+	return now - since;
+}
+
+/**
+ * Whether a deadline has passed, correct while the deadline is
+ * less than half the counter range away
+ * @param now current reading
+ * @param deadline reading to compare with
+ * @return true if now is at or after deadline
+ **/
+inline bool clockReached(uint32_t now, uint32_t deadline) {
+	return (int32_t)(now - deadline) >= 0;
+}
+
+#ifdef LINUX
+/**
+ * CLOCK_MONOTONIC, counted from when the clock was created
+ **/
+class MonotonicClock : public EMonClock {
+	public:
+		MonotonicClock();
+		uint32_t millis();
+		uint32_t micros();
+	protected:
+		struct timespec start; /** time the clock was created **/
+};
+#else
+/**
+ * The Arduino millis() and micros() counters
+ **/
+class ArduinoClock : public EMonClock {
+	public:
+		uint32_t millis();
+		uint32_t micros();
+};
+#endif
+
+/**
+ * Clock that only moves when told to, for tests and simulations
+ **/
+class SimulatedClock : public EMonClock {
+	public:
+		/**
+		 * @param start initial time in ms
+		 **/
+		SimulatedClock(uint32_t start = 0);
+		uint32_t millis();
+		uint32_t micros();
+		/**
+		 * Sets the time
+		 * @param ms new time in ms
+		 **/
+		void set(uint32_t ms);
+		/**
+		 * Moves the time on
+		 * @param us microseconds to advance by
+		 **/
+		void advanceMicros(uint32_t us);
+		/**
+		 * Moves the time on
+		 * @param ms milliseconds to advance by
+		 **/
+		void advance(uint32_t ms);
+	protected:
+		uint32_t ms; /** current time in ms **/
+		uint32_t us; /** microseconds into the current ms **/
+};
+
+#endif
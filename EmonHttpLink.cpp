@@ -0,0 +1,217 @@
+#ifdef LINUX
+
+#include "EmonHttpLink.h"
+#include "Debug.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+EmonHttpLink::EmonHttpLink(const char *address, uint16_t port, const char *path) {
+	strncpy(this->address, address, sizeof(this->address) - 1);
+	this->address[sizeof(this->address) - 1] = '\0';
+	strncpy(this->path, path, HTTPLINK_PATH_LENGTH - 1);
+	this->path[HTTPLINK_PATH_LENGTH - 1] = '\0';
+	this->port = port;
+	this->fd = -1;
+	this->responseLength = 0;
+	this->requests = 0;
+}
+
+EmonHttpLink::~EmonHttpLink() {
+	this->disconnect();
+}
+
+uint8_t EmonHttpLink::sender(void *context, const char *payloads[], uint16_t lengths[], uint8_t count) {
+	return ((EmonHttpLink *)context)->send(payloads, lengths, count);
+}
+
+bool EmonHttpLink::connectServer() {
+	if(this->fd >= 0) {
+		return true;
+	}
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(this->port);
+	if(inet_pton(AF_INET, this->address, &(addr.sin_addr)) != 1) {
+		LOG(F("EmonHttpLink: bad address\r\n"));
+		return false;
+	}
+
+	this->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(this->fd < 0) {
+		return false;
+	}
+
+	/* Connect without blocking so a silent server can't hold the caller past the deadline */
+	int flags = fcntl(this->fd, F_GETFL, 0);
+	fcntl(this->fd, F_SETFL, flags | O_NONBLOCK);
+	bool connected = connect(this->fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+	if(!connected && errno == EINPROGRESS) {
+		struct pollfd waiting;
+		waiting.fd = this->fd;
+		waiting.events = POLLOUT;
+		waiting.revents = 0;
+		int error = 0;
+		socklen_t errorLength = sizeof(error);
+		connected = poll(&waiting, 1, HTTPLINK_TIMEOUT_MS) == 1
+			&& getsockopt(this->fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) == 0 && error == 0;
+	}
+	if(!connected) {
+		LOG(F("EmonHttpLink: could not connect\r\n"));
+		this->disconnect();
+		return false;
+	}
+	fcntl(this->fd, F_SETFL, flags);
+
+	/* Reads and writes time out, which the callers see as a failed transfer */
+	struct timeval timeout;
+	timeout.tv_sec = HTTPLINK_TIMEOUT_MS / 1000;
+	timeout.tv_usec = (HTTPLINK_TIMEOUT_MS % 1000) * 1000;
+	setsockopt(this->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(this->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	int one = 1;
+	setsockopt(this->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return true;
+}
+
+void EmonHttpLink::disconnect() {
+	if(this->fd >= 0) {
+		close(this->fd);
+		this->fd = -1;
+	}
+	this->responseLength = 0;
+}
+
+bool EmonHttpLink::writeAll(const char *data, uint16_t length) {
+	while(length > 0) {
+		ssize_t written = ::send(this->fd, data, length, MSG_NOSIGNAL);
+		if(written <= 0) {
+			return false;
+		}
+		data += written;
+		length -= written;
+	}
+	return true;
+}
+
+bool EmonHttpLink::readResponse(bool *accepted) {
+	*accepted = false;
+	for(;;) {
+		/* Look for the end of the headers in what has been read so far */
+		this->response[this->responseLength] = '\0';
+		char *end = strstr(this->response, "\r\n\r\n");
+		if(end != NULL) {
+			uint16_t headerLength = end + 4 - this->response;
+			uint16_t bodyLength = 0;
+			char *length = strstr(this->response, "Content-Length:");
+			if(length != NULL && length < end) {
+				bodyLength = atoi(length + 15);
+			}
+			if(headerLength + bodyLength >= HTTPLINK_RESPONSE_SIZE) {
+				LOG(F("EmonHttpLink: response too large\r\n"));
+				return false;
+			}
+			if(headerLength + bodyLength <= this->responseLength) {
+				*accepted = strncmp(this->response + 8, " 200", 4) == 0
+					&& bodyLength >= 2 && strncmp(this->response + headerLength, "ok", 2) == 0;
+				this->responseLength -= headerLength + bodyLength;
+				memmove(this->response, this->response + headerLength + bodyLength, this->responseLength);
+				return true;
+			}
+		}
+
+		if(this->responseLength >= HTTPLINK_RESPONSE_SIZE - 1) {
+			return false;
+		}
+		ssize_t got = read(this->fd, this->response + this->responseLength,
+			HTTPLINK_RESPONSE_SIZE - 1 - this->responseLength);
+		if(got <= 0) {
+			/* closed, failed or timed out */
+			if(got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				LOG(F("EmonHttpLink: response timed out\r\n"));
+			}
+			return false;
+		}
+		this->responseLength += got;
+	}
+}
+
+uint8_t EmonHttpLink::send(const char *payloads[], uint16_t lengths[], uint8_t count) {
+	if(!this->connectServer()) {
+		return 0;
+	}
+
+	/* Write every request before waiting for any response */
+	uint8_t written = 0;
+	for(; written < count; written++) {
+		char header[HTTPLINK_PATH_LENGTH + 128];
+		int headerLength = snprintf(header, sizeof(header),
+			"POST %s HTTP/1.1\r\nHost: %s\r\n"
+			"Content-Type: application/x-www-form-urlencoded\r\n"
+			"Content-Length: %u\r\n\r\n", this->path, this->address, lengths[written]);
+
+		struct iovec parts[2];
+		parts[0].iov_base = header;
+		parts[0].iov_len = headerLength;
+		parts[1].iov_base = (void *)payloads[written];
+		parts[1].iov_len = lengths[written];
+		ssize_t total = headerLength + lengths[written];
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = parts;
+		message.msg_iovlen = 2;
+		ssize_t sent = sendmsg(this->fd, &message, MSG_NOSIGNAL);
+		if(sent < total) {
+			/* fall back to plain writes for the rest */
+			if(sent < 0) {
+				break;
+			}
+			bool done = sent < headerLength
+				? this->writeAll(header + sent, headerLength - sent) && this->writeAll(payloads[written], lengths[written])
+				: this->writeAll(payloads[written] + (sent - headerLength), total - sent);
+			if(!done) {
+				break;
+			}
+		}
+		this->requests++;
+	}
+
+	/* Responses come back in request order, stop at the first refusal */
+	uint8_t accepted = 0;
+	bool leading = true;
+	for(uint8_t i = 0; i < written; i++) {
+		bool ok;
+		if(!this->readResponse(&ok)) {
+			this->disconnect();
+			return accepted;
+		}
+		if(ok && leading) {
+			accepted++;
+		} else {
+			leading = false;
+		}
+	}
+
+	if(written < count) {
+		this->disconnect();
+	}
+	return accepted;
+}
+
+uint32_t EmonHttpLink::getRequests() {
+	return this->requests;
+}
+
+#endif
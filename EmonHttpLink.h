@@ -0,0 +1,76 @@
+#ifndef __EMONHTTPLINK_H__
+#define __EMONHTTPLINK_H__
+
+#ifdef LINUX
+
+#include "BulkUploader.h"
+
+#define HTTPLINK_PATH_LENGTH 128
+#define HTTPLINK_RESPONSE_SIZE 512
+#ifndef HTTPLINK_TIMEOUT_MS
+#define HTTPLINK_TIMEOUT_MS 5000 /** longest wait to connect, or for a socket read or write **/
+#endif
+
+/**
+ * Keep-alive HTTP/1.1 connection to an emoncms server for the
+ * BulkUploader. A batch is written as pipelined requests before
+ * any of the responses are read. Connecting, reading and writing
+ * give up after HTTPLINK_TIMEOUT_MS and are treated as a refusal,
+ * so an unresponsive server leaves the batch for the uploader's backoff.
+ **/
+class EmonHttpLink {
+	public:
+		/**
+		 * @param address dotted IPv4 address of the server
+		 * @param port port of the server
+		 * @param path request path including the apikey, e.g. /input/bulk.json?apikey=...
+		 **/
+		EmonHttpLink(const char *address, uint16_t port, const char *path);
+		~EmonHttpLink();
+		/**
+		 * BulkSender for a BulkUploader, the context must be an EmonHttpLink
+		 **/
+		static uint8_t sender(void *context, const char *payloads[], uint16_t lengths[], uint8_t count);
+		/**
+		 * Sends a batch of payloads over the connection, reconnecting if needed
+		 * @return the number of leading payloads answered with ok
+		 **/
+		uint8_t send(const char *payloads[], uint16_t lengths[], uint8_t count);
+		/**
+		 * @return number of requests written
+		 **/
+		uint32_t getRequests();
+	protected:
+		char address[16]; /** server IPv4 address **/
+		uint16_t port; /** server port **/
+		char path[HTTPLINK_PATH_LENGTH]; /** request path **/
+		int fd; /** socket, -1 when disconnected **/
+		char response[HTTPLINK_RESPONSE_SIZE]; /** bytes read but not yet parsed **/
+		uint16_t responseLength; /** length of response **/
+		uint32_t requests; /** number of requests written **/
+
+		/**
+		 * Opens the connection if it isn't open
+		 * @return true if connected
+		 **/
+		bool connectServer();
+		/**
+		 * Closes the connection and discards buffered response data
+		 **/
+		void disconnect();
+		/**
+		 * Writes all of a buffer to the socket
+		 * @return true on success
+		 **/
+		bool writeAll(const char *data, uint16_t length);
+		/**
+		 * Reads one response off the connection
+		 * @param accepted set true if it was a 200 with an ok body
+		 * @return false if the connection can't be used further
+		 **/
+		bool readResponse(bool *accepted);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+#ifdef LINUX
+
+#include "FakeEmonServer.h"
+#include "Debug.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define FAKESERVER_POLL_MS 50
+
+FakeEmonServer::FakeEmonServer(uint32_t failCount) {
+	this->listenFd = -1;
+	this->running = false;
+	this->failCount = failCount;
+	this->requests = 0;
+	this->readings = 0;
+	this->lastBody[0] = '\0';
+	pthread_mutex_init(&(this->lock), NULL);
+}
+
+FakeEmonServer::~FakeEmonServer() {
+	this->stop();
+	pthread_mutex_destroy(&(this->lock));
+}
+
+uint16_t FakeEmonServer::start() {
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+
+	this->listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	if(this->listenFd < 0) {
+		return 0;
+	}
+	socklen_t length = sizeof(addr);
+	if(bind(this->listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+			|| listen(this->listenFd, 4) != 0
+			|| getsockname(this->listenFd, (struct sockaddr *)&addr, &length) != 0) {
+		close(this->listenFd);
+		this->listenFd = -1;
+		return 0;
+	}
+
+	this->running = true;
+	if(pthread_create(&(this->thread), NULL, FakeEmonServer::run, this) != 0) {
+		this->running = false;
+		close(this->listenFd);
+		this->listenFd = -1;
+		return 0;
+	}
+	return ntohs(addr.sin_port);
+}
+
+void FakeEmonServer::stop() {
+	if(this->running) {
+		this->running = false;
+		pthread_join(this->thread, NULL);
+	}
+	if(this->listenFd >= 0) {
+		close(this->listenFd);
+		this->listenFd = -1;
+	}
+}
+
+void *FakeEmonServer::run(void *server) {
+	FakeEmonServer *self = (FakeEmonServer *)server;
+	while(self->running) {
+		struct pollfd waiting;
+		waiting.fd = self->listenFd;
+		waiting.events = POLLIN;
+		if(poll(&waiting, 1, FAKESERVER_POLL_MS) <= 0) {
+			continue;
+		}
+		int fd = accept(self->listenFd, NULL, NULL);
+		if(fd >= 0) {
+			self->serve(fd);
+			close(fd);
+		}
+	}
+	return NULL;
+}
+
+void FakeEmonServer::serve(int fd) {
+	char buffer[FAKESERVER_BUFFER_SIZE + 1];
+	uint32_t length = 0;
+
+	while(this->running) {
+		/* Handle every complete request that has been read */
+		buffer[length] = '\0';
+		char *end = strstr(buffer, "\r\n\r\n");
+		if(end != NULL) {
+			uint32_t headerLength = end + 4 - buffer;
+			uint32_t bodyLength = 0;
+			char *contentLength = strstr(buffer, "Content-Length:");
+			if(contentLength != NULL && contentLength < end) {
+				bodyLength = atoi(contentLength + 15);
+			}
+			if(headerLength + bodyLength > FAKESERVER_BUFFER_SIZE) {
+				return;
+			}
+			if(headerLength + bodyLength <= length) {
+				const char *reply = this->handle(buffer + headerLength, bodyLength)
+					? "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok"
+					: "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 5\r\n\r\nerror";
+				if(send(fd, reply, strlen(reply), MSG_NOSIGNAL) < 0) {
+					return;
+				}
+				length -= headerLength + bodyLength;
+				memmove(buffer, buffer + headerLength + bodyLength, length);
+				continue;
+			}
+		}
+
+		struct pollfd waiting;
+		waiting.fd = fd;
+		waiting.events = POLLIN;
+		if(poll(&waiting, 1, FAKESERVER_POLL_MS) <= 0) {
+			continue;
+		}
+		ssize_t got = read(fd, buffer + length, FAKESERVER_BUFFER_SIZE - length);
+		if(got <= 0) {
+			return;
+		}
+		length += got;
+	}
+}
+
+bool FakeEmonServer::handle(const char *body, uint32_t length) {
+	pthread_mutex_lock(&(this->lock));
+	if(this->failCount > 0) {
+		this->failCount--;
+		pthread_mutex_unlock(&(this->lock));
+		return false;
+	}
+
+	/* every reading is a "name":value pair */
+	for(uint32_t i = 0; i < length; i++) {
+		if(body[i] == ':') {
+			this->readings++;
+		}
+	}
+	this->requests++;
+	uint32_t copy = length < FAKESERVER_BUFFER_SIZE - 1 ? length : FAKESERVER_BUFFER_SIZE - 1;
+	memcpy(this->lastBody, body, copy);
+	this->lastBody[copy] = '\0';
+	pthread_mutex_unlock(&(this->lock));
+	return true;
+}
+
+uint32_t FakeEmonServer::getRequests() {
+	pthread_mutex_lock(&(this->lock));
+	uint32_t requests = this->requests;
+	pthread_mutex_unlock(&(this->lock));
+	return requests;
+}
+
+uint32_t FakeEmonServer::getReadings() {
+	pthread_mutex_lock(&(this->lock));
+	uint32_t readings = this->readings;
+	pthread_mutex_unlock(&(this->lock));
+	return readings;
+}
+
+void FakeEmonServer::getLastBody(char *out, uint32_t size) {
+	pthread_mutex_lock(&(this->lock));
+	strncpy(out, this->lastBody, size - 1);
+	out[size - 1] = '\0';
+	pthread_mutex_unlock(&(this->lock));
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef __FAKEEMONSERVER_H__
+#define __FAKEEMONSERVER_H__
+
+#ifdef LINUX
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define FAKESERVER_BUFFER_SIZE 8192
+
+/**
+ * Minimal stand-in for an emoncms server's input/bulk endpoint, used as
+ * the target of tests and benchmarks. Serves keep-alive connections one
+ * at a time on a background thread and answers every request with "ok".
+ **/
+class FakeEmonServer {
+	public:
+		/**
+		 * @param failCount number of requests to answer with an error first
+		 **/
+		FakeEmonServer(uint32_t failCount = 0);
+		~FakeEmonServer();
+		/**
+		 * Listens on an ephemeral loopback port and starts serving
+		 * @return the port, 0 on failure
+		 **/
+		uint16_t start();
+		/**
+		 * Stops serving and waits for the thread to finish
+		 **/
+		void stop();
+		/**
+		 * @return number of requests answered ok
+		 **/
+		uint32_t getRequests();
+		/**
+		 * @return number of readings in requests answered ok
+		 **/
+		uint32_t getReadings();
+		/**
+		 * Copies the body of the last request answered ok
+		 * @param out buffer to copy into
+		 * @param size size of out
+		 **/
+		void getLastBody(char *out, uint32_t size);
+	protected:
+		int listenFd; /** listening socket **/
+		volatile bool running; /** cleared to stop the thread **/
+		pthread_t thread; /** serving thread **/
+		pthread_mutex_t lock; /** guards the counters and last body **/
+		uint32_t failCount; /** requests left to fail **/
+		uint32_t requests; /** requests answered ok **/
+		uint32_t readings; /** readings answered ok **/
+		char lastBody[FAKESERVER_BUFFER_SIZE]; /** body of the last ok request **/
+
+		static void *run(void *server);
+		/**
+		 * Serves requests on a connection until it closes
+		 **/
+		void serve(int fd);
+		/**
+		 * Handles one complete request body
+		 * @return true if it was answered ok
+		 **/
+		bool handle(const char *body, uint32_t length);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,304 @@
+#ifdef LINUX
+
+#include "FeedStore.h"
+#include "Debug.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+FeedStore::FeedStore(const char *directory, uint32_t interval, uint32_t maxGap) {
+	strncpy(this->directory, directory, FEEDSTORE_PATH_LENGTH - 1);
+	this->directory[FEEDSTORE_PATH_LENGTH - 1] = '\0';
+	this->interval = interval > 0 ? interval : 1;
+	this->maxGap = maxGap;
+	this->dedup = NULL;
+	for(uint16_t i = 0; i < FEEDSTORE_MAX_FEEDS; i++) {
+		this->feeds[i].fd = -1;
+		this->feeds[i].header = NULL;
+	}
+}
+
+FeedStore::~FeedStore() {
+	this->close();
+}
+
+Feed *FeedStore::findSlot(uint16_t nodeID, AttributeIdentifier *attr) {
+	uint32_t hash = nodeID;
+	hash = hash * 31 + attr->groupID;
+	hash = hash * 31 + attr->attributeID;
+	hash = hash * 31 + attr->attributeNumber;
+	hash ^= hash >> 16;
+
+	for(uint16_t i = 0; i < FEEDSTORE_MAX_FEEDS; i++) {
+		Feed *feed = &(this->feeds[(hash + i) & (FEEDSTORE_MAX_FEEDS - 1)]);
+		if(feed->fd < 0) {
+			return feed;
+		}
+		if(feed->nodeID == nodeID && feed->attr.groupID == attr->groupID
+				&& feed->attr.attributeID == attr->attributeID
+				&& feed->attr.attributeNumber == attr->attributeNumber) {
+			return feed;
+		}
+	}
+	return NULL;
+}
+
+bool FeedStore::mapFeed(Feed *feed, uint32_t capacity) {
+	size_t oldLength = sizeof(FeedHeader) + (size_t)feed->capacity * sizeof(float);
+	size_t length = sizeof(FeedHeader) + (size_t)capacity * sizeof(float);
+
+	/* Grow the file first so the whole mapping is backed */
+	if(capacity > feed->capacity && ftruncate(feed->fd, length) != 0) {
+		LOG(F("FeedStore: could not grow feed file\r\n"));
+		return false;
+	}
+
+	void *map;
+	if(feed->header == NULL) {
+		map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, feed->fd, 0);
+	} else {
+		map = mremap(feed->header, oldLength, length, MREMAP_MAYMOVE);
+	}
+	if(map == MAP_FAILED) {
+		LOG(F("FeedStore: could not map feed file\r\n"));
+		return false;
+	}
+
+	feed->header = (FeedHeader *)map;
+	feed->data = (float *)(feed->header + 1);
+	feed->capacity = capacity;
+	return true;
+}
+
+Feed *FeedStore::open(uint16_t nodeID, AttributeIdentifier *attr) {
+	Feed *feed = this->findSlot(nodeID, attr);
+	if(feed == NULL) {
+		LOG(F("FeedStore: too many open feeds\r\n"));
+		return NULL;
+	}
+	if(feed->fd >= 0) {
+		return feed;
+	}
+
+	char path[FEEDSTORE_PATH_LENGTH + 32];
+	snprintf(path, sizeof(path), "%s/%u_%u_%u_%u.fina", this->directory, nodeID,
+		attr->groupID, attr->attributeID, attr->attributeNumber);
+
+	int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+	if(fd < 0) {
+		LOG(F("FeedStore: could not open ")); LOG(path); LOG(F("\r\n"));
+		return NULL;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
+		::close(fd);
+		return NULL;
+	}
+
+	feed->fd = fd;
+	feed->nodeID = nodeID;
+	feed->attr = *attr;
+	feed->header = NULL;
+	feed->capacity = 0;
+
+	bool created = (size_t)st.st_size < sizeof(FeedHeader);
+	uint32_t capacity = created ? FEEDSTORE_GROW_POINTS
+		: (uint32_t)((st.st_size - sizeof(FeedHeader)) / sizeof(float));
+	if(!created) {
+		/* existing files are mapped at their current size */
+		feed->capacity = capacity;
+	}
+
+	if(!this->mapFeed(feed, capacity)) {
+		::close(fd);
+		feed->fd = -1;
+		return NULL;
+	}
+
+	if(!created && feed->header->magic == FEEDSTORE_MAGIC && feed->header->interval == 0) {
+		LOG(F("FeedStore: feed has no interval, starting it again\r\n"));
+	}
+	if(created || feed->header->magic != FEEDSTORE_MAGIC || feed->header->interval == 0) {
+		feed->header->interval = this->interval;
+		feed->header->startTime = 0;
+		feed->header->npoints = 0;
+		feed->header->magic = FEEDSTORE_MAGIC;
+	} else if(feed->header->npoints > feed->capacity) {
+		/* header was committed but the file lost its tail */
+		feed->header->npoints = feed->capacity;
+	}
+
+	return feed;
+}
+
+bool FeedStore::append(Feed *feed, uint32_t timestamp, float value) {
+	FeedHeader *header = feed->header;
+
+	if(header->npoints == 0) {
+		header->startTime = timestamp - (timestamp % header->interval);
+	} else if(timestamp < header->startTime) {
+		LOG(F("FeedStore: reading before start of feed\r\n"));
+		return false;
+	}
+
+	uint32_t slot = (timestamp - header->startTime) / header->interval;
+	if(header->npoints > 0 && slot >= header->npoints
+			&& (uint64_t)(slot - (header->npoints - 1)) * header->interval > this->maxGap) {
+		LOG(F("FeedStore: reading too far ahead of feed\r\n"));
+		return false;
+	}
+
+	if(slot >= feed->capacity) {
+		uint64_t capacity = (uint64_t)feed->capacity * 2;
+		if(capacity < (uint64_t)slot + FEEDSTORE_GROW_POINTS) {
+			capacity = (uint64_t)slot + FEEDSTORE_GROW_POINTS;
+		}
+		if(capacity > FEEDSTORE_MAX_POINTS) {
+			capacity = FEEDSTORE_MAX_POINTS;
+		}
+		if(slot >= capacity || !this->mapFeed(feed, (uint32_t)capacity)) {
+			return false;
+		}
+		header = feed->header;
+	}
+
+	/* Gaps are filled before the value, and the point count is only
+	 *  moved on once the data it covers is in place. This orders the
+	 *  stores for other processes mapping the file and survives this
+	 *  process crashing; it does not order the pages written back to
+	 *  disk, for that call sync.
+	 */
+	for(uint32_t i = header->npoints; i < slot; i++) {
+		feed->data[i] = NAN;
+	}
+	feed->data[slot] = value;
+	if(slot >= header->npoints) {
+		__atomic_store_n(&(header->npoints), slot + 1, __ATOMIC_RELEASE);
+	}
+	return true;
+}
+
+bool FeedStore::itemToFloat(DataItem *item, float *out) {
+	union {
+		int8_t c; uint8_t uc; int16_t s; uint16_t us;
+		int32_t i; uint32_t ui; int64_t l; uint64_t ul; float f;
+	} v;
+
+	/* items point into the raw packet so may be unaligned */
+	switch(item->type) {
+		case CHAR: memcpy(&v.c, item->item, sizeof(v.c)); *out = v.c; break;
+		case UCHAR: memcpy(&v.uc, item->item, sizeof(v.uc)); *out = v.uc; break;
+		case SHORT: memcpy(&v.s, item->item, sizeof(v.s)); *out = v.s; break;
+		case USHORT: memcpy(&v.us, item->item, sizeof(v.us)); *out = v.us; break;
+		case INT: memcpy(&v.i, item->item, sizeof(v.i)); *out = v.i; break;
+		case UINT: memcpy(&v.ui, item->item, sizeof(v.ui)); *out = v.ui; break;
+		case LONG: memcpy(&v.l, item->item, sizeof(v.l)); *out = v.l; break;
+		case ULONG: memcpy(&v.ul, item->item, sizeof(v.ul)); *out = v.ul; break;
+		case FLOAT: memcpy(&v.f, item->item, sizeof(v.f)); *out = v.f; break;
+		default:
+			return false;
+	}
+	return true;
+}
+
+bool FeedStore::post(HeaderInfo *header, DataItem items[], uint32_t timestamp, uint8_t verdict) {
+	if(header->dataCount < 5 || header->status != SUCCESS) {
+		LOG(F("FeedStore: not a successful post\r\n"));
+		return false;
+	}
+	for(uint8_t i = 0; i < 4; i++) {
+		if(items[i].type != USHORT) {
+			LOG(F("FeedStore: post identifier is not USHORTs\r\n"));
+			return false;
+		}
+	}
+
+	uint16_t nodeID;
+	AttributeIdentifier ident;
+	memcpy(&nodeID, items[0].item, sizeof(nodeID));
+	memcpy(&(ident.groupID), items[1].item, sizeof(ident.groupID));
+	memcpy(&(ident.attributeID), items[2].item, sizeof(ident.attributeID));
+	memcpy(&(ident.attributeNumber), items[3].item, sizeof(ident.attributeNumber));
+
+	float value;
+	if(!this->itemToFloat(&(items[4]), &value)) {
+		LOG(F("FeedStore: post value is not numeric\r\n"));
+		return false;
+	}
+	if(verdict == DEDUP_RESULTS && this->dedup != NULL) {
+		verdict = this->dedup->checkItems(header, items);
+	}
+	if(verdict != DEDUP_RESULTS && !DedupWindow::accepted(verdict)) {
+		return true;
+	}
+
+	Feed *feed = this->open(nodeID, &ident);
+	if(feed == NULL) {
+		return false;
+	}
+	return this->append(feed, timestamp, value);
+}
+
+void FeedStore::setDedup(DedupWindow *dedup) {
+	this->dedup = dedup;
+}
+
+float FeedStore::value(Feed *feed, uint32_t timestamp) {
+	FeedHeader *header = feed->header;
+	if(header->npoints == 0 || timestamp < header->startTime) {
+		return NAN;
+	}
+	uint32_t slot = (timestamp - header->startTime) / header->interval;
+	if(slot >= header->npoints) {
+		return NAN;
+	}
+	return feed->data[slot];
+}
+
+const float *FeedStore::range(Feed *feed, uint32_t start, uint32_t end, uint32_t *count) {
+	FeedHeader *header = feed->header;
+	*count = 0;
+	if(header->npoints == 0 || end < start || end < header->startTime) {
+		return NULL;
+	}
+
+	uint32_t first = start < header->startTime ? 0 : (start - header->startTime) / header->interval;
+	uint32_t last = (end - header->startTime) / header->interval;
+	if(last >= header->npoints) {
+		last = header->npoints - 1;
+	}
+	if(first > last) {
+		return NULL;
+	}
+
+	*count = last - first + 1;
+	return &(feed->data[first]);
+}
+
+void FeedStore::sync() {
+	for(uint16_t i = 0; i < FEEDSTORE_MAX_FEEDS; i++) {
+		Feed *feed = &(this->feeds[i]);
+		if(feed->fd >= 0) {
+			msync(feed->header, sizeof(FeedHeader) + (size_t)feed->capacity * sizeof(float), MS_SYNC);
+		}
+	}
+}
+
+void FeedStore::close() {
+	for(uint16_t i = 0; i < FEEDSTORE_MAX_FEEDS; i++) {
+		Feed *feed = &(this->feeds[i]);
+		if(feed->fd >= 0) {
+			munmap(feed->header, sizeof(FeedHeader) + (size_t)feed->capacity * sizeof(float));
+			::close(feed->fd);
+			feed->fd = -1;
+			feed->header = NULL;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef __FEEDSTORE_H__
+#define __FEEDSTORE_H__
+
+#ifdef LINUX
+
+#include "EMonCMS.h"
+#include "DedupWindow.h"
+
+#define FEEDSTORE_MAX_FEEDS 256 /** maximum number of feeds open at once, power of 2 **/
+#define FEEDSTORE_GROW_POINTS 4096 /** minimum number of slots a feed file grows by **/
+#ifndef FEEDSTORE_MAX_GAP
+#define FEEDSTORE_MAX_GAP 604800 /** default seconds a reading may be ahead of the last one **/
+#endif
+#define FEEDSTORE_MAX_POINTS 0xFFFFFFFF /** largest feed capacity in slots **/
+#define FEEDSTORE_MAGIC 0x414E4946 /** "FINA" **/
+#define FEEDSTORE_PATH_LENGTH 256
+
+/**
+ * On disk header at the start of every feed file. The data slots
+ * follow directly after it as an array of floats, NAN for missing.
+ **/
+typedef struct {
+	uint32_t magic; /** FEEDSTORE_MAGIC **/
+	uint32_t interval; /** seconds between slots **/
+	uint32_t startTime; /** timestamp of slot 0 **/
+	uint32_t npoints; /** number of committed slots, written after the data in memory, not on disk **/
+} FeedHeader;
+
+/**
+ * An open feed, one per posted attribute of a node.
+ **/
+typedef struct {
+	uint16_t nodeID; /** emon cms node ID the attribute belongs to **/
+	AttributeIdentifier attr; /** the attribute this feed stores **/
+	int fd; /** file descriptor of the feed file, -1 when unused **/
+	FeedHeader *header; /** start of the mapping **/
+	float *data; /** slots following the header in the mapping **/
+	uint32_t capacity; /** number of slots backed by the file **/
+} Feed;
+
+/**
+ * Fixed interval, append only time series store in the style of
+ * emoncms's PHPFina. Each feed is a memory mapped file, appends and
+ * timestamp to slot lookups are O(1) and ranges are contiguous.
+ **/
+class FeedStore {
+	public:
+		/**
+		 * @param directory directory feed files are kept in
+		 * @param interval seconds between slots for newly created feeds
+		 * @param maxGap seconds a reading may be ahead of the last one in
+		 *  its feed, so a bad timestamp can't grow the file without bound
+		 **/
+		FeedStore(const char *directory, uint32_t interval, uint32_t maxGap = FEEDSTORE_MAX_GAP);
+		~FeedStore();
+		/**
+		 * Opens, or creates, the feed for an attribute of a node.
+		 * @param nodeID node the attribute belongs to
+		 * @param attr attribute identifier of the feed
+		 * @return NULL on failure, otherwise the open feed
+		 **/
+		Feed *open(uint16_t nodeID, AttributeIdentifier *attr);
+		/**
+		 * Stores a value in the slot for the given timestamp, filling
+		 * any gap since the last slot with NAN.
+		 * @param feed feed to write to
+		 * @param timestamp time of the reading in seconds
+		 * @param value the reading
+		 * @return true on success, false if the timestamp is before the
+		 *  start of the feed or more than maxGap after its last slot
+		 **/
+		bool append(Feed *feed, uint32_t timestamp, float value);
+		/**
+		 * Stores the value of a parsed ATTR_POST packet. Numbered posts
+		 * already seen are dropped instead of being stored again at a
+		 * later time, judged by the verdict given or else by the store's
+		 * DedupWindow, if set.
+		 * @param header header of the post
+		 * @param items parsed items: NID, GID, AID, ATTRNUM, ATTRVAL and
+		 *  optionally SEQ
+		 * @param timestamp time the post was received in seconds
+		 * @param verdict DedupResult of the window the post was already
+		 *  checked against, e.g. a gateway's, or DEDUP_RESULTS to check it
+		 *  against the store's own
+		 * @return true on success or if the post was dropped as a repeat,
+		 *  false if the identifier items are not USHORTs or the value is
+		 *  not numeric
+		 **/
+		bool post(HeaderInfo *header, DataItem items[], uint32_t timestamp, uint8_t verdict = DEDUP_RESULTS);
+		/**
+		 * Reads the value stored for a timestamp.
+		 * @param feed feed to read from
+		 * @param timestamp time to look up
+		 * @return the value, NAN if there is none
+		 **/
+		float value(Feed *feed, uint32_t timestamp);
+		/**
+		 * Sets the store's own filter for repeated posts. It must not be a
+		 * window the posts already went through, e.g. a gateway's, which
+		 * has recorded every post and would drop them all as repeats;
+		 * give post that window's verdict instead.
+		 * @param dedup the window to check posts against, NULL for none
+		 **/
+		void setDedup(DedupWindow *dedup);
+		/**
+		 * Gives the contiguous slots between two timestamps. The pointer
+		 * is only valid until the next append to the feed.
+		 * @param feed feed to read from
+		 * @param start first timestamp of the range
+		 * @param end last timestamp of the range
+		 * @param count set to the number of slots returned
+		 * @return pointer to the first slot, NULL if the range is empty
+		 **/
+		const float *range(Feed *feed, uint32_t start, uint32_t end, uint32_t *count);
+		/**
+		 * Flushes the data and headers of all open feeds to disk. Until
+		 * then a power loss can keep a header whose npoints covers slots
+		 * that never reached the disk.
+		 **/
+		void sync();
+		/**
+		 * Closes all open feeds
+		 **/
+		void close();
+	protected:
+		char directory[FEEDSTORE_PATH_LENGTH]; /** directory feed files are kept in **/
+		uint32_t interval; /** interval for newly created feeds **/
+		uint32_t maxGap; /** seconds a reading may be ahead of the last one **/
+		DedupWindow *dedup; /** drops repeated posts, NULL for none **/
+		Feed feeds[FEEDSTORE_MAX_FEEDS]; /** open feeds, indexed by hash **/
+
+		/**
+		 * Finds the slot in feeds for an attribute using open addressing.
+		 * @return the matching or first free slot, NULL if full
+		 **/
+		Feed *findSlot(uint16_t nodeID, AttributeIdentifier *attr);
+		/**
+		 * Maps the feed file, growing it to at least the given slots
+		 * @return true on success
+		 **/
+		bool mapFeed(Feed *feed, uint32_t capacity);
+		/**
+		 * Converts a numeric data item to a float
+		 * @return false if the item is not numeric
+		 **/
+		bool itemToFloat(DataItem *item, float *out);
+};
+
+#endif
+
+#endif
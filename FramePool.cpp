@@ -0,0 +1,68 @@
+#include "FramePool.h"
+#include "Debug.h"
+
+FramePool::FramePool() {
+	for(uint8_t i = 0; i < FRAMEPOOL_FRAMES; i++) {
+		this->freeFrames[i] = FRAMEPOOL_FRAMES - 1 - i;
+	}
+	this->freeCount = FRAMEPOOL_FRAMES;
+	memset(this->refs, 0, sizeof(this->refs));
+	this->highWater = 0;
+}
+
+uint8_t *FramePool::acquire() {
+	if(this->freeCount == 0) {
+		LOG(F("FramePool: no free frames\r\n"));
+		return NULL;
+	}
+	uint8_t index = this->freeFrames[--this->freeCount];
+	this->refs[index] = 1;
+	if(this->getInUse() > this->highWater) {
+		this->highWater = this->getInUse();
+	}
+	return this->frames[index];
+}
+
+uint8_t FramePool::indexOf(uint8_t *frame) {
+	if(frame < this->frames[0] || frame >= this->frames[0] + sizeof(this->frames)
+			|| (frame - this->frames[0]) % EMONCMS_MTU != 0) {
+		LOG(F("FramePool: frame not from pool\r\n"));
+		return FRAMEPOOL_FRAMES;
+	}
+	uint8_t index = (frame - this->frames[0]) / EMONCMS_MTU;
+	if(this->refs[index] == 0) {
+		LOG(F("FramePool: frame not in use\r\n"));
+		return FRAMEPOOL_FRAMES;
+	}
+	return index;
+}
+
+bool FramePool::retain(uint8_t *frame) {
+	uint8_t index = this->indexOf(frame);
+	if(index == FRAMEPOOL_FRAMES || this->refs[index] == 0xFF) {
+		return false;
+	}
+	this->refs[index]++;
+	return true;
+}
+
+void FramePool::release(uint8_t *frame) {
+	if(frame == NULL) {
+		return;
+	}
+	uint8_t index = this->indexOf(frame);
+	if(index == FRAMEPOOL_FRAMES) {
+		return;
+	}
+	if(--this->refs[index] == 0) {
+		this->freeFrames[this->freeCount++] = index;
+	}
+}
+
+uint8_t FramePool::getInUse() {
+	return FRAMEPOOL_FRAMES - this->freeCount;
+}
+
+uint8_t FramePool::getHighWater() {
+	return this->highWater;
+}
@@ -0,0 +1,69 @@
+#ifndef __FRAMEPOOL_H__
+#define __FRAMEPOOL_H__
+
+#ifdef LINUX
+#include <cstring>
+#include <stdint.h>
+#else
+#include "Arduino.h"
+#endif
+
+#ifndef EMONCMS_MTU
+#define EMONCMS_MTU 64 /** largest frame the radio carries, header included **/
+#endif
+
+#ifndef FRAMEPOOL_FRAMES
+#define FRAMEPOOL_FRAMES 2 /** frames in each pool, one for a response and one spare **/
+#endif
+
+/**
+ * Fixed set of EMONCMS_MTU sized frame buffers. Packets are built into
+ * frames taken from the pool instead of stack arrays sized at run time,
+ * so the RAM used for encoding is known at compile time. Free frames are
+ * kept on a stack of indexes so acquiring and releasing are O(1). Each
+ * frame has a reference count, so a frame can be held past its builder
+ * releasing it, e.g. while queued, and a release of a free frame is caught.
+ **/
+class FramePool {
+	public:
+		FramePool();
+		/**
+		 * Takes a frame from the pool
+		 * @return an EMONCMS_MTU byte frame, NULL if all are in use
+		 **/
+		uint8_t *acquire();
+		/**
+		 * Takes another reference to an acquired frame, it stays in use
+		 * until released once more
+		 * @param frame a frame from acquire
+		 * @return false if the frame isn't from the pool or isn't in use
+		 **/
+		bool retain(uint8_t *frame);
+		/**
+		 * Drops a reference to a frame, returning it to the pool with the
+		 * last. Frames not from the pool or not in use are logged and ignored.
+		 * @param frame a frame from acquire, NULL is ignored
+		 **/
+		void release(uint8_t *frame);
+		/**
+		 * @return frames currently acquired
+		 **/
+		uint8_t getInUse();
+		/**
+		 * @return most frames that have been acquired at once
+		 **/
+		uint8_t getHighWater();
+	protected:
+		uint8_t frames[FRAMEPOOL_FRAMES][EMONCMS_MTU] __attribute__((aligned(4))); /** frame storage **/
+		uint8_t freeFrames[FRAMEPOOL_FRAMES]; /** indexes of free frames **/
+		uint8_t freeCount; /** entries in freeFrames **/
+		uint8_t refs[FRAMEPOOL_FRAMES]; /** references to each frame, 0 when free **/
+		uint8_t highWater; /** most frames acquired at once **/
+
+		/**
+		 * @return index of a frame in use, FRAMEPOOL_FRAMES if it is free or not from the pool
+		 **/
+		uint8_t indexOf(uint8_t *frame);
+};
+
+#endif
@@ -0,0 +1,730 @@
+#ifdef LINUX
+
+#include "Debug.h"
+#include "EMonCMS.h"
+#include "FeedStore.h"
+#include "BulkUploader.h"
+#include "EmonHttpLink.h"
+#include "FakeEmonServer.h"
+#include "AttributePoller.h"
+#include "RadioSimulator.h"
+#include "NodeTable.h"
+#include "NodeDispatcher.h"
+#include "EMonAsync.h"
+#include "CodecFuzzer.h"
+#include "DedupWindow.h"
+#include "TestHelpers.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#define BENCH(x) x(); \
+	total++;
+
+/**
+ * Monotonic wall time in seconds for timing benchmarks
+ **/
+double benchSeconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Prints a benchmark result as a rate per second
+ * @param name name of the benchmark
+ * @param count number of operations done
+ * @param seconds time taken
+ * @param unit what an operation is
+ **/
+void benchReport(const char *name, double count, double seconds, const char *unit) {
+	std::cout << name << ": " << (uint64_t)(count / seconds) << " " << unit << "/s ("
+		<< (seconds * 1e9 / count) << " ns each)\n";
+}
+
+/* keeps results live so the optimiser can't drop the work */
+volatile float benchSink;
+
+#define FEED_BENCH_POINTS 2000000
+#define FEED_BENCH_NODES 64
+
+void benchFeedStore() {
+	char directory[] = "/tmp/emoncmsbenchXXXXXX";
+	if(mkdtemp(directory) == NULL) {
+		std::cout << "benchFeedStore: could not create directory\n";
+		return;
+	}
+
+	EMonCMS emon(NULL, 0, NULL, NULL, NULL, 1);
+	FeedStore store(directory, 10);
+	AttributeIdentifier ident;
+	ident.groupID = 1;
+	ident.attributeID = 2;
+	ident.attributeNumber = 0;
+
+	/* Build one post frame per node, the benchmark only changes the value */
+	uint8_t frames[FEED_BENCH_NODES][32];
+	HeaderInfo *headers[FEED_BENCH_NODES];
+	DataItem items[FEED_BENCH_NODES][5];
+	int value = 0;
+	for(uint16_t n = 0; n < FEED_BENCH_NODES; n++) {
+		EMonCMS node(NULL, 0, NULL, NULL, NULL, n + 1);
+		DataItem postItems[4];
+		node.attrIdentAsDataItems(&ident, postItems);
+		postItems[3].type = INT;
+		postItems[3].item = &value;
+		node.attrBuilder(ATTR_POST, postItems, 4, frames[n]);
+		headers[n] = (HeaderInfo *)frames[n];
+		emon.parseDataItems(headers[n], &(frames[n][sizeof(HeaderInfo)]), items[n]);
+	}
+
+	double start = benchSeconds();
+	for(uint32_t i = 0; i < FEED_BENCH_POINTS; i++) {
+		uint16_t n = i % FEED_BENCH_NODES;
+		memcpy((void *)items[n][4].item, &i, sizeof(i));
+		store.post(headers[n], items[n], 1000000 + (i / FEED_BENCH_NODES) * 10);
+	}
+	benchReport("benchFeedStorePost", FEED_BENCH_POINTS, benchSeconds() - start, "posts");
+
+	Feed *feed = store.open(1, &ident);
+	start = benchSeconds();
+	for(uint32_t i = 0; i < FEED_BENCH_POINTS; i++) {
+		feed = store.open(1, &ident);
+		store.append(feed, 1000000 + i * 10, (float)i);
+	}
+	benchReport("benchFeedStoreAppend", FEED_BENCH_POINTS, benchSeconds() - start, "points");
+
+	uint32_t count = 0;
+	float sum = 0;
+	start = benchSeconds();
+	for(int pass = 0; pass < 10; pass++) {
+		const float *values = store.range(feed, 0, 0xFFFFFFFF, &count);
+		for(uint32_t i = 0; i < count; i++) {
+			sum += values[i];
+		}
+	}
+	benchSink = sum;
+	benchReport("benchFeedStoreRange", (double)count * 10, benchSeconds() - start, "points");
+
+	store.close();
+	removeFeedDirectory(directory);
+}
+
+#define BULK_BENCH_READINGS 2000000
+#define BULK_BENCH_NODES 64
+#define BULK_BENCH_ATTRIBUTES 4
+
+uint8_t discardingBulkSender(void *, const char *[], uint16_t [], uint8_t count) {
+	return count;
+}
+
+/**
+ * Feeds readings from BULK_BENCH_NODES nodes, each posting
+ * BULK_BENCH_ATTRIBUTES attributes per timestamp, through an uploader.
+ **/
+void runBulkUploader(const char *name, BulkUploader *uploader) {
+	AttributeIdentifier ident;
+	ident.groupID = 3;
+	ident.attributeNumber = 0;
+	float value = 0;
+	DataItem item = { FLOAT, &value };
+
+	double start = benchSeconds();
+	for(uint32_t i = 0; i < BULK_BENCH_READINGS; i++) {
+		uint32_t reading = i / BULK_BENCH_ATTRIBUTES;
+		ident.attributeID = i % BULK_BENCH_ATTRIBUTES;
+		value = (float)(i % 100000) * 0.25f;
+		uint32_t now = i / 1000;
+		while(!uploader->add(reading % BULK_BENCH_NODES + 1, &ident, &item,
+				1700000000 + reading / BULK_BENCH_NODES, now)) {
+			uploader->poll(now);
+		}
+		uploader->poll(now);
+	}
+	uploader->flush(BULK_BENCH_READINGS);
+	double seconds = benchSeconds() - start;
+
+	benchReport(name, uploader->getReadingsForwarded(), seconds, "readings");
+	std::cout << name << ": " << (double)uploader->getBytesForwarded() / uploader->getReadingsForwarded()
+		<< " bytes/reading\n";
+}
+
+void benchBulkUploader() {
+	BulkUploader serialiser(discardingBulkSender, NULL, 1000);
+	runBulkUploader("benchBulkUploaderSerialise", &serialiser);
+
+	FakeEmonServer server;
+	uint16_t port = server.start();
+	if(port == 0) {
+		std::cout << "benchBulkUploader: could not start fake server\n";
+		return;
+	}
+	EmonHttpLink link("127.0.0.1", port, "/input/bulk.json?apikey=bench");
+	BulkUploader uploader(EmonHttpLink::sender, &link, 1000);
+	runBulkUploader("benchBulkUploaderForward", &uploader);
+	std::cout << "benchBulkUploaderForward: " << link.getRequests() << " requests, "
+		<< server.getReadings() << " readings received\n";
+	server.stop();
+}
+
+#define POLL_BENCH_NODES 2
+#define POLL_BENCH_ATTRIBUTES 12
+#define POLL_BENCH_MS 60000
+
+AttributePoller *benchPoller = NULL;
+uint32_t benchPolled = 0;
+int benchReading = 1234;
+
+bool benchAttributeReader(AttributeIdentifier *, DataItem *item) {
+	item->type = INT;
+	item->item = &benchReading;
+	return true;
+}
+
+void benchPollGateway(uint8_t type, uint8_t *buffer, uint16_t length, uint32_t now) {
+	benchPoller->handleResponse(type, buffer, length, now);
+}
+
+void benchPollResult(uint16_t nodeID, AttributeIdentifier *attr, uint8_t status, DataItem *) {
+	if(status == SUCCESS) {
+		benchPolled++;
+	}
+	/* keep polling the same attribute for the whole run */
+	benchPoller->request(nodeID, attr);
+}
+
+/**
+ * Polls every attribute of every node continuously for POLL_BENCH_MS of
+ * simulated time on a 38.4kbps channel with 30ms turnaround and 1% loss.
+ **/
+void runAttributePoller(const char *name, uint8_t window, uint16_t framesPerSecond, uint8_t batch) {
+	static AttributeValue attrValues[POLL_BENCH_NODES][POLL_BENCH_ATTRIBUTES];
+	EMonCMS *nodes[POLL_BENCH_NODES];
+
+	RadioSimulator sim(38400, 30, 10, 42);
+	for(uint16_t n = 0; n < POLL_BENCH_NODES; n++) {
+		for(uint16_t a = 0; a < POLL_BENCH_ATTRIBUTES; a++) {
+			attrValues[n][a].attr.groupID = 1;
+			attrValues[n][a].attr.attributeID = a;
+			attrValues[n][a].attr.attributeNumber = 0;
+			attrValues[n][a].reader = benchAttributeReader;
+			attrValues[n][a].registered = true;
+		}
+		nodes[n] = new EMonCMS(attrValues[n], POLL_BENCH_ATTRIBUTES, RadioSimulator::nodeSender, NULL, NULL, n + 1);
+		sim.addNode(nodes[n]);
+	}
+	sim.setGateway(benchPollGateway);
+
+	AttributePoller poller(RadioSimulator::gatewaySender, benchPollResult, window, framesPerSecond, batch);
+	benchPoller = &poller;
+	benchPolled = 0;
+	for(uint16_t n = 0; n < POLL_BENCH_NODES; n++) {
+		for(uint16_t a = 0; a < POLL_BENCH_ATTRIBUTES; a++) {
+			poller.request(n + 1, &(attrValues[n][a].attr));
+		}
+	}
+
+	double start = benchSeconds();
+	while(sim.now() < POLL_BENCH_MS) {
+		poller.poll(sim.now());
+		sim.runUntil(sim.now() + 1);
+	}
+	double seconds = benchSeconds() - start;
+
+	std::cout << name << ": " << benchPolled * 1000.0 / POLL_BENCH_MS << " polled attributes/s simulated, "
+		<< sim.getAirtime() * 100.0 / POLL_BENCH_MS << "% airtime, "
+		<< (double)sim.getAirtime() / benchPolled << " ms airtime/attribute, " << poller.getRetries() << " resends, "
+		<< (uint64_t)(benchPolled / seconds) << " polls/s wall\n";
+
+	benchPoller = NULL;
+	for(uint16_t n = 0; n < POLL_BENCH_NODES; n++) {
+		delete nodes[n];
+	}
+}
+
+void benchAttributePoller() {
+	runAttributePoller("benchAttributePollerWindow1", 1, 0, 1);
+	runAttributePoller("benchAttributePollerWindow4", 4, 0, 1);
+	runAttributePoller("benchAttributePollerWindow4Paced", 4, 40, 1);
+	runAttributePoller("benchAttributePollerWindow12Batch6", 12, 0, 6);
+}
+
+#define TABLE_BENCH_ATTRIBUTES 8
+#define TABLE_BENCH_FRAMES 4096
+#define TABLE_BENCH_PASSES 2000
+
+void benchNodeTable() {
+	NodeTable *table = new NodeTable(NODETABLE_SIZE * 32);
+	AttributeIdentifier ident;
+	ident.groupID = 1;
+	ident.attributeNumber = 0;
+
+	/* Fill every node ID with a set of attributes */
+	double start = benchSeconds();
+	uint32_t nodes = 0;
+	for(uint16_t nodeID = table->allocate(); nodeID != 0; nodeID = table->allocate()) {
+		for(uint16_t a = 0; a < TABLE_BENCH_ATTRIBUTES; a++) {
+			ident.attributeID = a;
+			table->addAttribute(nodeID, &ident);
+		}
+		nodes++;
+	}
+	benchReport("benchNodeTableRegister", (double)nodes * TABLE_BENCH_ATTRIBUTES, benchSeconds() - start, "attributes");
+
+	/* Post frames from random nodes, a quarter for unregistered attributes */
+	static uint8_t frames[TABLE_BENCH_FRAMES][32];
+	uint16_t lengths[TABLE_BENCH_FRAMES];
+	uint32_t random = 12345;
+	int value = 7;
+	for(uint16_t f = 0; f < TABLE_BENCH_FRAMES; f++) {
+		random = random * 1103515245 + 12345;
+		EMonCMS node(NULL, 0, NULL, NULL, NULL, (uint16_t)(random >> 16) | 1);
+		DataItem items[4];
+		ident.attributeID = (random >> 8) % (TABLE_BENCH_ATTRIBUTES + TABLE_BENCH_ATTRIBUTES / 3);
+		node.attrIdentAsDataItems(&ident, items);
+		items[3].type = INT;
+		items[3].item = &value;
+		lengths[f] = node.attrBuilder(ATTR_POST, items, 4, frames[f]);
+	}
+
+	uint32_t known = 0;
+	start = benchSeconds();
+	for(uint32_t pass = 0; pass < TABLE_BENCH_PASSES; pass++) {
+		for(uint16_t f = 0; f < TABLE_BENCH_FRAMES; f++) {
+			known += table->handleFrame(ATTR_POST, frames[f], lengths[f], pass);
+		}
+	}
+	double seconds = benchSeconds() - start;
+	benchReport("benchNodeTableFrame", (double)TABLE_BENCH_FRAMES * TABLE_BENCH_PASSES, seconds, "frames");
+	std::cout << "benchNodeTableFrame: " << nodes << " nodes, "
+		<< known * 100.0 / ((double)TABLE_BENCH_FRAMES * TABLE_BENCH_PASSES) << "% known\n";
+
+	/* Churn: replace every node, which should reuse the freed sets */
+	uint32_t used = table->getArenaUsed();
+	start = benchSeconds();
+	for(uint32_t nodeID = 1; nodeID < NODETABLE_SIZE; nodeID++) {
+		table->remove(nodeID);
+		table->assign(nodeID);
+		for(uint16_t a = 0; a < TABLE_BENCH_ATTRIBUTES; a++) {
+			ident.attributeID = a;
+			table->addAttribute(nodeID, &ident);
+		}
+	}
+	benchReport("benchNodeTableChurn", NODETABLE_SIZE - 1, benchSeconds() - start, "nodes");
+	std::cout << "benchNodeTableChurn: arena grew by " << table->getArenaUsed() - used << " slots\n";
+
+	delete table;
+}
+
+#define DISPATCH_BENCH_FRAMES 4096
+#define DISPATCH_BENCH_PASSES 200
+
+uint32_t benchBatches = 0;
+uint32_t benchBatchFrames = 0;
+
+uint8_t benchBatchSender(void *, uint8_t [], uint8_t *[], uint16_t [], uint8_t count) {
+	benchBatches++;
+	benchBatchFrames += count;
+	return count;
+}
+
+void benchNodeDispatcher() {
+	AttributeValue attrValues[DISPATCHER_MAX_NODES];
+	NodeDispatcher *dispatcher = new NodeDispatcher(NULL, benchBatchSender);
+	for(uint8_t n = 0; n < DISPATCHER_MAX_NODES; n++) {
+		attrValues[n].attr.groupID = 1;
+		attrValues[n].attr.attributeID = 0;
+		attrValues[n].attr.attributeNumber = 0;
+		attrValues[n].reader = benchAttributeReader;
+		attrValues[n].registered = true;
+		dispatcher->addNode(&(attrValues[n]), 1, NULL, NULL, 100 + 37 * n);
+	}
+
+	/* Single attribute requests for random nodes */
+	static uint8_t frames[DISPATCH_BENCH_FRAMES][16];
+	uint32_t random = 54321;
+	for(uint16_t f = 0; f < DISPATCH_BENCH_FRAMES; f++) {
+		random = random * 1103515245 + 12345;
+		uint16_t nodeID = 100 + 37 * ((random >> 16) % DISPATCHER_MAX_NODES);
+		uint8_t request[16] = { 12, 0, SUCCESS, 4, USHORT, 0, 0, USHORT, 1, 0, USHORT, 0, 0, USHORT, 0, 0 };
+		memcpy(&(request[5]), &nodeID, sizeof(nodeID));
+		memcpy(frames[f], request, sizeof(request));
+	}
+
+	uint32_t handled = 0;
+	double start = benchSeconds();
+	for(uint32_t pass = 0; pass < DISPATCH_BENCH_PASSES; pass++) {
+		for(uint16_t f = 0; f < DISPATCH_BENCH_FRAMES; f++) {
+			handled += dispatcher->dispatch('P', frames[f], 16);
+			if(dispatcher->getQueued() == DISPATCHER_QUEUE_FRAMES) {
+				dispatcher->flush();
+			}
+		}
+	}
+	dispatcher->flush();
+	double seconds = benchSeconds() - start;
+	benchReport("benchNodeDispatcher", (double)DISPATCH_BENCH_FRAMES * DISPATCH_BENCH_PASSES, seconds, "requests");
+	std::cout << "benchNodeDispatcher: " << DISPATCHER_MAX_NODES << " nodes, " << handled << " answered, "
+		<< (double)benchBatchFrames / benchBatches << " frames per batch\n";
+
+	delete dispatcher;
+}
+
+#define CODEC_BENCH_FRAMES 1024
+#define CODEC_BENCH_PASSES 2000
+
+void benchCodec() {
+	EMonCMS node(NULL, 0, NULL, NULL, NULL, 2);
+	static uint8_t frames[CODEC_BENCH_FRAMES][EMONCMS_MTU];
+	uint16_t lengths[CODEC_BENCH_FRAMES];
+	uint8_t valueTypes[] = { CHAR, UCHAR, SHORT, USHORT, INT, UINT, FLOAT, ULONG };
+	uint64_t value = 0x0123456789ABCDEFULL;
+	AttributeIdentifier ident = { 1, 2, 3 };
+	DataItem items[4];
+	node.attrIdentAsDataItems(&ident, items);
+	items[3].item = &value;
+
+	/* Posts of each value type */
+	uint32_t bytes = 0;
+	double start = benchSeconds();
+	for(uint32_t pass = 0; pass < CODEC_BENCH_PASSES; pass++) {
+		for(uint16_t f = 0; f < CODEC_BENCH_FRAMES; f++) {
+			items[3].type = valueTypes[f % sizeof(valueTypes)];
+			lengths[f] = node.attrBuilder(ATTR_POST, items, 4, frames[f]);
+			bytes += lengths[f];
+		}
+	}
+	benchReport("benchCodecBuild", (double)CODEC_BENCH_FRAMES * CODEC_BENCH_PASSES, benchSeconds() - start, "frames");
+
+	/* Parsing them back, as a gateway does */
+	DataItem parsed[5];
+	uint32_t valid = 0;
+	start = benchSeconds();
+	for(uint32_t pass = 0; pass < CODEC_BENCH_PASSES; pass++) {
+		for(uint16_t f = 0; f < CODEC_BENCH_FRAMES; f++) {
+			valid += EMonCMS::parseDataItems((HeaderInfo *)frames[f], &(frames[f][sizeof(HeaderInfo)]), parsed,
+				lengths[f] - sizeof(HeaderInfo));
+		}
+	}
+	benchReport("benchCodecParse", (double)CODEC_BENCH_FRAMES * CODEC_BENCH_PASSES, benchSeconds() - start, "frames");
+	benchSink = (float)bytes + valid + *(uint8_t *)parsed[4].item;
+}
+
+#define FUZZ_BENCH_FRAMES 4000000
+
+/**
+ * Sweeps the differential fuzzer over millions of random frames and
+ * reports the throughput of each codec path it checked
+ **/
+void benchCodecFuzz() {
+	CodecFuzzer fuzzer(0xC0DEC, 50);
+	const char *names[FUZZ_PATHS] = { "benchFuzzBuild", "benchFuzzReference", "benchFuzzParseItems",
+		"benchFuzzParsePacket", "benchFuzzNoise" };
+	uint32_t mismatches = fuzzer.run(FUZZ_BENCH_FRAMES);
+	for(uint8_t path = 0; path < FUZZ_PATHS; path++) {
+		benchReport(names[path], fuzzer.getPathCalls((FuzzPath)path), fuzzer.getPathSeconds((FuzzPath)path), "frames");
+	}
+	std::cout << "benchCodecFuzz: " << fuzzer.getFrames() << " frames, " << fuzzer.getRejected() << " rejected, "
+		<< mismatches << " mismatches\n";
+}
+
+#define DEDUP_BENCH_NODES 64
+#define DEDUP_BENCH_INTERVAL 1000 /** ms between posts from each node **/
+#define DEDUP_BENCH_MS 600000
+#define DEDUP_BENCH_CAPTURE 65536
+#define DEDUP_BENCH_PASSES 50
+#define DEDUP_BENCH_CHECKS 50000000
+
+uint8_t benchDedupFrames[DEDUP_BENCH_CAPTURE][EMONCMS_MTU];
+uint16_t benchDedupLengths[DEDUP_BENCH_CAPTURE];
+uint32_t benchDedupCount = 0;
+
+void benchDedupGateway(uint8_t type, uint8_t *buffer, uint16_t length, uint32_t) {
+	if(type == ATTR_POST && benchDedupCount < DEDUP_BENCH_CAPTURE) {
+		memcpy(benchDedupFrames[benchDedupCount], buffer, length);
+		benchDedupLengths[benchDedupCount++] = length;
+	}
+}
+
+/**
+ * Numbered posts from simulated nodes, a tenth heard twice, go through
+ * a DedupWindow in arrival order. Reports how many repeats it dropped
+ * and its cost per frame.
+ **/
+void benchDedup() {
+	AttributeValue attrValues[DEDUP_BENCH_NODES];
+	EMonCMS *nodes[DEDUP_BENCH_NODES];
+	RadioSimulator sim(38400, 20, 10, 4321);
+	sim.setDuplication(100, 300);
+	sim.setGateway(benchDedupGateway);
+	benchDedupCount = 0;
+	for(uint16_t n = 0; n < DEDUP_BENCH_NODES; n++) {
+		attrValues[n].attr.groupID = 1;
+		attrValues[n].attr.attributeID = 1;
+		attrValues[n].attr.attributeNumber = 0;
+		attrValues[n].reader = benchAttributeReader;
+		attrValues[n].registered = true;
+		nodes[n] = new EMonCMS(&(attrValues[n]), 1, RadioSimulator::nodeSender, NULL, NULL, n + 1);
+		nodes[n]->setPostSequence(true);
+		sim.addNode(nodes[n]);
+	}
+	/* Nodes post in turn, spread over the interval */
+	for(uint32_t t = 0; t < DEDUP_BENCH_MS; t += DEDUP_BENCH_INTERVAL / DEDUP_BENCH_NODES) {
+		nodes[(t / (DEDUP_BENCH_INTERVAL / DEDUP_BENCH_NODES)) % DEDUP_BENCH_NODES]->postAttribute(&(attrValues[0].attr));
+		sim.runUntil(t + DEDUP_BENCH_INTERVAL / DEDUP_BENCH_NODES);
+	}
+	sim.runUntil(DEDUP_BENCH_MS + 1000);
+
+	DedupWindow *dedup = NULL;
+	double start = benchSeconds();
+	for(uint32_t pass = 0; pass < DEDUP_BENCH_PASSES; pass++) {
+		delete dedup;
+		dedup = new DedupWindow();
+		for(uint32_t f = 0; f < benchDedupCount; f++) {
+			dedup->checkFrame(ATTR_POST, benchDedupFrames[f], benchDedupLengths[f]);
+		}
+	}
+	benchReport("benchDedupFrame", (double)benchDedupCount * DEDUP_BENCH_PASSES, benchSeconds() - start, "frames");
+	uint32_t dropped = dedup->getCount(DEDUP_DUPLICATE) + dedup->getCount(DEDUP_STALE);
+	std::cout << "benchDedupFrame: " << benchDedupCount << " posts received, " << sim.getFramesLost() << " lost, "
+		<< sim.getFramesDuplicated() << " duplicated (" << sim.getFramesDuplicated() * 100.0 / benchDedupCount << "%), "
+		<< dropped << " dropped, " << dedup->getCount(DEDUP_REORDERED) << " out of order\n";
+	delete dedup;
+
+	/* The window alone, sequence numbers jittered so some repeat or arrive late */
+	dedup = new DedupWindow();
+	uint32_t random = 2463534242UL;
+	start = benchSeconds();
+	for(uint32_t i = 0; i < DEDUP_BENCH_CHECKS; i++) {
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		dedup->check((i % DEDUP_MAX_NODES) + 1, i / DEDUP_MAX_NODES + (random & 7));
+	}
+	benchReport("benchDedupCheck", DEDUP_BENCH_CHECKS, benchSeconds() - start, "checks");
+	std::cout << "benchDedupCheck: " << dedup->getCount(DEDUP_DUPLICATE) * 100.0 / DEDUP_BENCH_CHECKS << "% duplicates\n";
+	delete dedup;
+
+	for(uint16_t n = 0; n < DEDUP_BENCH_NODES; n++) {
+		delete nodes[n];
+	}
+}
+
+#ifdef EMONCMS_COROUTINES
+#define CONVERSATION_BENCH_NODES 1000
+#define CONVERSATION_BENCH_POLLS 50
+#define CONVERSATION_BENCH_STACK (256 * 1024)
+
+uint32_t benchConversationsDone = 0;
+uint32_t benchConversationPolls = 0;
+
+/**
+ * Prints time, throughput and scheduling cost of a conversation benchmark
+ **/
+void conversationReport(const char *name, double seconds, struct rusage *before, uint32_t threads) {
+	struct rusage after;
+	getrusage(RUSAGE_SELF, &after);
+	benchReport(name, benchConversationPolls, seconds, "polls");
+	std::cout << name << ": " << CONVERSATION_BENCH_NODES << " nodes, " << threads << " threads, "
+		<< (after.ru_nvcsw - before->ru_nvcsw) + (after.ru_nivcsw - before->ru_nivcsw) << " context switches, "
+		<< (uint64_t)((after.ru_utime.tv_sec - before->ru_utime.tv_sec + after.ru_stime.tv_sec - before->ru_stime.tv_sec) * 1e6
+			+ (after.ru_utime.tv_usec - before->ru_utime.tv_usec) + (after.ru_stime.tv_usec - before->ru_stime.tv_usec))
+			/ (benchConversationPolls > 0 ? benchConversationPolls : 1)
+		<< " us CPU/poll\n";
+}
+
+AsyncTask benchConversation(EventLoop *loop, AsyncNode *node, AsyncGateway *gateway, AttributeIdentifier *ident) {
+	uint16_t nodeID = co_await node->registered();
+	for(uint32_t i = 0; i < CONVERSATION_BENCH_POLLS; i++) {
+		PollReply reply = co_await gateway->poll(nodeID, ident);
+		if(reply.status == SUCCESS) {
+			benchConversationPolls++;
+		}
+	}
+	if(++benchConversationsDone == CONVERSATION_BENCH_NODES) {
+		loop->stop();
+	}
+}
+
+void benchCoroutineConversations(AttributeValue *attrValue) {
+	static int fds[CONVERSATION_BENCH_NODES][2];
+	EventLoop loop(CONVERSATION_BENCH_NODES * 4 + 64, CONVERSATION_BENCH_NODES * 4);
+	AsyncGateway *gateway = new AsyncGateway(&loop, CONVERSATION_BENCH_NODES);
+	AsyncNode **nodes = new AsyncNode *[CONVERSATION_BENCH_NODES];
+	for(uint32_t n = 0; n < CONVERSATION_BENCH_NODES; n++) {
+		radioPair(fds[n], true);
+		gateway->addLink(fds[n][0]);
+		nodes[n] = new AsyncNode(&loop, fds[n][1], attrValue, 1);
+	}
+
+	benchConversationsDone = 0;
+	benchConversationPolls = 0;
+	struct rusage before;
+	getrusage(RUSAGE_SELF, &before);
+	double start = benchSeconds();
+	for(uint32_t n = 0; n < CONVERSATION_BENCH_NODES; n++) {
+		benchConversation(&loop, nodes[n], gateway, &(attrValue->attr));
+	}
+	loop.run(60000);
+	conversationReport("benchConversationsCoroutine", benchSeconds() - start, &before, 1);
+
+	for(uint32_t n = 0; n < CONVERSATION_BENCH_NODES; n++) {
+		delete nodes[n];
+		close(fds[n][0]);
+		close(fds[n][1]);
+	}
+	delete[] nodes;
+	delete gateway;
+}
+
+typedef struct {
+	int fd; /** this end of the pseudo radio **/
+	uint16_t nodeID; /** ID handed out by the gateway thread **/
+	AttributeValue *attrValue; /** attribute the node serves **/
+} ThreadConversation;
+
+uint16_t benchThreadSender(void *context, uint8_t type, uint8_t *buffer, uint16_t length) {
+	return radioSend(*(int *)context, type, buffer, length);
+}
+
+/**
+ * Blocking node: registers, then answers until the gateway hangs up
+ **/
+void *benchNodeThread(void *context) {
+	ThreadConversation *conversation = (ThreadConversation *)context;
+	EMonCMS node(conversation->attrValue, 1);
+	node.setSender(benchThreadSender, &(conversation->fd));
+	node.attrSender(NODE_REGISTER, NULL, 0);
+
+	uint8_t frame[EMONCMS_MTU] __attribute__((aligned(4)));
+	DataItem items[ASYNC_MAX_ITEMS];
+	uint8_t type;
+	int32_t length;
+	while((length = radioReceive(conversation->fd, &type, frame)) > 0) {
+		HeaderInfo *header = (HeaderInfo *)frame;
+		if(header->dataCount > ASYNC_MAX_ITEMS) {
+			continue;
+		}
+		uint16_t nodeID = node.getNodeID();
+		node.parseEMonCMSPacket(header, type, &(frame[sizeof(HeaderInfo)]), items);
+		if(nodeID == 0 && node.getNodeID() != 0) {
+			node.registerAttributes();
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Blocking gateway conversation with one node
+ **/
+void *benchGatewayThread(void *context) {
+	ThreadConversation *conversation = (ThreadConversation *)context;
+	uint8_t frame[EMONCMS_MTU] __attribute__((aligned(4)));
+	uint8_t type;
+
+	/* Node ID request, any attribute registration is skipped over below */
+	while(radioReceive(conversation->fd, &type, frame) > 0 && type != NODE_REGISTER);
+	uint8_t registered[sizeof(HeaderInfo) + 3] __attribute__((aligned(4))) = { 3, 0, SUCCESS, 1, USHORT };
+	memcpy(&(registered[sizeof(HeaderInfo) + 1]), &(conversation->nodeID), sizeof(uint16_t));
+	radioSend(conversation->fd, 'r', registered, sizeof(registered));
+
+	AttributeIdentifier *ident = &(conversation->attrValue->attr);
+	uint16_t values[4] = { conversation->nodeID, ident->groupID, ident->attributeID, ident->attributeNumber };
+	uint8_t request[sizeof(HeaderInfo) + 12] __attribute__((aligned(4))) = { 12, 0, SUCCESS, 4 };
+	for(uint8_t i = 0; i < 4; i++) {
+		request[sizeof(HeaderInfo) + i * 3] = USHORT;
+		memcpy(&(request[sizeof(HeaderInfo) + i * 3 + 1]), &(values[i]), sizeof(uint16_t));
+	}
+	uint32_t polled = 0;
+	for(uint32_t i = 0; i < CONVERSATION_BENCH_POLLS; i++) {
+		radioSend(conversation->fd, ATTR_POST, request, sizeof(request));
+		while(radioReceive(conversation->fd, &type, frame) > 0 && type != ATTR_POST_RESPONSE);
+		if(((HeaderInfo *)frame)->status == SUCCESS) {
+			polled++;
+		}
+	}
+	__sync_fetch_and_add(&benchConversationPolls, polled);
+	shutdown(conversation->fd, SHUT_RDWR);
+	return NULL;
+}
+
+void benchThreadConversations(AttributeValue *attrValue) {
+	static int fds[CONVERSATION_BENCH_NODES][2];
+	static ThreadConversation nodes[CONVERSATION_BENCH_NODES];
+	static ThreadConversation gateways[CONVERSATION_BENCH_NODES];
+	static pthread_t threads[CONVERSATION_BENCH_NODES * 2];
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, CONVERSATION_BENCH_STACK);
+
+	benchConversationPolls = 0;
+	struct rusage before;
+	getrusage(RUSAGE_SELF, &before);
+	double start = benchSeconds();
+	uint32_t started = 0;
+	for(uint32_t n = 0; n < CONVERSATION_BENCH_NODES; n++) {
+		radioPair(fds[n], false);
+		gateways[n].fd = fds[n][0];
+		gateways[n].nodeID = n + 1;
+		gateways[n].attrValue = attrValue;
+		nodes[n].fd = fds[n][1];
+		nodes[n].attrValue = attrValue;
+		if(pthread_create(&(threads[started]), &attr, benchGatewayThread, &(gateways[n])) == 0) {
+			started++;
+		}
+		if(pthread_create(&(threads[started]), &attr, benchNodeThread, &(nodes[n])) == 0) {
+			started++;
+		}
+	}
+	for(uint32_t t = 0; t < started; t++) {
+		pthread_join(threads[t], NULL);
+	}
+	conversationReport("benchConversationsThreads", benchSeconds() - start, &before, started);
+
+	for(uint32_t n = 0; n < CONVERSATION_BENCH_NODES; n++) {
+		close(fds[n][0]);
+		close(fds[n][1]);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+void benchConversations() {
+	AttributeValue attrValue;
+	attrValue.attr.groupID = 1;
+	attrValue.attr.attributeID = 0;
+	attrValue.attr.attributeNumber = 0;
+	attrValue.reader = benchAttributeReader;
+	attrValue.registered = false;
+	benchCoroutineConversations(&attrValue);
+	benchThreadConversations(&attrValue);
+}
+#endif
+
+int main(int argc, char *args[]) {
+	int total = 0;
+
+	BENCH(benchFeedStore);
+	BENCH(benchBulkUploader);
+	BENCH(benchAttributePoller);
+	BENCH(benchNodeTable);
+	BENCH(benchNodeDispatcher);
+	BENCH(benchCodec);
+	BENCH(benchCodecFuzz);
+	BENCH(benchDedup);
+#ifdef EMONCMS_COROUTINES
+	BENCH(benchConversations);
+#endif
+
+	std::cout << total << " benchmarks run\n";
+
+	return 0;
+}
+
+#endif
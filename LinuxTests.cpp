@@ -2,10 +2,26 @@
 
 #include "Debug.h"
 #include "EMonCMS.h"
+#include "FeedStore.h"
+#include "BulkUploader.h"
+#include "EmonHttpLink.h"
+#include "FakeEmonServer.h"
+#include "AttributePoller.h"
+#include "RadioSimulator.h"
+#include "NodeTable.h"
+#include "NodeDispatcher.h"
+#include "EMonAsync.h"
+#include "CodecFuzzer.h"
+#include "DedupWindow.h"
+#include "TestHelpers.h"
 
 #include <iostream>
 #include <fstream>
 #include <cstring>
+#include <cmath>
+#include <cstdlib>
+#include <dirent.h>
+#include <unistd.h>
 
 #define TEST(x) if(x()) { \
 		passCount++; \
@@ -141,6 +157,7 @@ bool fakeAttributeReader(AttributeIdentifier *attr, DataItem *item) {
 uint16_t fakeNetworkSender(uint8_t type, uint8_t *buffer, uint16_t length) {
 	memcpy(tmpBuffer, buffer, length);
 	bufferSize = length;
+	return length;
 }
 
 bool testAttributePostResponse() {
@@ -166,8 +183,8 @@ bool testAttributePostResponse() {
 		return false;
 	}
 	
-	unsigned char cmpBuffer[] = { 0x11, 0x0, 0x0, 0x5, 0x5, 0x2, 0x0, 0x5, 0x0, 0x0,
-		0x5, 0xa, 0x0, 0x5, 0x14, 0x0, 0x6, 0xfa, 0x92, 0x3, 0x0 };
+	unsigned char cmpBuffer[] = { 0x11, 0x0, 0x0, 0x5, 0x5, 0x2, 0x0, 0x5, 0xa, 0x0,
+		0x5, 0x14, 0x0, 0x5, 0x28, 0x0, 0x6, 0xfa, 0x92, 0x3, 0x0 };
 	if(memcmp(cmpBuffer, tmpBuffer, 21) != 0) {
 		LOG("Error: expected output of testing fetch attribute request fails\n");
 		return false;
@@ -208,6 +225,1224 @@ bool testBuildAttributeRegister() {
 	return true;
 }
 
+/**
+ * Body of testFeedStorePost, so the directory is removed however it exits
+ **/
+bool checkFeedStorePost(const char *directory) {
+	EMonCMS emon(NULL, 0, NULL, NULL, NULL, 7);
+	AttributeIdentifier ident;
+	ident.groupID = 10;
+	ident.attributeID = 20;
+	ident.attributeNumber = 1;
+
+	{
+		FeedStore store(directory, 10);
+		uint32_t times[] = { 1003, 1025, 1031 };
+		int values[] = { 100, 250, 300 };
+		for(int i = 0; i < 3; i++) {
+			DataItem postItems[4];
+			emon.attrIdentAsDataItems(&ident, postItems);
+			postItems[3].type = INT;
+			postItems[3].item = &(values[i]);
+
+			uint8_t postBuffer[TMP_BUFFER_SIZE];
+			emon.attrBuilder(ATTR_POST, postItems, 4, postBuffer);
+
+			HeaderInfo *header = (HeaderInfo *)postBuffer;
+			DataItem items[header->dataCount];
+			emon.parseDataItems(header, &(postBuffer[sizeof(HeaderInfo)]), items);
+			if(!store.post(header, items, times[i])) {
+				std::cout << "ERR: feed store rejected post\n";
+				return false;
+			}
+		}
+	}
+
+	/* Reopen to check the data made it to the file */
+	FeedStore store(directory, 10);
+	Feed *feed = store.open(7, &ident);
+	if(feed == NULL || feed->header->startTime != 1000 || feed->header->npoints != 4) {
+		std::cout << "ERR: feed header not persisted\n";
+		return false;
+	}
+
+	uint32_t count = 0;
+	const float *values = store.range(feed, 0, 2000, &count);
+	if(count != 4 || values[0] != 100 || !std::isnan(values[1]) || values[2] != 250 || values[3] != 300) {
+		std::cout << "ERR: feed range does not match posted values\n";
+		return false;
+	}
+
+	if(store.value(feed, 1029) != 250 || !std::isnan(store.value(feed, 999))) {
+		std::cout << "ERR: feed value lookup wrong\n";
+		return false;
+	}
+
+	/* A bogus timestamp far ahead must not grow the file */
+	uint32_t capacity = feed->capacity;
+	if(store.append(feed, 0xFFFFFFFF, 1) || store.append(feed, 1031 + FEEDSTORE_MAX_GAP + 10, 1)
+			|| feed->capacity != capacity || !store.append(feed, 1031 + FEEDSTORE_MAX_GAP, 1)) {
+		std::cout << "ERR: feed gap not bounded\n";
+		return false;
+	}
+
+	/* The identifier items must be USHORTs */
+	uint8_t node = 7;
+	uint16_t attr = 1;
+	float reading = 5;
+	DataItem badItems[5] = { { UCHAR, &node }, { USHORT, &attr }, { USHORT, &attr }, { USHORT, &attr }, { FLOAT, &reading } };
+	HeaderInfo badHeader = { 0, SUCCESS, 5 };
+	if(store.post(&badHeader, badItems, 1040)) {
+		std::cout << "ERR: feed store took post with a bad identifier\n";
+		return false;
+	}
+
+	/* With a DedupWindow a repeated numbered post is not stored again */
+	DedupWindow dedup;
+	store.setDedup(&dedup);
+	uint16_t nodeID = 7;
+	uint32_t sequence = 1;
+	DataItem seqItems[6] = { { USHORT, &nodeID }, { USHORT, &attr }, { USHORT, &attr }, { USHORT, &attr },
+		{ FLOAT, &reading }, { UINT, &sequence } };
+	HeaderInfo seqHeader = { 0, SUCCESS, 6 };
+	AttributeIdentifier seqIdent = { 1, 1, 1 };
+	if(!store.post(&seqHeader, seqItems, 2000) || !store.post(&seqHeader, seqItems, 2010)) {
+		std::cout << "ERR: feed store rejected a numbered post\n";
+		return false;
+	}
+	Feed *seqFeed = store.open(7, &seqIdent);
+	if(seqFeed == NULL || store.value(seqFeed, 2000) != 5 || !std::isnan(store.value(seqFeed, 2010))
+			|| dedup.getCount(DEDUP_DUPLICATE) != 1) {
+		std::cout << "ERR: feed store stored a repeated post\n";
+		return false;
+	}
+
+	/* A frame the gateway's window already passed is stored on its verdict, not checked again */
+	DedupWindow gateway;
+	AttributeIdentifier gatewayIdent = { 2, 1, 1 };
+	uint32_t frameSequence = 1;
+	DataItem frameItems[5];
+	emon.attrIdentAsDataItems(&gatewayIdent, frameItems);
+	frameItems[3].type = FLOAT;
+	frameItems[3].item = &reading;
+	frameItems[4].type = UINT;
+	frameItems[4].item = &frameSequence;
+	uint8_t frame[TMP_BUFFER_SIZE];
+	uint16_t frameSize = emon.attrBuilder(ATTR_POST, frameItems, 5, frame);
+	HeaderInfo *frameHeader = (HeaderInfo *)frame;
+	DataItem parsed[DEDUP_POST_ITEMS];
+	uint32_t storeChecks = dedup.getCount(DEDUP_NEW) + dedup.getCount(DEDUP_DUPLICATE);
+	for(uint32_t i = 0; i < 2; i++) {
+		uint8_t verdict = gateway.checkFrame(ATTR_POST, frame, frameSize);
+		if(!EMonCMS::parseDataItems(frameHeader, &(frame[sizeof(HeaderInfo)]), parsed, frameSize - sizeof(HeaderInfo))
+				|| !store.post(frameHeader, parsed, 2000 + 10 * i, verdict)) {
+			std::cout << "ERR: feed store rejected a post the gateway checked\n";
+			return false;
+		}
+	}
+	Feed *gatewayFeed = store.open(7, &gatewayIdent);
+	if(gatewayFeed == NULL || store.value(gatewayFeed, 2000) != 5 || !std::isnan(store.value(gatewayFeed, 2010))
+			|| gateway.getCount(DEDUP_DUPLICATE) != 1
+			|| dedup.getCount(DEDUP_NEW) + dedup.getCount(DEDUP_DUPLICATE) != storeChecks) {
+		std::cout << "ERR: feed store did not follow the gateway's verdict\n";
+		return false;
+	}
+
+	/* A header with no interval is started again rather than divided by */
+	seqFeed->header->interval = 0;
+	store.close();
+	seqFeed = store.open(7, &seqIdent);
+	if(seqFeed == NULL || seqFeed->header->interval != 10 || seqFeed->header->npoints != 0
+			|| !std::isnan(store.value(seqFeed, 2000))) {
+		std::cout << "ERR: feed with no interval not started again\n";
+		return false;
+	}
+
+	return true;
+}
+
+bool testFeedStorePost() {
+	char directory[] = "/tmp/emoncmsfeedsXXXXXX";
+	if(mkdtemp(directory) == NULL) {
+		std::cout << "ERR: could not create feed directory\n";
+		return false;
+	}
+	bool passed = checkFeedStorePost(directory);
+	removeFeedDirectory(directory);
+	return passed;
+}
+
+char capturedPayload[BULK_BUFFER_SIZE + 1];
+
+uint8_t capturingBulkSender(void *, const char *payloads[], uint16_t lengths[], uint8_t count) {
+	memcpy(capturedPayload, payloads[0], lengths[0]);
+	capturedPayload[lengths[0]] = '\0';
+	return count;
+}
+
+bool testBulkUploaderPayload() {
+	BulkUploader uploader(capturingBulkSender, NULL, 1000);
+	AttributeIdentifier ident;
+	ident.groupID = 10;
+	ident.attributeID = 20;
+	ident.attributeNumber = 1;
+
+	int power = -1500;
+	float temperature = 21.25f;
+	DataItem powerItem = { INT, &power };
+	DataItem temperatureItem = { FLOAT, &temperature };
+
+	uploader.add(5, &ident, &powerItem, 1700000000, 0);
+	ident.attributeID = 21;
+	uploader.add(5, &ident, &temperatureItem, 1700000000, 0);
+	uploader.add(6, &ident, &temperatureItem, 1700000000, 0);
+
+	/* Nothing is sent until the payload is old enough */
+	capturedPayload[0] = '\0';
+	if(uploader.poll(999) != 0 || capturedPayload[0] != '\0') {
+		std::cout << "ERR: bulk payload sent before its age\n";
+		return false;
+	}
+	if(uploader.poll(1000) != 1) {
+		std::cout << "ERR: bulk payload not sent at its age\n";
+		return false;
+	}
+
+	const char *expected = "data=[[1700000000,5,{\"10_20_1\":-1500,\"10_21_1\":21.25}],"
+		"[1700000000,6,{\"10_21_1\":21.25}]]";
+	if(strcmp(capturedPayload, expected) != 0) {
+		std::cout << "ERR: bulk payload " << capturedPayload << "\n";
+		return false;
+	}
+
+	if(uploader.getReadingsForwarded() != 3) {
+		return false;
+	}
+
+	/* A post whose identifier isn't all USHORTs is refused before anything is read from it */
+	unsigned char shortNode = 7;
+	unsigned short group = 10, attribute = 20, number = 1;
+	HeaderInfo postHeader = { 0, SUCCESS, 5 };
+	DataItem postItems[5] = { { UCHAR, &shortNode }, { USHORT, &group }, { USHORT, &attribute },
+		{ USHORT, &number }, { INT, &power } };
+	if(uploader.post(&postHeader, postItems, 1700000001, 2000)) {
+		std::cout << "ERR: bulk post with a UCHAR node ID accepted\n";
+		return false;
+	}
+	unsigned short node = 7;
+	postItems[0].type = USHORT;
+	postItems[0].item = &node;
+	postItems[3].type = INT;
+	if(uploader.post(&postHeader, postItems, 1700000001, 2000)) {
+		std::cout << "ERR: bulk post with an INT attribute number accepted\n";
+		return false;
+	}
+	postItems[3].type = USHORT;
+	return uploader.post(&postHeader, postItems, 1700000001, 2000);
+}
+
+bool testBulkUploaderRetry() {
+	FakeEmonServer server(1);
+	uint16_t port = server.start();
+	if(port == 0) {
+		std::cout << "ERR: could not start fake server\n";
+		return false;
+	}
+
+	EmonHttpLink link("127.0.0.1", port, "/input/bulk.json?apikey=test");
+	BulkUploader uploader(EmonHttpLink::sender, &link, 1000);
+	AttributeIdentifier ident;
+	ident.groupID = 1;
+	ident.attributeID = 2;
+	ident.attributeNumber = 3;
+	unsigned short value = 42;
+	DataItem item = { USHORT, &value };
+	uploader.add(9, &ident, &item, 100, 0);
+
+	/* The server fails the first request, the retry waits for its delay */
+	if(uploader.flush(0) != 0 || uploader.poll(BULK_RETRY_DELAY - 1) != 0) {
+		std::cout << "ERR: bulk payload accepted by failing server\n";
+		return false;
+	}
+	if(uploader.poll(BULK_RETRY_DELAY) != 1) {
+		std::cout << "ERR: bulk payload not retried\n";
+		return false;
+	}
+
+	char body[128];
+	server.getLastBody(body, sizeof(body));
+	server.stop();
+	if(strcmp(body, "data=[[100,9,{\"1_2_3\":42}]]") != 0 || server.getReadings() != 1) {
+		std::cout << "ERR: fake server received " << body << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+uint8_t orderedCalls = 0;
+char orderedBodies[4][64];
+uint8_t orderedCount = 0;
+
+uint8_t failFirstBulkSender(void *, const char *payloads[], uint16_t lengths[], uint8_t count) {
+	if(orderedCalls++ == 0) {
+		return 0;
+	}
+	for(uint8_t i = 0; i < count && orderedCount < 4; i++) {
+		memcpy(orderedBodies[orderedCount], payloads[i], lengths[i]);
+		orderedBodies[orderedCount++][lengths[i]] = '\0';
+	}
+	return count;
+}
+
+bool testBulkUploaderOrder() {
+	BulkUploader uploader(failFirstBulkSender, NULL, 1000);
+	AttributeIdentifier ident = { 1, 2, 3 };
+	unsigned short value = 1;
+	DataItem item = { USHORT, &value };
+	orderedCalls = 0;
+	orderedCount = 0;
+
+	/* The first payload fails, the second must not overtake it */
+	uploader.add(9, &ident, &item, 100, 0);
+	if(uploader.flush(0) != 0) {
+		std::cout << "ERR: first bulk payload not failed\n";
+		return false;
+	}
+	value = 2;
+	uploader.add(9, &ident, &item, 110, 10);
+	if(uploader.flush(10) != 0 || orderedCount != 0) {
+		std::cout << "ERR: bulk payload overtook one backing off\n";
+		return false;
+	}
+	if(uploader.poll(BULK_RETRY_DELAY) != 2 || orderedCount != 2
+			|| strcmp(orderedBodies[0], "data=[[100,9,{\"1_2_3\":1}]]") != 0
+			|| strcmp(orderedBodies[1], "data=[[110,9,{\"1_2_3\":2}]]") != 0) {
+		std::cout << "ERR: bulk payloads not sent in order\n";
+		return false;
+	}
+	return true;
+}
+
+AttributePoller *testPoller = NULL;
+uint16_t pollSuccesses = 0;
+uint16_t pollUnsupported = 0;
+uint16_t pollOther = 0;
+
+void testPollGateway(uint8_t type, uint8_t *buffer, uint16_t length, uint32_t now) {
+	testPoller->handleResponse(type, buffer, length, now);
+}
+
+void testPollResult(uint16_t, AttributeIdentifier *attr, uint8_t status, DataItem *value) {
+	if(status == SUCCESS && value != NULL && value->type == INT
+			&& memcmp(value->item, &globalFakeReading, sizeof(int)) == 0) {
+		pollSuccesses++;
+	} else if(status == UNSUPPORTED_ATTRIBUTE && attr->attributeID == 99) {
+		pollUnsupported++;
+	} else {
+		pollOther++;
+	}
+}
+
+/**
+ * Polls two simulated nodes over a lossy channel
+ * @param batch polls coalesced per request
+ **/
+bool runAttributePollerSimulation(uint8_t batch) {
+	AttributeValue attrValues[2][2];
+	for(int n = 0; n < 2; n++) {
+		for(int a = 0; a < 2; a++) {
+			attrValues[n][a].attr.groupID = 1;
+			attrValues[n][a].attr.attributeID = a;
+			attrValues[n][a].attr.attributeNumber = 0;
+			attrValues[n][a].reader = fakeAttributeReader;
+			attrValues[n][a].registered = true;
+		}
+	}
+
+	/* 10% loss so some polls have to be resent */
+	RadioSimulator sim(38400, 20, 100, 1234);
+	EMonCMS nodeA(attrValues[0], 2, RadioSimulator::nodeSender, NULL, NULL, 11);
+	EMonCMS nodeB(attrValues[1], 2, RadioSimulator::nodeSender, NULL, NULL, 12);
+	sim.addNode(&nodeA);
+	sim.addNode(&nodeB);
+	sim.setGateway(testPollGateway);
+
+	AttributePoller poller(RadioSimulator::gatewaySender, testPollResult, 4, 50, batch);
+	testPoller = &poller;
+	pollSuccesses = pollUnsupported = pollOther = 0;
+
+	for(uint16_t node = 11; node <= 12; node++) {
+		for(uint16_t round = 0; round < 5; round++) {
+			for(uint16_t a = 0; a < 3; a++) {
+				AttributeIdentifier ident = { 1, (uint16_t)(a == 2 ? 99 : a), 0 };
+				if(!poller.request(node, &ident)) {
+					std::cout << "ERR: poll table full\n";
+					return false;
+				}
+			}
+		}
+	}
+
+	while(poller.getPending() > 0 && sim.now() < 60000) {
+		poller.poll(sim.now());
+		sim.runUntil(sim.now() + 1);
+	}
+	testPoller = NULL;
+
+	if(pollSuccesses != 20 || pollUnsupported != 10 || pollOther != 0) {
+		std::cout << "ERR: poll results " << pollSuccesses << " ok, " << pollUnsupported
+			<< " unsupported, " << pollOther << " other\n";
+		return false;
+	}
+	if(poller.getRetries() == 0 || poller.getTimeout(11) >= POLLER_INITIAL_RTO) {
+		std::cout << "ERR: poller did not resend or adapt its timeout\n";
+		return false;
+	}
+
+	return true;
+}
+
+bool testAttributePollerSimulated() {
+	return runAttributePollerSimulation(1);
+}
+
+bool testAttributePollerBatched() {
+	return runAttributePollerSimulation(3);
+}
+
+#define CAPTURE_FRAMES 4
+uint8_t capturedFrames[CAPTURE_FRAMES][EMONCMS_MTU];
+uint8_t capturedTypes[CAPTURE_FRAMES];
+uint16_t capturedCount = 0;
+
+uint16_t capturingNetworkSender(uint8_t type, uint8_t *buffer, uint16_t length) {
+	if(capturedCount < CAPTURE_FRAMES) {
+		memcpy(capturedFrames[capturedCount], buffer, length);
+		capturedTypes[capturedCount] = type;
+		capturedCount++;
+	}
+	return length;
+}
+
+/**
+ * @return node ID polled by a captured request
+ **/
+uint16_t capturedPollNode(uint8_t frame) {
+	uint16_t nodeID;
+	memcpy(&nodeID, &(capturedFrames[frame][sizeof(HeaderInfo) + 1]), sizeof(nodeID));
+	return nodeID;
+}
+
+bool testAttributePollerFairness() {
+	AttributeIdentifier ident = { 1, 0, 0 };
+
+	/* One frame per ms: node 2 is polled before node 1's queue drains */
+	AttributePoller poller(capturingNetworkSender, NULL, 4, 1000);
+	for(uint8_t i = 0; i < 3; i++) {
+		poller.request(1, &ident);
+	}
+	poller.request(2, &ident);
+	capturedCount = 0;
+	for(uint32_t now = 0; now < 4; now++) {
+		poller.poll(now);
+	}
+	if(capturedCount != 4 || capturedPollNode(0) != 1 || capturedPollNode(1) != 2
+			|| capturedPollNode(2) != 1 || capturedPollNode(3) != 1) {
+		std::cout << "ERR: poller did not take turns between nodes\n";
+		return false;
+	}
+
+	/* A long gap at a high rate must fill the bucket, not wrap it to 0 */
+	AttributePoller fast(capturingNetworkSender, NULL, 4, 32768);
+	fast.request(1, &ident);
+	fast.request(1, &ident);
+	capturedCount = 0;
+	fast.poll(0);
+	fast.poll(131072);
+	if(capturedCount != 3) {
+		std::cout << "ERR: poller tokens overflowed, sent " << capturedCount << "\n";
+		return false;
+	}
+	return true;
+}
+
+bool testMultiAttributeRequest() {
+	/* Group 1 has attributes 0 to 5, group 2 has attribute 0 */
+	AttributeValue attrValues[7];
+	for(int i = 0; i < 7; i++) {
+		attrValues[i].attr.groupID = i < 6 ? 1 : 2;
+		attrValues[i].attr.attributeID = i < 6 ? i : 0;
+		attrValues[i].attr.attributeNumber = 0;
+		attrValues[i].reader = fakeAttributeReader;
+		attrValues[i].registered = true;
+	}
+	EMonCMS emon(attrValues, 7, capturingNetworkSender, NULL, NULL, 2);
+
+	/* Request 2/0/0, the unsupported 3/0/0 and all of group 1 */
+	HeaderInfo header;
+	header.status = SUCCESS;
+	header.dataCount = 10;
+	header.dataSize = 30;
+	unsigned char request[30] = { USHORT, 0x02, 0x00,
+		USHORT, 0x02, 0x00, USHORT, 0x00, 0x00, USHORT, 0x00, 0x00,
+		USHORT, 0x03, 0x00, USHORT, 0x00, 0x00, USHORT, 0x00, 0x00,
+		USHORT, 0x01, 0x00, USHORT, 0xff, 0xff, USHORT, 0x00, 0x00 };
+	DataItem items[10];
+	capturedCount = 0;
+	if(!emon.parseEMonCMSPacket(&header, 'P', request, items)) {
+		std::cout << "ERR: multi attribute request not handled\n";
+		return false;
+	}
+
+	/* 8 answers of 16 bytes, or 11 for the failure, packed 3 to a frame */
+	if(capturedCount != 3 || capturedTypes[0] != ATTR_MULTI_RESPONSE) {
+		std::cout << "ERR: expected 3 multi response frames, got " << capturedCount << "\n";
+		return false;
+	}
+
+	unsigned char first[] = { 0x2e, 0x0, 0x0, 0xf, 0x5, 0x2, 0x0,
+		0x5, 0x2, 0x0, 0x5, 0x0, 0x0, 0x5, 0x0, 0x0, 0x3, 0x0, 0x6, 0xfa, 0x92, 0x3, 0x0,
+		0x5, 0x3, 0x0, 0x5, 0x0, 0x0, 0x5, 0x0, 0x0, 0x3, 0x86,
+		0x5, 0x1, 0x0, 0x5, 0x0, 0x0, 0x5, 0x0, 0x0, 0x3, 0x0, 0x6, 0xfa, 0x92, 0x3, 0x0 };
+	if(memcmp(capturedFrames[0], first, sizeof(first)) != 0) {
+		std::cout << "ERR: first multi response frame does not match\n";
+		return false;
+	}
+
+	HeaderInfo *last = (HeaderInfo *)capturedFrames[2];
+	if(last->dataCount != 11 || last->dataSize != 35) {
+		std::cout << "ERR: last multi response frame should hold 2 answers\n";
+		return false;
+	}
+
+	/* A UCHAR in any triple, or in a single request, is refused with a failure */
+	unsigned char mixed[] = { USHORT, 0x02, 0x00,
+		USHORT, 0x02, 0x00, USHORT, 0x00, 0x00, USHORT, 0x00, 0x00,
+		USHORT, 0x01, 0x00, UCHAR, 0x00, USHORT, 0x00, 0x00 };
+	unsigned char single[] = { USHORT, 0x02, 0x00, USHORT, 0x01, 0x00, UCHAR, 0x00, USHORT, 0x00, 0x00 };
+	HeaderInfo mixedHeader = { sizeof(mixed), SUCCESS, 7 };
+	HeaderInfo singleHeader = { sizeof(single), SUCCESS, 4 };
+	for(int i = 0; i < 2; i++) {
+		capturedCount = 0;
+		bool handled = i == 0 ? emon.parseEMonCMSPacket(&mixedHeader, 'P', mixed, items)
+			: emon.parseEMonCMSPacket(&singleHeader, 'P', single, items);
+		HeaderInfo *failure = (HeaderInfo *)capturedFrames[0];
+		if(handled || capturedCount != 1 || capturedTypes[0] != ATTR_POST_RESPONSE
+			|| failure->status != FAILURE || failure->dataCount != 0) {
+			std::cout << "ERR: attribute request with a UCHAR identifier not refused\n";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool testFramePool() {
+	FramePool pool;
+	uint8_t *frames[FRAMEPOOL_FRAMES];
+	for(int i = 0; i < FRAMEPOOL_FRAMES; i++) {
+		frames[i] = pool.acquire();
+		if(frames[i] == NULL) {
+			std::cout << "ERR: frame pool ran out early\n";
+			return false;
+		}
+	}
+	if(pool.acquire() != NULL || pool.getInUse() != FRAMEPOOL_FRAMES || frames[0] == frames[1]) {
+		std::cout << "ERR: frame pool handed out more frames than it has\n";
+		return false;
+	}
+	pool.release(frames[0]);
+	pool.release(frames[0] + 1);
+	if(pool.acquire() != frames[0] || pool.getHighWater() != FRAMEPOOL_FRAMES) {
+		std::cout << "ERR: released frame not reused\n";
+		return false;
+	}
+
+	/* A frame released twice from a partly used pool is only freed once */
+	pool.release(frames[1]);
+	pool.release(frames[1]);
+	if(pool.getInUse() != FRAMEPOOL_FRAMES - 1 || pool.acquire() != frames[1] || pool.acquire() != NULL) {
+		std::cout << "ERR: double release freed a frame twice\n";
+		return false;
+	}
+
+	/* A retained frame needs one release per reference */
+	if(!pool.retain(frames[1]) || pool.retain(frames[0] + 1)) {
+		std::cout << "ERR: frame pool retain wrong\n";
+		return false;
+	}
+	pool.release(frames[1]);
+	if(pool.getInUse() != FRAMEPOOL_FRAMES) {
+		std::cout << "ERR: retained frame freed by its first release\n";
+		return false;
+	}
+	pool.release(frames[1]);
+	if(pool.getInUse() != FRAMEPOOL_FRAMES - 1 || pool.retain(frames[1])) {
+		std::cout << "ERR: retained frame not freed by its last release\n";
+		return false;
+	}
+
+	/* Sending builds into one pooled frame and gives it back */
+	AttributeValue attrValue;
+	attrValue.attr.groupID = 1;
+	attrValue.attr.attributeID = 2;
+	attrValue.attr.attributeNumber = 3;
+	attrValue.reader = fakeAttributeReader;
+	attrValue.registered = true;
+	EMonCMS emon(&attrValue, 1, capturingNetworkSender, NULL, NULL, 2);
+	capturedCount = 0;
+	if(emon.postAttribute(&(attrValue.attr)) != 21 || capturedCount != 1) {
+		std::cout << "ERR: post not sent from pooled frame\n";
+		return false;
+	}
+	if(emon.getFramePool()->getInUse() != 0 || emon.getFramePool()->getHighWater() != 1) {
+		std::cout << "ERR: post did not return its frame\n";
+		return false;
+	}
+
+	/* Packets over the MTU are refused rather than overflowing a frame */
+	DataItem items[25];
+	uint16_t value = 0;
+	for(int i = 0; i < 25; i++) {
+		items[i].type = USHORT;
+		items[i].item = &value;
+	}
+	if(emon.attrSender(NODE_REGISTER, items, 25) != 0 || capturedCount != 1 || emon.getFramePool()->getInUse() != 0) {
+		std::cout << "ERR: oversized packet was sent\n";
+		return false;
+	}
+
+	return true;
+}
+
+uint8_t batchCalls = 0;
+
+uint8_t capturingBatchSender(void *, uint8_t types[], uint8_t *frames[], uint16_t lengths[], uint8_t count) {
+	batchCalls++;
+	for(uint8_t i = 0; i < count; i++) {
+		capturingNetworkSender(types[i], frames[i], lengths[i]);
+	}
+	return count;
+}
+
+bool testNodeDispatcher() {
+	AttributeValue attrValues[3];
+	for(int i = 0; i < 3; i++) {
+		attrValues[i].attr.groupID = 1;
+		attrValues[i].attr.attributeID = i;
+		attrValues[i].attr.attributeNumber = 0;
+		attrValues[i].reader = fakeAttributeReader;
+		attrValues[i].registered = false;
+	}
+	SimulatedClock clock(REGISTERREQUESTTIMEOUT + 1);
+	NodeDispatcher dispatcher(NULL, capturingBatchSender);
+	for(int i = 0; i < 3; i++) {
+		dispatcher.addNode(&(attrValues[i]), 1)->setClock(&clock);
+	}
+
+	/* All three ask for a node ID in one batch */
+	capturedCount = 0;
+	batchCalls = 0;
+	dispatcher.registerNodes();
+	if(batchCalls != 1 || capturedCount != 3 || capturedTypes[2] != NODE_REGISTER) {
+		std::cout << "ERR: node register requests not batched\n";
+		return false;
+	}
+
+	/* IDs are handed out in the order they were asked for */
+	uint8_t frame[7] = { 3, 0, SUCCESS, 1, USHORT, 0, 0 };
+	for(uint8_t i = 0; i < 3; i++) {
+		frame[5] = 10 + i;
+		if(!dispatcher.dispatch('r', frame, sizeof(frame))) {
+			std::cout << "ERR: node ID response not dispatched\n";
+			return false;
+		}
+	}
+	if(dispatcher.dispatch('r', frame, sizeof(frame))) {
+		std::cout << "ERR: unrequested node ID response dispatched\n";
+		return false;
+	}
+	for(uint8_t i = 0; i < 3; i++) {
+		if(dispatcher.getNode(i)->getNodeID() != 10 + i || dispatcher.findNode(10 + i) != dispatcher.getNode(i)) {
+			std::cout << "ERR: node " << (int)i << " got the wrong ID\n";
+			return false;
+		}
+	}
+
+	/* 1/1/0 is answered by the second node, the third doesn't have it */
+	uint8_t request[16] = { 12, 0, SUCCESS, 4, USHORT, 12, 0, USHORT, 1, 0, USHORT, 1, 0, USHORT, 0, 0 };
+	if(!dispatcher.dispatch('P', request, sizeof(request))) {
+		std::cout << "ERR: request for a missing attribute not answered\n";
+		return false;
+	}
+	request[5] = 11;
+	if(!dispatcher.dispatch('P', request, sizeof(request)) || dispatcher.getQueued() != 2) {
+		std::cout << "ERR: attribute requests not routed and queued\n";
+		return false;
+	}
+	request[5] = 99;
+	if(dispatcher.dispatch('P', request, sizeof(request))) {
+		std::cout << "ERR: request for an unknown node dispatched\n";
+		return false;
+	}
+
+	/* Queued responses stay in their nodes' pools until sent */
+	FramePool *pool = dispatcher.getNode(1)->getFramePool();
+	if(pool->getInUse() != 1) {
+		std::cout << "ERR: queued response not held in its node's pool\n";
+		return false;
+	}
+	capturedCount = 0;
+	if(dispatcher.flush() != 2 || batchCalls != 2 || capturedTypes[1] != ATTR_POST_RESPONSE
+			|| capturedFrames[0][2] != UNSUPPORTED_ATTRIBUTE || capturedFrames[0][5] != 12 || capturedFrames[1][5] != 11
+			|| pool->getInUse() != 0) {
+		std::cout << "ERR: responses not sent for the right nodes\n";
+		return false;
+	}
+
+	/* Three of 1/1/0 and three of the missing 1/9/0 split over two multi
+	 *  responses, the second filling the node's pool and flushing both.
+	 */
+	uint8_t multi[61] = { 57, 0, SUCCESS, 19, USHORT, 11, 0 };
+	for(uint8_t i = 0; i < 6; i++) {
+		uint8_t triple[9] = { USHORT, 1, 0, USHORT, (uint8_t)(i < 3 ? 1 : 9), 0, USHORT, 0, 0 };
+		memcpy(&(multi[7 + 9 * i]), triple, sizeof(triple));
+	}
+	capturedCount = 0;
+	if(!dispatcher.dispatch('P', multi, sizeof(multi)) || batchCalls != 3 || dispatcher.getQueued() != 0
+			|| capturedCount != 2 || pool->getInUse() != 0) {
+		std::cout << "ERR: multi responses not flushed when the node's pool filled\n";
+		return false;
+	}
+	if(((HeaderInfo *)capturedFrames[0])->dataCount != 16 || ((HeaderInfo *)capturedFrames[1])->dataCount != 13
+			|| capturedFrames[1][7 + 9 + 1] != UNSUPPORTED_ATTRIBUTE) {
+		std::cout << "ERR: first multi response overwritten while queued\n";
+		return false;
+	}
+
+	return true;
+}
+
+bool testNodeTableFrames() {
+	NodeTable *table = new NodeTable(1024);
+	uint16_t nodeID = table->allocate();
+	if(nodeID == 0 || table->getState(nodeID) != NODE_ASSIGNED) {
+		std::cout << "ERR: node table did not assign an ID\n";
+		delete table;
+		return false;
+	}
+
+	/* Register 10 attributes through frames from the node */
+	EMonCMS emon(NULL, 0, NULL, NULL, NULL, nodeID);
+	AttributeIdentifier ident;
+	DataItem items[4];
+	uint8_t frame[TMP_BUFFER_SIZE];
+	int value = 5;
+	for(uint16_t i = 0; i < 10; i++) {
+		ident.groupID = 1;
+		ident.attributeID = i;
+		ident.attributeNumber = 0;
+		emon.attrIdentAsDataItems(&ident, items);
+		items[3].type = INT;
+		items[3].item = &value;
+		uint16_t size = emon.attrBuilder(ATTR_REGISTER, items, 4, frame);
+		if(!table->handleFrame(ATTR_REGISTER, frame, size, 100 + i)) {
+			std::cout << "ERR: node table rejected registration\n";
+			delete table;
+			return false;
+		}
+	}
+
+	/* Posts of registered attributes are known, others are not */
+	ident.attributeID = 3;
+	uint16_t size = emon.attrBuilder(ATTR_POST, items, 4, frame);
+	bool known = table->handleFrame(ATTR_POST, frame, size, 200);
+	ident.attributeID = 30;
+	size = emon.attrBuilder(ATTR_POST, items, 4, frame);
+	bool unknown = table->handleFrame(ATTR_POST, frame, size, 201);
+	if(!known || unknown || table->getLastSeen(nodeID) != 201 || table->getState(nodeID) != NODE_ACTIVE
+			|| table->getAttributeCount(nodeID) != 10) {
+		std::cout << "ERR: node table post lookup wrong\n";
+		delete table;
+		return false;
+	}
+
+	/* A registration whose group ID is a UCHAR is refused, not stored */
+	unsigned char shortGroup = 1;
+	items[0].type = UCHAR;
+	items[0].item = &shortGroup;
+	size = emon.attrBuilder(ATTR_REGISTER, items, 4, frame);
+	if(table->handleFrame(ATTR_REGISTER, frame, size, 202) || table->getAttributeCount(nodeID) != 10) {
+		std::cout << "ERR: node table accepted a UCHAR attribute identifier\n";
+		delete table;
+		return false;
+	}
+
+	/* A node replacing a removed one reuses its arena space */
+	uint32_t used = table->getArenaUsed();
+	table->remove(nodeID);
+	table->assign(nodeID + 1);
+	for(uint16_t i = 0; i < 10; i++) {
+		ident.attributeID = i;
+		table->addAttribute(nodeID + 1, &ident);
+	}
+	bool reused = table->getArenaUsed() == used && table->getState(nodeID) == NODE_UNUSED;
+	delete table;
+	if(!reused) {
+		std::cout << "ERR: node table did not reuse freed attribute sets\n";
+		return false;
+	}
+
+	return true;
+}
+
+uint16_t registerRequests = 0;
+
+uint16_t countingNetworkSender(uint8_t type, uint8_t *, uint16_t length) {
+	if(type == NODE_REGISTER) {
+		registerRequests++;
+	}
+	return length;
+}
+
+bool testRegisterNodeClock() {
+	SimulatedClock clock;
+	EMonCMS emon(NULL, 0, countingNetworkSender);
+	emon.setClock(&clock);
+	registerRequests = 0;
+
+	/* The timeout is in ms, not seconds */
+	emon.registerNode();
+	clock.advance(REGISTERREQUESTTIMEOUT + 1);
+	emon.registerNode();
+	clock.advance(REGISTERREQUESTTIMEOUT / 2);
+	emon.registerNode();
+	if(registerRequests != 1) {
+		std::cout << "ERR: register requests not timed in ms, sent " << registerRequests << "\n";
+		return false;
+	}
+
+	/* Retries carry on across the 32 bit millis wraparound */
+	clock.set(0xFFFFFFFF - REGISTERREQUESTTIMEOUT / 2);
+	emon.registerNode();
+	clock.advance(REGISTERREQUESTTIMEOUT / 2);
+	emon.registerNode();
+	clock.advance(REGISTERREQUESTTIMEOUT / 2 + 2);
+	emon.registerNode();
+	if(registerRequests != 3) {
+		std::cout << "ERR: register retry wrong across wraparound, sent " << registerRequests << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+bool testMonotonicClock() {
+	MonotonicClock clock;
+	uint32_t startMs = clock.millis();
+	uint32_t startUs = clock.micros();
+	struct timespec wait = { 0, 20 * 1000000 };
+	nanosleep(&wait, NULL);
+	uint32_t ms = clockElapsed(clock.millis(), startMs);
+	uint32_t us = clockElapsed(clock.micros(), startUs);
+	if(ms < 20 || ms > 1000 || us < 20000 || us > 1000000) {
+		std::cout << "ERR: monotonic clock measured " << ms << "ms, " << us << "us for a 20ms sleep\n";
+		return false;
+	}
+	return clockReached(ms, 20) && !clockReached(ms, ms + 1);
+}
+
+bool testUnknownTypes() {
+	EMonCMS emon(NULL, 0, NULL, NULL, NULL, 2);
+	AttributeIdentifier ident = { 1, 2, 3 };
+	DataItem items[4];
+	emon.attrIdentAsDataItems(&ident, items);
+	uint32_t value = 5;
+	items[3].item = &value;
+	uint8_t buffer[EMONCMS_MTU];
+
+	/* Codes past the table, and ones aliasing a known code when masked */
+	uint8_t badTypes[] = { 0, FLOAT + 1, USHORT + TYPE_TABLE_SIZE, 0xFF };
+	for(uint8_t i = 0; i < sizeof(badTypes); i++) {
+		items[3].type = badTypes[i];
+		if(emon.attrSize(ATTR_POST, items, 4) != 0 || emon.attrBuilder(ATTR_POST, items, 4, buffer) != 0) {
+			std::cout << "ERR: built packet with unknown type " << (int)badTypes[i] << "\n";
+			return false;
+		}
+	}
+
+	items[3].type = UINT;
+	uint16_t length = emon.attrBuilder(ATTR_POST, items, 4, buffer);
+	HeaderInfo *header = (HeaderInfo *)buffer;
+	DataItem parsed[5];
+	if(length != 21 || header->dataSize != 17
+			|| !EMonCMS::parseDataItems(header, &(buffer[sizeof(HeaderInfo)]), parsed, length - sizeof(HeaderInfo))) {
+		std::cout << "ERR: valid post not built or parsed\n";
+		return false;
+	}
+	buffer[length - 5] = USHORT + TYPE_TABLE_SIZE;
+	if(EMonCMS::parseDataItems(header, &(buffer[sizeof(HeaderInfo)]), parsed, length - sizeof(HeaderInfo))) {
+		std::cout << "ERR: parsed item with unknown type\n";
+		return false;
+	}
+	/* A node must not act on the unparsed items */
+	buffer[sizeof(HeaderInfo)] = 0xFF;
+	if(emon.parseEMonCMSPacket(header, 'r', &(buffer[sizeof(HeaderInfo)]), parsed) || emon.getNodeID() != 2) {
+		std::cout << "ERR: acted on packet with unknown type\n";
+		return false;
+	}
+
+	return true;
+}
+
+#define FUZZ_TEST_FRAMES 200000
+
+const char *fuzzPathNames[FUZZ_PATHS] = { "attrBuilder", "reference", "parseDataItems", "parseEMonCMSPacket", "noise" };
+
+bool testCodecDifferential() {
+	CodecFuzzer fuzzer(0x5EED, 100);
+	uint32_t mismatches = fuzzer.run(FUZZ_TEST_FRAMES);
+	FuzzPath path;
+	FuzzCase *failed = fuzzer.getFirstMismatch(&path);
+	if(failed != NULL) {
+		std::cout << "ERR: " << fuzzPathNames[path] << " disagreed for type " << (char)failed->type
+			<< " with " << (int)failed->length << " items, built " << failed->built
+			<< " expected " << failed->expected << "\n";
+	}
+	if(mismatches != 0) {
+		std::cout << "ERR: " << mismatches << " mismatches in " << fuzzer.getFrames() << " frames\n";
+		return false;
+	}
+
+	/* Every request type and the invalid cases must have been covered */
+	RequestType types[FUZZ_TYPES] = { NODE_REGISTER, ATTR_REGISTER, ATTR_POST, ATTR_FAILURE,
+		ATTR_POST_RESPONSE, ATTR_MULTI_RESPONSE };
+	for(uint8_t i = 0; i < FUZZ_TYPES; i++) {
+		if(fuzzer.getTypeFrames(types[i]) < FUZZ_TEST_FRAMES / 8) {
+			std::cout << "ERR: too few frames of type " << (char)types[i] << "\n";
+			return false;
+		}
+	}
+	if(fuzzer.getRejected() < FUZZ_TEST_FRAMES / 20) {
+		std::cout << "ERR: too few invalid frames rejected\n";
+		return false;
+	}
+	if(fuzzer.getSplitAnswers() < FUZZ_TEST_FRAMES / 100) {
+		std::cout << "ERR: too few multi responses split over packets\n";
+		return false;
+	}
+
+	/* The reference encoder against a hand checked post */
+	uint16_t nodeID = 0x0102;
+	AttributeIdentifier ident = { 0x0304, 0x0506, 0x0708 };
+	uint8_t value = 0x09;
+	DataItem items[4];
+	EMonCMS emon(NULL, 0, NULL, NULL, NULL, nodeID);
+	emon.attrIdentAsDataItems(&ident, items);
+	items[3].type = UCHAR;
+	items[3].item = &value;
+	uint8_t expected[] = { 14, 0, SUCCESS, 5, USHORT, 0x02, 0x01, USHORT, 0x04, 0x03,
+		USHORT, 0x06, 0x05, USHORT, 0x08, 0x07, UCHAR, 0x09 };
+	uint8_t buffer[EMONCMS_MTU];
+	if(CodecFuzzer::referenceEncode(ATTR_POST, nodeID, items, 4, buffer) != sizeof(expected)
+			|| memcmp(buffer, expected, sizeof(expected)) != 0) {
+		std::cout << "ERR: reference encoder wrong for post\n";
+		return false;
+	}
+
+	/* and against a hand checked multi response entry */
+	uint8_t expectedMulti[] = { 16, 0, SUCCESS, 6, USHORT, 0x02, 0x01, USHORT, 0x04, 0x03,
+		USHORT, 0x06, 0x05, USHORT, 0x08, 0x07, UCHAR, SUCCESS, UCHAR, 0x09 };
+	if(CodecFuzzer::referenceEncode(ATTR_MULTI_RESPONSE, nodeID, items, 4, buffer) != sizeof(expectedMulti)
+			|| memcmp(buffer, expectedMulti, sizeof(expectedMulti)) != 0) {
+		std::cout << "ERR: reference encoder wrong for multi response\n";
+		return false;
+	}
+
+	return true;
+}
+
+DedupWindow *testDedup = NULL;
+uint32_t dedupDropped = 0;
+
+void testDedupGateway(uint8_t type, uint8_t *buffer, uint16_t length, uint32_t) {
+	if(!DedupWindow::accepted(testDedup->checkFrame(type, buffer, length))) {
+		dedupDropped++;
+	}
+}
+
+bool testDedupWindow() {
+	DedupWindow *dedup = new DedupWindow();
+	/* In order, repeated, out of order within the window and beyond it, however far */
+	uint32_t sequences[] = { 110, 110, 112, 111, 111, 176, 112, 113, 5000, 1 };
+	uint8_t results[] = { DEDUP_NEW, DEDUP_DUPLICATE, DEDUP_NEW, DEDUP_REORDERED, DEDUP_DUPLICATE,
+		DEDUP_NEW, DEDUP_STALE, DEDUP_REORDERED, DEDUP_NEW, DEDUP_STALE };
+	for(uint8_t i = 0; i < sizeof(results); i++) {
+		uint8_t result = dedup->check(5, sequences[i]);
+		if(result != results[i]) {
+			std::cout << "ERR: sequence " << sequences[i] << " gave " << (int)result << "\n";
+			return false;
+		}
+	}
+	if(dedup->getRestarts() != 0 || dedup->check(6, 0xFFFFFFFF) != DEDUP_NEW || dedup->check(6, 0) != DEDUP_NEW
+			|| dedup->check(6, 0xFFFFFFFF) != DEDUP_DUPLICATE) {
+		std::cout << "ERR: restart or wraparound not handled\n";
+		return false;
+	}
+	/* A node reset after a few posts counts again from 1 once it registers again */
+	for(uint32_t sequence = 1; sequence <= 100; sequence++) {
+		dedup->check(9, sequence);
+	}
+	if(dedup->check(9, 1) != DEDUP_STALE || dedup->check(9, 60) != DEDUP_DUPLICATE) {
+		std::cout << "ERR: old post taken as a node reset\n";
+		return false;
+	}
+	dedup->forget(9);
+	if(dedup->check(9, 1) != DEDUP_NEW || dedup->check(9, 2) != DEDUP_NEW || dedup->check(9, 1) != DEDUP_DUPLICATE
+			|| dedup->getRestarts() != 1) {
+		std::cout << "ERR: node reset after a few posts not recognised\n";
+		return false;
+	}
+	/* A node sharing the entry takes it over */
+	if(dedup->check(5 + DEDUP_MAX_NODES, 1) != DEDUP_NEW || dedup->getEvictions() != 1
+			|| dedup->check(5, 1) != DEDUP_NEW) {
+		std::cout << "ERR: entry not taken over\n";
+		return false;
+	}
+	delete dedup;
+
+	/* Numbered posts from a node */
+	AttributeValue attrVal = { { 1, 2, 3 }, fakeAttributeReader, true };
+	EMonCMS emon(&attrVal, 1, capturingNetworkSender, NULL, NULL, 7);
+	capturedCount = 0;
+	emon.postAttribute(&(attrVal.attr));
+	emon.setPostSequence(true);
+	emon.postAttribute(&(attrVal.attr));
+	emon.postAttribute(&(attrVal.attr));
+	DedupWindow frames;
+	uint16_t sequencedSize = 25 + 5;
+	if(capturedCount != 3 || emon.getPostSequence() != 2
+			|| frames.checkFrame(ATTR_POST, capturedFrames[0], 25) != DEDUP_UNSEQUENCED
+			|| frames.checkFrame(ATTR_POST, capturedFrames[2], sequencedSize) != DEDUP_NEW
+			|| frames.checkFrame(ATTR_POST, capturedFrames[1], sequencedSize) != DEDUP_REORDERED
+			|| frames.checkFrame(ATTR_POST, capturedFrames[2], sequencedSize) != DEDUP_DUPLICATE) {
+		std::cout << "ERR: numbered posts not checked\n";
+		return false;
+	}
+
+	/* Every duplicate from the simulated channel is dropped */
+	AttributeValue attrValues[4];
+	EMonCMS *nodes[4];
+	RadioSimulator sim(38400, 5, 0, 99);
+	sim.setDuplication(300, 120);
+	DedupWindow gatewayDedup;
+	testDedup = &gatewayDedup;
+	dedupDropped = 0;
+	sim.setGateway(testDedupGateway);
+	for(uint8_t n = 0; n < 4; n++) {
+		attrValues[n] = attrVal;
+		nodes[n] = new EMonCMS(&(attrValues[n]), 1, RadioSimulator::nodeSender, NULL, NULL, 20 + n);
+		nodes[n]->setPostSequence(true);
+		sim.addNode(nodes[n]);
+	}
+	for(uint32_t t = 0; t < 2000; t += 50) {
+		for(uint8_t n = 0; n < 4; n++) {
+			nodes[n]->postAttribute(&(attrVal.attr));
+		}
+		sim.runUntil(t + 50);
+	}
+	sim.runUntil(3000);
+	bool passed = sim.getFramesDuplicated() > 0 && dedupDropped == sim.getFramesDuplicated()
+		&& gatewayDedup.getCount(DEDUP_NEW) + gatewayDedup.getCount(DEDUP_REORDERED) == 4 * nodes[0]->getPostSequence();
+	if(!passed) {
+		std::cout << "ERR: " << dedupDropped << " dropped of " << sim.getFramesDuplicated() << " duplicates\n";
+	}
+	for(uint8_t n = 0; n < 4; n++) {
+		delete nodes[n];
+	}
+	testDedup = NULL;
+	return passed;
+}
+
+#ifdef EMONCMS_COROUTINES
+uint8_t asyncFinished = 0;
+uint8_t asyncPosted = 0;
+uint16_t asyncNodeIDs[3];
+PollReply asyncReplies[3][2];
+
+AsyncTask asyncConversation(EventLoop *loop, AsyncNode *node, AsyncGateway *gateway, AttributeIdentifier *ident, uint8_t n) {
+	asyncNodeIDs[n] = co_await node->registered();
+	if(co_await node->post(ident)) {
+		asyncPosted++;
+	}
+	AttributeIdentifier missing = *ident;
+	missing.attributeNumber = 9;
+	asyncReplies[n][0] = co_await gateway->poll(asyncNodeIDs[n], ident);
+	asyncReplies[n][1] = co_await gateway->poll(asyncNodeIDs[n], &missing);
+	if(++asyncFinished == 3) {
+		loop->stop();
+	}
+}
+
+bool testAsyncConversation() {
+	EventLoop loop(1024, 64);
+	AsyncGateway gateway(&loop, 3);
+	AttributeValue attrValues[3];
+	AsyncNode *nodes[3];
+	int fds[3][2];
+	for(uint8_t n = 0; n < 3; n++) {
+		attrValues[n].attr.groupID = 1;
+		attrValues[n].attr.attributeID = n;
+		attrValues[n].attr.attributeNumber = 0;
+		attrValues[n].reader = fakeAttributeReader;
+		attrValues[n].registered = false;
+		if(!radioPair(fds[n], true) || !gateway.addLink(fds[n][0])) {
+			std::cout << "ERR: could not create pseudo radio\n";
+			return false;
+		}
+		nodes[n] = new AsyncNode(&loop, fds[n][1], &(attrValues[n]), 1);
+	}
+
+	asyncFinished = 0;
+	asyncPosted = 0;
+	for(uint8_t n = 0; n < 3; n++) {
+		asyncConversation(&loop, nodes[n], &gateway, &(attrValues[n].attr), n);
+	}
+	loop.run(2000);
+
+	bool passed = true;
+	if(asyncFinished != 3 || asyncPosted != 3 || gateway.getPosts() != 3) {
+		std::cout << "ERR: conversations did not finish, " << (int)asyncFinished << " finished, "
+			<< (int)asyncPosted << " posted\n";
+		passed = false;
+	}
+	for(uint8_t n = 0; passed && n < 3; n++) {
+		int value;
+		memcpy(&value, asyncReplies[n][0].value, sizeof(value));
+		if(asyncNodeIDs[n] == 0 || (n > 0 && asyncNodeIDs[n] == asyncNodeIDs[n - 1])
+				|| gateway.getTable()->getAttributeCount(asyncNodeIDs[n]) != 1) {
+			std::cout << "ERR: node " << (int)n << " not registered\n";
+			passed = false;
+		} else if(asyncReplies[n][0].status != SUCCESS || asyncReplies[n][0].type != INT || value != globalFakeReading
+				|| asyncReplies[n][1].status != UNSUPPORTED_ATTRIBUTE) {
+			std::cout << "ERR: wrong poll replies from node " << (int)n << "\n";
+			passed = false;
+		}
+	}
+
+	for(uint8_t n = 0; n < 3; n++) {
+		delete nodes[n];
+		close(fds[n][0]);
+		close(fds[n][1]);
+	}
+	return passed;
+}
+
+PollReply asyncTimeoutReply;
+
+AsyncTask asyncTimeoutPoll(EventLoop *loop, AsyncGateway *gateway) {
+	AttributeIdentifier ident = { 1, 2, 3 };
+	asyncTimeoutReply = co_await gateway->poll(7, &ident, 50);
+	loop->stop();
+}
+
+bool testAsyncPollTimeout() {
+	EventLoop loop(1024, 16);
+	AsyncGateway gateway(&loop, 1);
+	int fds[2];
+	if(!radioPair(fds, true) || !gateway.addLink(fds[0])) {
+		return false;
+	}
+
+	/* A post from node 7 makes the link known, then it goes quiet */
+	uint8_t post[sizeof(HeaderInfo) + 17] = { 17, 0, SUCCESS, 5, USHORT, 7, 0, USHORT, 1, 0, USHORT, 2, 0,
+		USHORT, 3, 0, INT, 1, 0, 0, 0 };
+	radioSend(fds[1], ATTR_POST, post, sizeof(post));
+	loop.run(20);
+
+	asyncTimeoutReply.status = SUCCESS;
+	uint32_t start = loop.getClock()->millis();
+	asyncTimeoutPoll(&loop, &gateway);
+	loop.run(2000);
+	uint32_t elapsed = clockElapsed(loop.getClock()->millis(), start);
+
+	close(fds[0]);
+	close(fds[1]);
+	if(asyncTimeoutReply.status != FAILURE || elapsed < 50 || elapsed > 1000) {
+		std::cout << "ERR: poll of a silent node should fail after 50ms, took " << elapsed << "ms\n";
+		return false;
+	}
+	return true;
+}
+
+void asyncIdleTimer(void *) {
+	/* do nothing */
+}
+
+bool testAsyncPollNoTimer() {
+	/* The only timer slot is taken, so the poll can't time out */
+	EventLoop loop(1024, 1);
+	AsyncGateway gateway(&loop, 1);
+	int fds[2];
+	if(!radioPair(fds, true) || !gateway.addLink(fds[0])) {
+		return false;
+	}
+	uint8_t post[sizeof(HeaderInfo) + 17] = { 17, 0, SUCCESS, 5, USHORT, 7, 0, USHORT, 1, 0, USHORT, 2, 0,
+		USHORT, 3, 0, INT, 1, 0, 0, 0 };
+	radioSend(fds[1], ATTR_POST, post, sizeof(post));
+	loop.run(20);
+	loop.startTimer(60000, asyncIdleTimer, NULL);
+
+	/* It must fail without suspending rather than wait for ever */
+	asyncTimeoutReply.status = SUCCESS;
+	asyncTimeoutPoll(&loop, &gateway);
+	bool passed = asyncTimeoutReply.status == FAILURE;
+
+	close(fds[0]);
+	close(fds[1]);
+	if(!passed) {
+		std::cout << "ERR: poll without a timer did not fail straight away\n";
+	}
+	return passed;
+}
+
+bool testAsyncPollTruncated() {
+	EventLoop loop(1024, 16);
+	AsyncGateway gateway(&loop, 1);
+	int fds[2];
+	if(!radioPair(fds, true) || !gateway.addLink(fds[0])) {
+		return false;
+	}
+	uint8_t post[sizeof(HeaderInfo) + 17] = { 17, 0, SUCCESS, 5, USHORT, 7, 0, USHORT, 1, 0, USHORT, 2, 0,
+		USHORT, 3, 0, INT, 1, 0, 0, 0 };
+	radioSend(fds[1], ATTR_POST, post, sizeof(post));
+	loop.run(20);
+
+	/* A junk frame fills the receive buffer, then an answer claims 60
+	 *  bytes of data but carries a one byte value.
+	 */
+	asyncTimeoutPoll(&loop, &gateway);
+	uint8_t junk[EMONCMS_MTU];
+	memset(junk, 0xEE, sizeof(junk));
+	uint8_t answer[sizeof(HeaderInfo) + 14] = { 60, 0, SUCCESS, 5, USHORT, 7, 0, USHORT, 1, 0, USHORT, 2, 0,
+		USHORT, 3, 0, UCHAR, 42 };
+	radioSend(fds[1], 'x', junk, sizeof(junk));
+	radioSend(fds[1], ATTR_POST_RESPONSE, answer, sizeof(answer));
+	loop.run(2000);
+
+	close(fds[0]);
+	close(fds[1]);
+	uint8_t expected[8] = { 42, 0, 0, 0, 0, 0, 0, 0 };
+	if(asyncTimeoutReply.status != SUCCESS || asyncTimeoutReply.type != UCHAR
+			|| memcmp(asyncTimeoutReply.value, expected, sizeof(expected)) != 0) {
+		std::cout << "ERR: truncated poll answer read past its frame\n";
+		return false;
+	}
+	return true;
+}
+#endif
+
 int main(int argc, char *args[]) {
 	int total = 0;
 	int passCount = 0;
@@ -218,11 +1453,33 @@ int main(int argc, char *args[]) {
 	TEST(testSetNodeID);
 	TEST(testAttributePostResponse);
 	TEST(testBuildAttributeRegister);
+	TEST(testFeedStorePost);
+	TEST(testBulkUploaderPayload);
+	TEST(testBulkUploaderRetry);
+	TEST(testBulkUploaderOrder);
+	TEST(testAttributePollerSimulated);
+	TEST(testAttributePollerBatched);
+	TEST(testAttributePollerFairness);
+	TEST(testMultiAttributeRequest);
+	TEST(testNodeTableFrames);
+	TEST(testRegisterNodeClock);
+	TEST(testMonotonicClock);
+	TEST(testFramePool);
+	TEST(testNodeDispatcher);
+	TEST(testUnknownTypes);
+	TEST(testCodecDifferential);
+	TEST(testDedupWindow);
+#ifdef EMONCMS_COROUTINES
+	TEST(testAsyncConversation);
+	TEST(testAsyncPollTimeout);
+	TEST(testAsyncPollTruncated);
+	TEST(testAsyncPollNoTimer);
+#endif
 	
 	std::cout << passCount << " pass of " << total << "\n";
 	
 	
-	return 0;
+	return passCount == total ? 0 : 1;
 }
 
 #endif
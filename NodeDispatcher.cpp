@@ -0,0 +1,208 @@
+#include "NodeDispatcher.h"
+#include "Debug.h"
+
+NodeDispatcher::NodeDispatcher(NetworkSender sender, BatchSender batchSender, void *context) {
+	this->sender = sender;
+	this->batchSender = batchSender;
+	this->context = context;
+	this->nodeCount = 0;
+	this->registeringHead = 0;
+	this->registeringCount = 0;
+	this->queueHead = 0;
+	this->queueCount = 0;
+	memset(this->index, DISPATCHER_NONE, sizeof(this->index));
+}
+
+NodeDispatcher::~NodeDispatcher() {
+	/* do nothing */
+}
+
+EMonCMS *NodeDispatcher::addNode(AttributeValue values[], int16_t length,
+		AttributeRegistered attrRegistered, NodeIDRegistered nodeRegistered, uint16_t nodeID) {
+	if(this->nodeCount >= DISPATCHER_MAX_NODES) {
+		LOG(F("NodeDispatcher: no room for node\r\n"));
+		return NULL;
+	}
+	uint8_t slot = this->nodeCount++;
+	this->nodes[slot] = EMonCMS(values, length, NULL, attrRegistered, nodeRegistered, nodeID);
+	this->contexts[slot].dispatcher = this;
+	this->contexts[slot].slot = slot;
+	this->nodes[slot].setSender(NodeDispatcher::queueSender, &(this->contexts[slot]));
+	this->reindex();
+	return &(this->nodes[slot]);
+}
+
+EMonCMS *NodeDispatcher::getNode(uint8_t slot) {
+	return slot < this->nodeCount ? &(this->nodes[slot]) : NULL;
+}
+
+uint8_t NodeDispatcher::getNodeCount() {
+	return this->nodeCount;
+}
+
+void NodeDispatcher::reindex() {
+	memset(this->index, DISPATCHER_NONE, sizeof(this->index));
+	for(uint8_t slot = 0; slot < this->nodeCount; slot++) {
+		uint16_t nodeID = this->nodes[slot].getNodeID();
+		this->indexedIDs[slot] = nodeID;
+		if(nodeID == 0) {
+			continue;
+		}
+		uint8_t i = hash(nodeID);
+		while(this->index[i] != DISPATCHER_NONE) {
+			i = (i + 1) & (DISPATCHER_INDEX_SIZE - 1);
+		}
+		this->index[i] = slot;
+	}
+}
+
+EMonCMS *NodeDispatcher::findNode(uint16_t nodeID) {
+	if(nodeID == 0) {
+		return NULL;
+	}
+	/* The index is at most half full so a probe ends at an empty slot */
+	for(uint8_t i = hash(nodeID); this->index[i] != DISPATCHER_NONE; i = (i + 1) & (DISPATCHER_INDEX_SIZE - 1)) {
+		if(this->indexedIDs[this->index[i]] == nodeID) {
+			return &(this->nodes[this->index[i]]);
+		}
+	}
+	return NULL;
+}
+
+bool NodeDispatcher::dispatch(uint8_t type, uint8_t *buffer, uint16_t length) {
+	if(length < sizeof(HeaderInfo)) {
+		return false;
+	}
+	HeaderInfo *header = (HeaderInfo *)buffer;
+	uint8_t *data = &(buffer[sizeof(HeaderInfo)]);
+	if(header->dataCount == 0 || header->dataCount > DISPATCHER_MAX_ITEMS
+			|| !EMonCMS::parseDataItems(header, data, this->items, length - sizeof(HeaderInfo))) {
+		LOG(F("NodeDispatcher: malformed frame\r\n"));
+		return false;
+	}
+
+	uint8_t slot;
+	if(type == 'r') {
+		/* Node ID responses go to the longest waiting request */
+		if(this->registeringCount == 0) {
+			LOG(F("NodeDispatcher: node ID response with no request\r\n"));
+			return false;
+		}
+		slot = this->registering[this->registeringHead];
+		this->registeringHead = (this->registeringHead + 1) % DISPATCHER_MAX_NODES;
+		this->registeringCount--;
+	} else {
+		/* Everything else starts with the node ID */
+		if(this->items[0].type != USHORT) {
+			return false;
+		}
+		uint16_t nodeID;
+		memcpy(&nodeID, this->items[0].item, sizeof(nodeID));
+		EMonCMS *node = this->findNode(nodeID);
+		if(node == NULL) {
+			return false;
+		}
+		slot = node - this->nodes;
+	}
+
+	bool handled = this->nodes[slot].parseEMonCMSPacket(header, type, data, this->items);
+	if(this->nodes[slot].getNodeID() != this->indexedIDs[slot]) {
+		this->reindex();
+	}
+	return handled;
+}
+
+void NodeDispatcher::registerNodes() {
+	for(uint8_t slot = 0; slot < this->nodeCount; slot++) {
+		this->nodes[slot].registerNode();
+	}
+	this->flush();
+}
+
+uint16_t NodeDispatcher::queueSender(void *context, uint8_t type, uint8_t *buffer, uint16_t length) {
+	DispatchContext *dispatchContext = (DispatchContext *)context;
+	return dispatchContext->dispatcher->queue(dispatchContext->slot, type, buffer, length);
+}
+
+uint16_t NodeDispatcher::queue(uint8_t slot, uint8_t type, uint8_t *buffer, uint16_t length) {
+	if(length > EMONCMS_MTU) {
+		return 0;
+	}
+	if(this->queueCount >= DISPATCHER_QUEUE_FRAMES && (this->flush() == 0 || this->queueCount >= DISPATCHER_QUEUE_FRAMES)) {
+		LOG(F("NodeDispatcher: transmit queue full\r\n"));
+		return 0;
+	}
+
+	if(type == NODE_REGISTER) {
+		/* Remember who is waiting, once, for routing the response */
+		bool waiting = false;
+		for(uint8_t i = 0; i < this->registeringCount; i++) {
+			if(this->registering[(this->registeringHead + i) % DISPATCHER_MAX_NODES] == slot) {
+				waiting = true;
+			}
+		}
+		if(!waiting) {
+			this->registering[(this->registeringHead + this->registeringCount) % DISPATCHER_MAX_NODES] = slot;
+			this->registeringCount++;
+		}
+	}
+
+	FramePool *pool = this->nodes[slot].getFramePool();
+	if(!pool->retain(buffer)) {
+		LOG(F("NodeDispatcher: frame not from the node's pool\r\n"));
+		return 0;
+	}
+
+	DispatchFrame *frame = &(this->frames[(this->queueHead + this->queueCount) % DISPATCHER_QUEUE_FRAMES]);
+	frame->type = type;
+	frame->length = length;
+	frame->data = buffer;
+	frame->pool = pool;
+	this->queueCount++;
+
+	/* Send now if the node would have no frame left for its next packet */
+	if(pool->getInUse() >= FRAMEPOOL_FRAMES) {
+		this->flush();
+	}
+	return length;
+}
+
+uint8_t NodeDispatcher::flush() {
+	uint8_t sent = 0;
+	if(this->batchSender != NULL) {
+		uint8_t types[DISPATCHER_QUEUE_FRAMES];
+		uint8_t *frames[DISPATCHER_QUEUE_FRAMES];
+		uint16_t lengths[DISPATCHER_QUEUE_FRAMES];
+		for(uint8_t i = 0; i < this->queueCount; i++) {
+			DispatchFrame *frame = &(this->frames[(this->queueHead + i) % DISPATCHER_QUEUE_FRAMES]);
+			types[i] = frame->type;
+			frames[i] = frame->data;
+			lengths[i] = frame->length;
+		}
+		if(this->queueCount > 0) {
+			sent = this->batchSender(this->context, types, frames, lengths, this->queueCount);
+		}
+	} else if(this->sender != NULL) {
+		while(sent < this->queueCount) {
+			DispatchFrame *frame = &(this->frames[(this->queueHead + sent) % DISPATCHER_QUEUE_FRAMES]);
+			if(this->sender(frame->type, frame->data, frame->length) == 0) {
+				break;
+			}
+			sent++;
+		}
+	}
+	if(sent > this->queueCount) {
+		sent = this->queueCount;
+	}
+	for(uint8_t i = 0; i < sent; i++) {
+		DispatchFrame *frame = &(this->frames[(this->queueHead + i) % DISPATCHER_QUEUE_FRAMES]);
+		frame->pool->release(frame->data);
+	}
+	this->queueHead = (this->queueHead + sent) % DISPATCHER_QUEUE_FRAMES;
+	this->queueCount -= sent;
+	return sent;
+}
+
+uint8_t NodeDispatcher::getQueued() {
+	return this->queueCount;
+}
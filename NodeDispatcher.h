@@ -0,0 +1,162 @@
+#ifndef __NODEDISPATCHER_H__
+#define __NODEDISPATCHER_H__
+
+#include "EMonCMS.h"
+
+#ifndef DISPATCHER_MAX_NODES
+#define DISPATCHER_MAX_NODES 8 /** logical nodes behind one dispatcher **/
+#endif
+#ifndef DISPATCHER_QUEUE_FRAMES
+#define DISPATCHER_QUEUE_FRAMES 8 /** frames waiting in the transmit queue **/
+#endif
+#define DISPATCHER_INDEX_SIZE 16 /** node ID hash slots, a power of 2 at least twice DISPATCHER_MAX_NODES **/
+#define DISPATCHER_NONE 0xFF /** empty node ID hash slot **/
+#define DISPATCHER_MAX_ITEMS ((EMONCMS_MTU - sizeof(HeaderInfo)) / 3) /** items in an incoming frame, all 3 byte USHORTs at most **/
+
+/**
+ * Sends several queued frames, possibly from different logical nodes,
+ * in one go, e.g. back to back in one radio transaction.
+ * @param context the context given to the NodeDispatcher
+ * @param types packet type of each frame
+ * @param frames the frames, including header
+ * @param lengths length of each frame
+ * @param count number of frames
+ * @return the number of leading frames sent
+ **/
+typedef uint8_t (*BatchSender)(void *context, uint8_t types[], uint8_t *frames[], uint16_t lengths[], uint8_t count);
+
+/**
+ * A frame waiting in the transmit queue, held in its node's frame pool
+ **/
+typedef struct {
+	uint8_t type; /** packet type **/
+	uint16_t length; /** bytes used in data **/
+	uint8_t *data; /** the frame, including header **/
+	FramePool *pool; /** pool holding data, released once sent **/
+} DispatchFrame;
+
+class NodeDispatcher;
+
+/**
+ * Identifies the logical node a frame is sent for
+ **/
+typedef struct {
+	NodeDispatcher *dispatcher; /** owner of the node **/
+	uint8_t slot; /** index of the node **/
+} DispatchContext;
+
+/**
+ * Runs several logical emon nodes behind one radio, e.g. a concentrator
+ * metering several circuits. The EMonCMS instances are held in one array,
+ * incoming frames are routed to them by node ID through a small hash
+ * index, and everything they send goes through one transmit queue that
+ * is flushed as a batch. The queue holds the nodes' pooled frames rather
+ * than copies, and flushes early when a node would have none left to
+ * build into.
+ *
+ * Node ID responses carry no node ID, and requests carry nothing the
+ * gateway echoes back, so they go to the nodes waiting for one in the
+ * order they asked. This is only right while the gateway answers every
+ * request in order; a lost request or response hands the following IDs
+ * to the wrong nodes until they register again.
+ **/
+class NodeDispatcher {
+	public:
+		/**
+		 * @param sender sends queued frames one at a time
+		 * @param batchSender sends queued frames together, NULL to use sender
+		 * @param context passed to batchSender
+		 **/
+		NodeDispatcher(NetworkSender sender, BatchSender batchSender = NULL, void *context = NULL);
+		~NodeDispatcher();
+		/**
+		 * Adds a logical node, taking the same arguments as EMonCMS
+		 * @param values list of attributes which can be read from the node
+		 * @param length length of attribute list
+		 * @param attrRegistered attribute registered callback
+		 * @param nodeRegistered node registered callback
+		 * @param nodeID node id for emoncms, 0 to request one
+		 * @return the node, NULL if there are already DISPATCHER_MAX_NODES
+		 **/
+		EMonCMS *addNode(AttributeValue values[], int16_t length,
+			AttributeRegistered attrRegistered = NULL,
+			NodeIDRegistered nodeRegistered = NULL,
+			uint16_t nodeID = 0);
+		/**
+		 * @param slot index of the node, in the order added
+		 * @return the node, NULL if there is none
+		 **/
+		EMonCMS *getNode(uint8_t slot);
+		/**
+		 * @return the node with the ID, NULL if none has it
+		 **/
+		EMonCMS *findNode(uint16_t nodeID);
+		/**
+		 * @return number of nodes
+		 **/
+		uint8_t getNodeCount();
+		/**
+		 * Routes an incoming frame to its node and parses it there. Any
+		 * responses are queued, call flush to send them.
+		 * @param type type of the frame
+		 * @param buffer the whole frame, including header
+		 * @param length length of the frame
+		 * @return false if the frame is malformed, for no node here or
+		 *  the node failed to handle it
+		 **/
+		bool dispatch(uint8_t type, uint8_t *buffer, uint16_t length);
+		/**
+		 * Calls registerNode on every node and flushes what they send
+		 **/
+		void registerNodes();
+		/**
+		 * Queues a frame for sending, flushing first if the queue is full.
+		 * The frame is held in the node's pool until sent, so it must be
+		 * one the node acquired from its pool.
+		 * @return length on success, 0 if the queue is still full or the
+		 *  frame isn't from the node's pool
+		 **/
+		uint16_t queue(uint8_t slot, uint8_t type, uint8_t *buffer, uint16_t length);
+		/**
+		 * Sends the queued frames
+		 * @return the number of frames sent
+		 **/
+		uint8_t flush();
+		/**
+		 * @return frames waiting to be sent
+		 **/
+		uint8_t getQueued();
+		/**
+		 * ContextSender given to each node, with its DispatchContext
+		 **/
+		static uint16_t queueSender(void *context, uint8_t type, uint8_t *buffer, uint16_t length);
+	protected:
+		EMonCMS nodes[DISPATCHER_MAX_NODES]; /** the logical nodes **/
+		DispatchContext contexts[DISPATCHER_MAX_NODES]; /** sender context of each node **/
+		uint16_t indexedIDs[DISPATCHER_MAX_NODES]; /** node IDs as last put in the index **/
+		uint8_t index[DISPATCHER_INDEX_SIZE]; /** node ID hash to slot **/
+		uint8_t nodeCount; /** nodes added **/
+		uint8_t registering[DISPATCHER_MAX_NODES]; /** FIFO of slots waiting for a node ID **/
+		uint8_t registeringHead; /** first entry in registering **/
+		uint8_t registeringCount; /** entries in registering **/
+		DispatchFrame frames[DISPATCHER_QUEUE_FRAMES]; /** transmit queue **/
+		uint8_t queueHead; /** first queued frame **/
+		uint8_t queueCount; /** frames queued **/
+		NetworkSender sender; /** sends single frames **/
+		BatchSender batchSender; /** sends frames together **/
+		void *context; /** passed to batchSender **/
+		DataItem items[DISPATCHER_MAX_ITEMS]; /** items of the frame being dispatched **/
+
+		/**
+		 * Rebuilds the node ID index after IDs change
+		 **/
+		void reindex();
+		/**
+		 * @return home slot of a node ID in the index
+		 **/
+		static inline uint8_t hash(uint16_t nodeID) {
+			return (uint8_t)((uint16_t)(nodeID * 40503u) >> 8) & (DISPATCHER_INDEX_SIZE - 1);
+		}
+};
+
+#endif
@@ -0,0 +1,223 @@
+#ifdef LINUX
+
+#include "NodeTable.h"
+#include "Debug.h"
+
+#include <cstdlib>
+
+NodeTable::NodeTable(uint32_t arenaSlots) {
+	this->arena = (uint64_t *)malloc(sizeof(uint64_t) * arenaSlots);
+	this->arenaSlots = this->arena == NULL ? 0 : arenaSlots;
+	this->arenaUsed = 0;
+	this->nextID = 1;
+	for(uint8_t i = 0; i <= NODETABLE_MAX_SET; i++) {
+		this->freeSets[i] = NODETABLE_NONE;
+	}
+	memset(this->lastSeen, 0, sizeof(this->lastSeen));
+	memset(this->attrSet, 0xFF, sizeof(this->attrSet));
+	memset(this->attrCount, 0, sizeof(this->attrCount));
+	memset(this->attrSetSize, 0, sizeof(this->attrSetSize));
+	memset(this->state, NODE_UNUSED, sizeof(this->state));
+}
+
+NodeTable::~NodeTable() {
+	free(this->arena);
+}
+
+uint32_t NodeTable::allocateSet(uint8_t size) {
+	uint32_t offset = this->freeSets[size];
+	if(offset != NODETABLE_NONE) {
+		/* the first slot of a free set links to the next one */
+		this->freeSets[size] = (uint32_t)this->arena[offset];
+	} else {
+		uint32_t slots = (uint32_t)1 << size;
+		if(this->arenaSlots - this->arenaUsed < slots) {
+			LOG(F("NodeTable: attribute arena full\r\n"));
+			return NODETABLE_NONE;
+		}
+		offset = this->arenaUsed;
+		this->arenaUsed += slots;
+	}
+	for(uint32_t i = 0; i < ((uint32_t)1 << size); i++) {
+		this->arena[offset + i] = NODETABLE_EMPTY;
+	}
+	return offset;
+}
+
+void NodeTable::freeSet(uint32_t offset, uint8_t size) {
+	this->arena[offset] = this->freeSets[size];
+	this->freeSets[size] = offset;
+}
+
+void NodeTable::insert(uint64_t *set, uint8_t size, uint64_t key) {
+	uint32_t mask = ((uint32_t)1 << size) - 1;
+	for(uint32_t i = slot(key, size); ; i = (i + 1) & mask) {
+		if(set[i] == NODETABLE_EMPTY || set[i] == key) {
+			set[i] = key;
+			return;
+		}
+	}
+}
+
+uint16_t NodeTable::allocate() {
+	/* Scan on from the last ID given out so allocation is O(1) until the table fills */
+	for(uint32_t n = 0; n < NODETABLE_SIZE; n++) {
+		uint16_t nodeID = this->nextID++;
+		if(nodeID != 0 && this->state[nodeID] == NODE_UNUSED) {
+			this->assign(nodeID);
+			return nodeID;
+		}
+	}
+	return 0;
+}
+
+bool NodeTable::assign(uint16_t nodeID) {
+	if(nodeID == 0) {
+		return false;
+	}
+	if(this->state[nodeID] == NODE_UNUSED) {
+		this->state[nodeID] = NODE_ASSIGNED;
+	}
+	return true;
+}
+
+void NodeTable::remove(uint16_t nodeID) {
+	if(this->attrSet[nodeID] != NODETABLE_NONE) {
+		this->freeSet(this->attrSet[nodeID], this->attrSetSize[nodeID]);
+	}
+	this->attrSet[nodeID] = NODETABLE_NONE;
+	this->attrCount[nodeID] = 0;
+	this->attrSetSize[nodeID] = 0;
+	this->lastSeen[nodeID] = 0;
+	this->state[nodeID] = NODE_UNUSED;
+}
+
+void NodeTable::seen(uint16_t nodeID, uint32_t now) {
+	if(this->state[nodeID] != NODE_UNUSED) {
+		this->state[nodeID] = NODE_ACTIVE;
+		this->lastSeen[nodeID] = now;
+	}
+}
+
+bool NodeTable::addAttribute(uint16_t nodeID, AttributeIdentifier *attr) {
+	if(this->state[nodeID] == NODE_UNUSED) {
+		return false;
+	}
+	if(this->hasAttribute(nodeID, attr)) {
+		return true;
+	}
+
+	uint32_t offset = this->attrSet[nodeID];
+	uint8_t size = this->attrSetSize[nodeID];
+
+	/* Keep the set at most half full, rehashing into a set twice the size */
+	if(offset == NODETABLE_NONE || (uint32_t)(this->attrCount[nodeID] + 1) * 2 > ((uint32_t)1 << size)) {
+		uint8_t newSize = offset == NODETABLE_NONE ? NODETABLE_MIN_SET : size + 1;
+		if(newSize > NODETABLE_MAX_SET) {
+			return false;
+		}
+		uint32_t newOffset = this->allocateSet(newSize);
+		if(newOffset == NODETABLE_NONE) {
+			return false;
+		}
+		if(offset != NODETABLE_NONE) {
+			uint64_t *old = &(this->arena[offset]);
+			for(uint32_t i = 0; i < ((uint32_t)1 << size); i++) {
+				if(old[i] != NODETABLE_EMPTY) {
+					this->insert(&(this->arena[newOffset]), newSize, old[i]);
+				}
+			}
+			this->freeSet(offset, size);
+		}
+		offset = newOffset;
+		size = newSize;
+		this->attrSet[nodeID] = offset;
+		this->attrSetSize[nodeID] = size;
+	}
+
+	this->insert(&(this->arena[offset]), size, key(attr));
+	this->attrCount[nodeID]++;
+	return true;
+}
+
+bool NodeTable::hasAttribute(uint16_t nodeID, AttributeIdentifier *attr) {
+	uint32_t offset = this->attrSet[nodeID];
+	if(offset == NODETABLE_NONE) {
+		return false;
+	}
+	uint8_t size = this->attrSetSize[nodeID];
+	uint32_t mask = ((uint32_t)1 << size) - 1;
+	uint64_t *set = &(this->arena[offset]);
+	uint64_t k = key(attr);
+	for(uint32_t i = slot(k, size); ; i = (i + 1) & mask) {
+		if(set[i] == k) {
+			return true;
+		}
+		if(set[i] == NODETABLE_EMPTY) {
+			return false;
+		}
+	}
+}
+
+bool NodeTable::handleFrame(uint8_t type, uint8_t *buffer, uint16_t length, uint32_t now) {
+	/* Every frame from a registered node starts with its ID */
+	if(length < sizeof(HeaderInfo) + 3) {
+		return false;
+	}
+	HeaderInfo *header = (HeaderInfo *)buffer;
+	uint8_t *data = &(buffer[sizeof(HeaderInfo)]);
+	if(header->dataCount == 0 || data[0] != USHORT) {
+		return false;
+	}
+	uint16_t nodeID;
+	memcpy(&nodeID, &(data[1]), sizeof(nodeID));
+	if(this->state[nodeID] == NODE_UNUSED) {
+		return false;
+	}
+	this->seen(nodeID, now);
+
+	if(type != ATTR_REGISTER && type != ATTR_POST) {
+		return true;
+	}
+
+	/* Registrations and posts are NID, GID, AID, ATTRNUM, value */
+	DataItem items[5];
+	HeaderInfo identHeader = *header;
+	identHeader.dataCount = 4;
+	if(header->dataCount < 5 || !EMonCMS::parseDataItems(&identHeader, data, items, length - sizeof(HeaderInfo))) {
+		return false;
+	}
+	for(uint8_t i = 1; i < 4; i++) {
+		if(items[i].type != USHORT) {
+			LOG(F("NodeTable: attribute identifier is not USHORTs\r\n"));
+			return false;
+		}
+	}
+	AttributeIdentifier ident;
+	memcpy(&(ident.groupID), items[1].item, sizeof(uint16_t));
+	memcpy(&(ident.attributeID), items[2].item, sizeof(uint16_t));
+	memcpy(&(ident.attributeNumber), items[3].item, sizeof(uint16_t));
+
+	if(type == ATTR_REGISTER) {
+		return this->addAttribute(nodeID, &ident);
+	}
+	return this->hasAttribute(nodeID, &ident);
+}
+
+uint8_t NodeTable::getState(uint16_t nodeID) {
+	return this->state[nodeID];
+}
+
+uint32_t NodeTable::getLastSeen(uint16_t nodeID) {
+	return this->lastSeen[nodeID];
+}
+
+uint16_t NodeTable::getAttributeCount(uint16_t nodeID) {
+	return this->attrCount[nodeID];
+}
+
+uint32_t NodeTable::getArenaUsed() {
+	return this->arenaUsed;
+}
+
+#endif
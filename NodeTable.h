@@ -0,0 +1,136 @@
+#ifndef __NODETABLE_H__
+#define __NODETABLE_H__
+
+#ifdef LINUX
+
+#include "EMonCMS.h"
+
+#define NODETABLE_SIZE 65536 /** one entry per 16 bit node ID **/
+#define NODETABLE_NONE 0xFFFFFFFF /** no attribute set **/
+#define NODETABLE_EMPTY 0xFFFFFFFFFFFFFFFFULL /** unused attribute set slot **/
+#define NODETABLE_MIN_SET 2 /** log2 of the smallest attribute set **/
+#define NODETABLE_MAX_SET 16 /** log2 of the largest attribute set **/
+
+/**
+ * Registration state of a node ID
+ **/
+enum NodeState {
+	NODE_UNUSED = 0, /** ID not given out **/
+	NODE_ASSIGNED, /** ID given out, nothing heard from the node since **/
+	NODE_ACTIVE /** node has sent frames with its ID **/
+};
+
+/**
+ * Gateway table of every node and its registered attributes. Per node
+ * fields are stored as separate arrays indexed directly by node ID, and
+ * each node's attributes are an open addressed hash set of packed
+ * identifiers carved out of one preallocated arena. Freed sets go on a
+ * free list per size and are reused when nodes come and go, so handling
+ * a frame never allocates.
+ *
+ * The per node arrays make the table around 800KB, so create it with new.
+ **/
+class NodeTable {
+	public:
+		/**
+		 * @param arenaSlots number of attribute slots shared by all nodes
+		 **/
+		NodeTable(uint32_t arenaSlots);
+		~NodeTable();
+		/**
+		 * Gives out the next unused node ID, for a NODE_REGISTER request
+		 * @return the ID, 0 if every ID is in use
+		 **/
+		uint16_t allocate();
+		/**
+		 * Marks a node ID as given out
+		 * @return false for the reserved ID 0
+		 **/
+		bool assign(uint16_t nodeID);
+		/**
+		 * Forgets a node and frees its attribute set
+		 **/
+		void remove(uint16_t nodeID);
+		/**
+		 * Records that a node has been heard from
+		 * @param now current time
+		 **/
+		void seen(uint16_t nodeID, uint32_t now);
+		/**
+		 * Adds an attribute to a node's registered set
+		 * @return false if the node is unused or the arena is full
+		 **/
+		bool addAttribute(uint16_t nodeID, AttributeIdentifier *attr);
+		/**
+		 * @return true if the attribute is registered for the node
+		 **/
+		bool hasAttribute(uint16_t nodeID, AttributeIdentifier *attr);
+		/**
+		 * Updates the table from a frame received from a node: registers
+		 * attributes from ATTR_REGISTER requests and records the time.
+		 * @param type type of the frame
+		 * @param buffer the whole frame, including header
+		 * @param length length of the frame
+		 * @param now current time
+		 * @return true if the frame is from a known node and, for posts
+		 *  and registrations, about a registered attribute
+		 **/
+		bool handleFrame(uint8_t type, uint8_t *buffer, uint16_t length, uint32_t now);
+		/**
+		 * @return state of the node, a NodeState
+		 **/
+		uint8_t getState(uint16_t nodeID);
+		/**
+		 * @return time the node was last heard from
+		 **/
+		uint32_t getLastSeen(uint16_t nodeID);
+		/**
+		 * @return number of attributes registered for the node
+		 **/
+		uint16_t getAttributeCount(uint16_t nodeID);
+		/**
+		 * @return arena slots handed out, including ones on free lists
+		 **/
+		uint32_t getArenaUsed();
+	protected:
+		uint32_t lastSeen[NODETABLE_SIZE]; /** time each node was last heard **/
+		uint32_t attrSet[NODETABLE_SIZE]; /** arena offset of each node's set **/
+		uint16_t attrCount[NODETABLE_SIZE]; /** attributes in each node's set **/
+		uint8_t attrSetSize[NODETABLE_SIZE]; /** log2 of each node's set capacity **/
+		uint8_t state[NODETABLE_SIZE]; /** NodeState of each node **/
+		uint64_t *arena; /** attribute slots **/
+		uint32_t arenaSlots; /** size of the arena **/
+		uint32_t arenaUsed; /** bump allocation point **/
+		uint32_t freeSets[NODETABLE_MAX_SET + 1]; /** free list heads by log2 size **/
+		uint16_t nextID; /** where allocate starts looking **/
+
+		/**
+		 * Takes a set of 2^size slots from the free list or arena
+		 * @return arena offset, NODETABLE_NONE if full
+		 **/
+		uint32_t allocateSet(uint8_t size);
+		/**
+		 * Returns a set to its free list
+		 **/
+		void freeSet(uint32_t offset, uint8_t size);
+		/**
+		 * Inserts a key into a set known to have room
+		 **/
+		void insert(uint64_t *set, uint8_t size, uint64_t key);
+		/**
+		 * @return the packed form of an attribute identifier
+		 **/
+		static inline uint64_t key(AttributeIdentifier *attr) {
+			return ((uint64_t)attr->groupID << 32) | ((uint32_t)attr->attributeID << 16) | attr->attributeNumber;
+		}
+		/**
+		 * @return home slot of a key in a set of 2^size slots
+		 **/
+		static inline uint32_t slot(uint64_t key, uint8_t size) {
+			return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - size));
+		}
+};
+
+#endif
+
+#endif
@@ -0,0 +1,191 @@
+#ifdef LINUX
+
+#include "RadioSimulator.h"
+#include "Debug.h"
+
+RadioSimulator *RadioSimulator::active = NULL;
+
+RadioSimulator::RadioSimulator(uint32_t bitrate, uint32_t latency, uint16_t lossPerMille, uint32_t seed) {
+	this->bitrate = bitrate > 0 ? bitrate : 1;
+	this->latency = (uint64_t)latency * 1000;
+	this->lossPerMille = lossPerMille;
+	this->random = seed != 0 ? seed : 1;
+	this->nodeCount = 0;
+	this->gateway = NULL;
+	this->head = 0;
+	this->count = 0;
+	this->echoHead = 0;
+	this->echoCount = 0;
+	this->duplicatePerMille = 0;
+	this->echoDelay = 0;
+	this->time = 0;
+	this->channelFree = 0;
+	this->airtime = 0;
+	this->framesSent = 0;
+	this->framesLost = 0;
+	this->framesDuplicated = 0;
+	RadioSimulator::active = this;
+}
+
+RadioSimulator::~RadioSimulator() {
+	if(RadioSimulator::active == this) {
+		RadioSimulator::active = NULL;
+	}
+}
+
+bool RadioSimulator::addNode(EMonCMS *node) {
+	if(this->nodeCount >= SIM_MAX_NODES) {
+		return false;
+	}
+	node->setClock(&(this->clock));
+	this->nodes[this->nodeCount++] = node;
+	return true;
+}
+
+void RadioSimulator::setGateway(GatewayReceiver receiver) {
+	this->gateway = receiver;
+}
+
+void RadioSimulator::setDuplication(uint16_t perMille, uint32_t delay) {
+	this->duplicatePerMille = perMille;
+	this->echoDelay = (uint64_t)delay * 1000;
+}
+
+uint16_t RadioSimulator::gatewaySender(uint8_t type, uint8_t *buffer, uint16_t length) {
+	return RadioSimulator::active == NULL ? 0 : RadioSimulator::active->transmit(false, type, buffer, length);
+}
+
+uint16_t RadioSimulator::nodeSender(uint8_t type, uint8_t *buffer, uint16_t length) {
+	return RadioSimulator::active == NULL ? 0 : RadioSimulator::active->transmit(true, type, buffer, length);
+}
+
+uint32_t RadioSimulator::nextRandom() {
+	this->random ^= this->random << 13;
+	this->random ^= this->random >> 17;
+	this->random ^= this->random << 5;
+	return this->random;
+}
+
+uint16_t RadioSimulator::transmit(bool toGateway, uint8_t type, uint8_t *buffer, uint16_t length) {
+	if(length > SIM_MTU || this->count >= SIM_MAX_FRAMES) {
+		LOG(F("RadioSimulator: frame dropped\r\n"));
+		return 0;
+	}
+
+	/* The channel is shared so a frame waits for the one before it */
+	uint64_t start = this->channelFree > this->time ? this->channelFree : this->time;
+	uint64_t duration = (uint64_t)(length + SIM_FRAME_OVERHEAD) * 8 * 1000000 / this->bitrate;
+	this->channelFree = start + duration;
+	this->airtime += duration;
+	this->framesSent++;
+
+	/* lost frames still used the channel */
+	if(this->nextRandom() % 1000 < this->lossPerMille) {
+		this->framesLost++;
+		return length;
+	}
+
+	SimFrame *frame = &(this->frames[(this->head + this->count) % SIM_MAX_FRAMES]);
+	frame->deliverAt = this->channelFree + this->latency;
+	frame->toGateway = toGateway;
+	frame->type = type;
+	frame->length = length;
+	memcpy(frame->data, buffer, length);
+	this->count++;
+
+	/* Every copy has the same delay, so the duplicates stay in delivery order */
+	if(toGateway && this->duplicatePerMille > 0 && this->echoCount < SIM_MAX_ECHOES
+			&& this->nextRandom() % 1000 < this->duplicatePerMille) {
+		SimFrame *echo = &(this->echoes[(this->echoHead + this->echoCount) % SIM_MAX_ECHOES]);
+		*echo = *frame;
+		echo->deliverAt += this->echoDelay;
+		this->echoCount++;
+	}
+	return length;
+}
+
+void RadioSimulator::deliver(SimFrame *frame) {
+	if(frame->toGateway) {
+		if(this->gateway != NULL) {
+			this->gateway(frame->type, frame->data, frame->length, this->now());
+		}
+		return;
+	}
+
+	HeaderInfo *header = (HeaderInfo *)frame->data;
+	if(frame->length < sizeof(HeaderInfo) + 3 || header->dataCount == 0 || header->dataCount > SIM_MAX_ITEMS
+			|| header->dataSize > frame->length - sizeof(HeaderInfo) || frame->data[sizeof(HeaderInfo)] != USHORT) {
+		return;
+	}
+	uint16_t nodeID;
+	memcpy(&nodeID, &(frame->data[sizeof(HeaderInfo) + 1]), sizeof(nodeID));
+
+	for(uint16_t i = 0; i < this->nodeCount; i++) {
+		if(this->nodes[i]->getNodeID() == nodeID) {
+			DataItem items[SIM_MAX_ITEMS];
+			this->nodes[i]->parseEMonCMSPacket(header, frame->type, &(frame->data[sizeof(HeaderInfo)]), items);
+			return;
+		}
+	}
+}
+
+void RadioSimulator::runUntil(uint32_t time) {
+	uint64_t end = (uint64_t)time * 1000;
+	/* Frames are queued in delivery order, replies are appended as they're
+	 *  sent. Duplicates are merged in from their own queue.
+	 */
+	while(true) {
+		bool echo = this->echoCount > 0 && this->echoes[this->echoHead].deliverAt <= end
+			&& (this->count == 0 || this->echoes[this->echoHead].deliverAt < this->frames[this->head].deliverAt);
+		SimFrame frame;
+		if(echo) {
+			frame = this->echoes[this->echoHead];
+			this->echoHead = (this->echoHead + 1) % SIM_MAX_ECHOES;
+			this->echoCount--;
+			this->framesDuplicated++;
+		} else if(this->count > 0 && this->frames[this->head].deliverAt <= end) {
+			frame = this->frames[this->head];
+			this->head = (this->head + 1) % SIM_MAX_FRAMES;
+			this->count--;
+		} else {
+			break;
+		}
+		this->setTime(frame.deliverAt);
+		this->deliver(&frame);
+	}
+	this->setTime(end);
+}
+
+void RadioSimulator::setTime(uint64_t us) {
+	if(us > this->time) {
+		this->time = us;
+		this->clock.set((uint32_t)(us / 1000));
+		this->clock.advanceMicros((uint32_t)(us % 1000));
+	}
+}
+
+EMonClock *RadioSimulator::getClock() {
+	return &(this->clock);
+}
+
+uint32_t RadioSimulator::now() {
+	return (uint32_t)(this->time / 1000);
+}
+
+uint32_t RadioSimulator::getFramesSent() {
+	return this->framesSent;
+}
+
+uint32_t RadioSimulator::getFramesLost() {
+	return this->framesLost;
+}
+
+uint32_t RadioSimulator::getFramesDuplicated() {
+	return this->framesDuplicated;
+}
+
+uint32_t RadioSimulator::getAirtime() {
+	return (uint32_t)(this->airtime / 1000);
+}
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef __RADIOSIMULATOR_H__
+#define __RADIOSIMULATOR_H__
+
+#ifdef LINUX
+
+#include "EMonCMS.h"
+#include "EMonClock.h"
+
+#define SIM_MAX_NODES 256 /** nodes attached to the simulated channel **/
+#define SIM_MAX_FRAMES 1024 /** frames in flight **/
+#define SIM_MTU EMONCMS_MTU /** largest frame the channel carries **/
+#define SIM_FRAME_OVERHEAD 12 /** preamble, sync, length and crc bytes per frame **/
+#define SIM_MAX_ECHOES 256 /** duplicate frames in flight **/
+#define SIM_MAX_ITEMS ((SIM_MTU - sizeof(HeaderInfo)) / 2) /** items in a delivered frame, all 2 byte UCHARs at most **/
+
+/**
+ * Receives frames addressed to the gateway
+ * @param type packet type
+ * @param buffer the whole packet, including header
+ * @param length length of the packet
+ * @param now simulated time in ms
+ **/
+typedef void (*GatewayReceiver)(uint8_t type, uint8_t *buffer, uint16_t length, uint32_t now);
+
+/**
+ * A frame on the simulated channel
+ **/
+typedef struct {
+	uint64_t deliverAt; /** simulated time in us the frame arrives **/
+	bool toGateway; /** direction of the frame **/
+	uint8_t type; /** packet type **/
+	uint16_t length; /** length of data **/
+	uint8_t data[SIM_MTU]; /** the packet **/
+} SimFrame;
+
+/**
+ * Discrete time simulation of a single shared half duplex radio channel
+ * between a gateway and EMonCMS nodes. Frames occupy the channel for
+ * their airtime, arrive after a fixed turnaround latency and may be
+ * lost. Frames to nodes are routed by the node ID in their first item.
+ *
+ * Frames to the gateway can also be duplicated, as if heard by a second
+ * gateway further away, with the copy arriving a fixed delay later and
+ * so out of order with frames sent in between.
+ *
+ * Only one simulator is active at a time, as nodes are given the plain
+ * function nodeSender as their NetworkSender.
+ **/
+class RadioSimulator {
+	public:
+		/**
+		 * @param bitrate channel bitrate in bits per second
+		 * @param latency turnaround from end of transmission to delivery in ms
+		 * @param lossPerMille frames lost out of every thousand
+		 * @param seed seed for the loss generator
+		 **/
+		RadioSimulator(uint32_t bitrate, uint32_t latency, uint16_t lossPerMille, uint32_t seed);
+		~RadioSimulator();
+		/**
+		 * Attaches a node, which must use nodeSender as its NetworkSender.
+		 * The node is switched to the simulator's clock.
+		 * @return false if the node table is full
+		 **/
+		bool addNode(EMonCMS *node);
+		/**
+		 * @param receiver callback for frames sent by nodes
+		 **/
+		void setGateway(GatewayReceiver receiver);
+		/**
+		 * Delivers some frames to the gateway twice
+		 * @param perMille frames duplicated out of every thousand delivered
+		 * @param delay ms the copy arrives after the frame
+		 **/
+		void setDuplication(uint16_t perMille, uint32_t delay);
+		/**
+		 * NetworkSender for the gateway side
+		 **/
+		static uint16_t gatewaySender(uint8_t type, uint8_t *buffer, uint16_t length);
+		/**
+		 * NetworkSender for the nodes
+		 **/
+		static uint16_t nodeSender(uint8_t type, uint8_t *buffer, uint16_t length);
+		/**
+		 * Queues a frame on the channel
+		 * @return length on success, 0 if it can't be carried
+		 **/
+		uint16_t transmit(bool toGateway, uint8_t type, uint8_t *buffer, uint16_t length);
+		/**
+		 * Delivers every frame due up to the given time and moves the clock there
+		 * @param time simulated time in ms
+		 **/
+		void runUntil(uint32_t time);
+		/**
+		 * @return simulated time in ms
+		 **/
+		uint32_t now();
+		/**
+		 * @return clock following simulated time
+		 **/
+		EMonClock *getClock();
+		/**
+		 * @return frames put on the channel
+		 **/
+		uint32_t getFramesSent();
+		/**
+		 * @return frames lost on the channel
+		 **/
+		uint32_t getFramesLost();
+		/**
+		 * @return duplicate frames delivered to the gateway
+		 **/
+		uint32_t getFramesDuplicated();
+		/**
+		 * @return ms the channel has been transmitting
+		 **/
+		uint32_t getAirtime();
+	protected:
+		static RadioSimulator *active; /** simulator the static senders use **/
+		EMonCMS *nodes[SIM_MAX_NODES]; /** attached nodes **/
+		uint16_t nodeCount; /** number of attached nodes **/
+		GatewayReceiver gateway; /** gateway frame callback **/
+		SimFrame frames[SIM_MAX_FRAMES]; /** ring of frames in flight, in delivery order **/
+		uint16_t head; /** next frame to deliver **/
+		uint16_t count; /** frames in flight **/
+		SimFrame echoes[SIM_MAX_ECHOES]; /** ring of duplicates in flight, in delivery order **/
+		uint16_t echoHead; /** next duplicate to deliver **/
+		uint16_t echoCount; /** duplicates in flight **/
+		uint16_t duplicatePerMille; /** duplication rate **/
+		uint64_t echoDelay; /** us a duplicate arrives after its frame **/
+		uint64_t time; /** simulated time in us **/
+		SimulatedClock clock; /** time as seen by the nodes **/
+		uint64_t channelFree; /** us time the channel is next idle **/
+		uint64_t airtime; /** us spent transmitting **/
+		uint32_t bitrate; /** bits per second **/
+		uint64_t latency; /** turnaround in us **/
+		uint16_t lossPerMille; /** loss rate **/
+		uint32_t random; /** xorshift state **/
+		uint32_t framesSent; /** frames put on the channel **/
+		uint32_t framesLost; /** frames lost **/
+		uint32_t framesDuplicated; /** duplicates delivered **/
+
+		/**
+		 * Moves simulated time on, never backwards
+		 * @param us new time in us
+		 **/
+		void setTime(uint64_t us);
+		/**
+		 * Hands a frame to its receiver
+		 **/
+		void deliver(SimFrame *frame);
+		/**
+		 * @return next pseudo random number
+		 **/
+		uint32_t nextRandom();
+};
+
+#endif
+
+#endif
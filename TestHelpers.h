@@ -0,0 +1,34 @@
+#ifndef __TESTHELPERS_H__
+#define __TESTHELPERS_H__
+
+#ifdef LINUX
+
+#include <cstdio>
+#include <dirent.h>
+#include <unistd.h>
+
+/**
+ * Removes a temporary feed directory and the feed files in it, shared by
+ * the tests and benchmarks
+ * @param directory directory made with mkdtemp
+ **/
+inline void removeFeedDirectory(const char *directory) {
+	DIR *dir = opendir(directory);
+	if(dir == NULL) {
+		return;
+	}
+	struct dirent *entry;
+	char path[512];
+	while((entry = readdir(dir)) != NULL) {
+		if(entry->d_name[0] != '.') {
+			snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+			unlink(path);
+		}
+	}
+	closedir(dir);
+	rmdir(directory);
+}
+
+#endif
+
+#endif